@@ -0,0 +1,184 @@
+#pragma once
+
+#include "BHM_Module.h"
+#include "BHM_ThreadPool.h"
+
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <functional>
+#include <filesystem>
+
+namespace bhd
+{
+	/// <summary>
+	/// Stage of an image in a batch run
+	/// </summary>
+	enum class BATCH_STAGE
+	{
+		DECODE = 0,		//cv::imread
+		PROCESS,		//Module processing
+		ENCODE,			//cv::imwrite
+		N_COUNT
+	};
+
+	//! Return the name of a batch stage
+	const char* to_string(BATCH_STAGE stage) noexcept;
+
+	/// <summary>
+	/// Options of a batch run (see batch_runner)
+	/// </summary>
+	struct batch_options
+	{
+		std::filesystem::path m_output_directory;	//Processed images are written here with the input filename, empty to skip the encoding
+		std::filesystem::path m_output_extension;	//Extension of the written images (".png"...), empty to keep the input one
+		int m_imread_flags = cv::IMREAD_UNCHANGED;
+		std::vector<int> m_imwrite_params;			//See cv::imwrite
+		std::size_t m_max_in_flight = 0;			//Maximum number of images between decode and encode (memory bound), 0 for twice the pool size
+		bool m_stop_on_error = false;				//Stop queuing new images after the first failure
+	};
+
+	/// <summary>
+	/// Result of a single image of a batch run
+	/// </summary>
+	struct batch_item
+	{
+		std::filesystem::path m_input;
+		std::filesystem::path m_output;		//Empty if the image is not written
+		double m_decode_ms = 0.0;
+		double m_process_ms = 0.0;
+		double m_encode_ms = 0.0;
+		double m_total_ms = 0.0;			//From the decode start to the end of the last stage, waits between stages included
+		BATCH_STAGE m_stage = BATCH_STAGE::N_COUNT;		//Failed stage, N_COUNT on success or if the image was skipped
+		std::string m_error;				//Empty on success
+		bool m_skipped = false;				//Not queued (the run stopped on a previous failure)
+
+		//! Return true if the image went through every stage
+		bool ok() const noexcept { return m_error.empty() && !m_skipped; }
+	};
+
+	/// <summary>
+	/// Report of a batch run: one item per input image (in the input order), and the summary of the run.
+	/// </summary>
+	struct batch_report
+	{
+		std::vector<batch_item> m_items;
+		std::size_t m_workers = 0;
+		double m_wall_ms = 0.0;
+
+		std::size_t succeeded() const noexcept;
+		std::size_t failed() const noexcept;
+		std::size_t skipped() const noexcept;
+
+		//! Processed images per second (wall time)
+		double throughput() const noexcept;
+
+		//! Human readable summary: counts, throughput, percentiles of each stage and list of the failures
+		std::string to_string() const;
+
+		//! Write one line per image (input, status, stage timings, error)
+		void write_csv(const std::filesystem::path& path) const;
+	};
+
+	/// <summary>
+	/// Parallel batch processing of images with a module.
+	/// Each image goes through three tasks on the pool: decode (low priority), process, encode (high priority),
+	/// so that the workers finish the images already in memory before loading new ones, and the decode / encode
+	/// of some images overlaps the processing of the others. The number of images in flight is bounded.
+	/// Every process task checks out its own module instance, created by the factory and configured as the prototype:
+	/// the module needs no lock, as long as the process function only uses the module it receives. An instance is never
+	/// shared, even when a worker waiting inside a process function (ex: parallel_for) runs the process task of another image.
+	/// Ex:
+	/// bhd::batch_runner runner(
+	///		[] { return std::make_unique<BilateralModule>(); },
+	///		[](bhd::IModule& module, const cv::Mat& in, cv::Mat& out) { static_cast<BilateralModule&>(module).Execute(in, out); },
+	///		options);
+	/// runner.prototype().ImportFile("bilateral.json");
+	/// auto report = runner.run("images/");
+	/// </summary>
+	class batch_runner
+	{
+	public:
+
+		using module_factory = std::function<std::unique_ptr<IModule>()>;
+		using process_function = std::function<void(IModule&, const cv::Mat&, cv::Mat&)>;
+		using progress_function = std::function<void(const batch_item&, std::size_t done, std::size_t total)>;
+
+		/// <summary>
+		/// Batch runner
+		/// </summary>
+		/// <param name="factory">Create a new module instance (called on the calling thread of the constructor and of run, and on a worker when the instances are all in use: never concurrently)</param>
+		/// <param name="process">Process an image with a module instance. Called concurrently, each time with a different instance</param>
+		/// <param name="options">Output and scheduling options</param>
+		/// <param name="pool">Pool running the stages</param>
+		batch_runner(module_factory factory, process_function process, batch_options options = {}, thread_pool& pool = thread_pool::instance());
+
+		batch_runner(const batch_runner&) = delete;
+		batch_runner& operator=(const batch_runner&) = delete;
+
+		//! Module holding the configuration copied into the worker instances at each run (ImportFile, GUI...)
+		IModule& prototype() noexcept { return *m_prototype; }
+		const IModule& prototype() const noexcept { return *m_prototype; }
+
+		batch_options& options() noexcept { return m_options; }
+		const batch_options& options() const noexcept { return m_options; }
+
+		//! Callback called after each image (serialized: it does not have to be thread safe)
+		void set_progress(progress_function progress) { m_progress = std::move(progress); }
+
+		/// <summary>
+		/// Process every image of a directory (see GetImgFromDir), in the filename order.
+		/// Must not be called from a worker of the pool.
+		/// </summary>
+		batch_report run(const std::filesystem::path& directory);
+
+		/// <summary>
+		/// Process a list of images. Must not be called from a worker of the pool.
+		/// </summary>
+		batch_report run(std::vector<std::filesystem::path> files);
+
+	private:
+
+		struct run_state;
+
+		module_factory m_factory;
+		process_function m_process;
+		batch_options m_options;
+		thread_pool& m_pool;
+		progress_function m_progress;
+
+		std::unique_ptr<IModule> m_prototype;
+		std::vector<std::unique_ptr<IModule>> m_modules;	//At least one per worker, configured at each run
+		std::vector<IModule*> m_free;						//Instances not used by a process task
+		std::mutex m_modules_mutex;							//Protects m_modules and m_free during a run
+
+		IModule& acquire_module();
+		void release_module(IModule& module) noexcept;
+
+		void decode(run_state& state, std::size_t index) noexcept;
+		void process(run_state& state, std::size_t index, const cv::Mat& image) noexcept;
+		void encode(run_state& state, std::size_t index, const cv::Mat& image) noexcept;
+		void fail(run_state& state, std::size_t index, BATCH_STAGE stage, std::exception_ptr error) noexcept;
+		void finish(run_state& state, std::size_t index) noexcept;
+	};
+
+	/// <summary>
+	/// Create a batch runner from a factory of a concrete module type: the process function receives this type.
+	/// Ex:
+	/// auto runner = bhd::make_batch_runner(
+	///		[] { return std::make_unique<BilateralModule>(); },
+	///		[](BilateralModule& module, const cv::Mat& in, cv::Mat& out) { module.Execute(in, out); });
+	/// </summary>
+	template<class TFactory, class TProcess>
+	batch_runner make_batch_runner(TFactory factory, TProcess process, batch_options options = {}, thread_pool& pool = thread_pool::instance())
+	{
+		using module_t = typename std::invoke_result_t<TFactory&>::element_type;
+		static_assert(std::is_base_of_v<IModule, module_t>, "The factory must return a std::unique_ptr of a module");
+
+		return batch_runner(
+			[factory = std::move(factory)]() mutable -> std::unique_ptr<IModule> { return factory(); },
+			[process = std::move(process)](IModule& module, const cv::Mat& in, cv::Mat& out) { process(static_cast<module_t&>(module), in, out); },
+			std::move(options),
+			pool);
+	}
+}
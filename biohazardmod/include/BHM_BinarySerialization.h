@@ -0,0 +1,264 @@
+#pragma once
+
+#include <bit>
+#include <array>
+#include <span>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string_view>
+#include <type_traits>
+
+namespace bhd
+{
+	/// <summary>
+	/// Compact binary encoding of configurable values (see module_snapshot).
+	///
+	/// Layout (little endian, every block aligned on 8 bytes):
+	///		- file_header, module key
+	///		- entries: entry_header, path ("SUB/KEY"), payload
+	///		- index: index_entry (path hash, entry offset) sorted by hash, for key lookups
+	/// Numeric values and arrays of numeric values are stored raw: arrays are read in place (zero copy).
+	/// Other values are stored as their string value (IConfigurable::GetStringValue), as in the text format.
+	/// </summary>
+	namespace binary
+	{
+		static_assert(std::endian::native == std::endian::little, "The binary format is little endian");
+
+		constexpr std::uint32_t MAGIC = 0x534D4842;		//"BHMS"
+		constexpr std::uint16_t VERSION = 1;
+		constexpr std::size_t ALIGNMENT = 8;
+		constexpr const char* FILE_EXTENSION = ".bhms";
+
+		/// <summary>
+		/// Type of the stored values
+		/// </summary>
+		enum class ELEMENT : std::uint8_t
+		{
+			TEXT = 0,		//String value
+			BOOL,
+			INT8,
+			UINT8,
+			INT16,
+			UINT16,
+			INT32,
+			UINT32,
+			INT64,
+			UINT64,
+			FLOAT32,
+			FLOAT64,
+			BYTES,			//Plain value structure, see raw_structure (cv::Rect, cv::Range...)
+			N_COUNT
+		};
+
+		const char* to_string(ELEMENT element) noexcept;
+
+		struct file_header
+		{
+			std::uint32_t m_magic = MAGIC;
+			std::uint16_t m_version = VERSION;
+			std::uint16_t m_flags = 0;
+			std::uint32_t m_entries = 0;
+			std::uint32_t m_key_size = 0;
+			std::uint64_t m_index_offset = 0;
+			std::uint64_t m_size = 0;			//Total size in bytes
+		};
+
+		struct entry_header
+		{
+			std::uint32_t m_path_size = 0;
+			ELEMENT m_element = ELEMENT::TEXT;
+			std::uint8_t m_array = 0;
+			std::uint16_t m_reserved = 0;
+			std::uint64_t m_count = 0;			//Number of elements (1 for a scalar)
+			std::uint64_t m_bytes = 0;			//Payload size
+		};
+
+		struct index_entry
+		{
+			std::uint64_t m_hash = 0;
+			std::uint64_t m_offset = 0;
+		};
+
+		static_assert(sizeof(file_header) == 32 && sizeof(entry_header) == 24 && sizeof(index_entry) == 16, "Unexpected binary header padding");
+
+		constexpr std::size_t align(std::size_t offset) noexcept {
+			return (offset + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+		}
+
+		/// <summary>
+		/// Structures stored raw (ELEMENT::BYTES). Opt-in: being trivially copyable is not enough, a structure holding a
+		/// pointer or a handle would be saved as an address. Specialize it for plain value structures:
+		/// template<> struct bhd::binary::raw_structure<MyRoi> : std::true_type {};
+		/// The OpenCV value types (cv::Point_, cv::Rect_, cv::Scalar_, cv::Vec...) are declared by BHM_Configurable.h.
+		/// </summary>
+		template<class T>
+		struct raw_structure : std::false_type {};
+
+		template<class T, std::size_t N>
+		struct raw_structure<std::array<T, N>> : std::bool_constant<std::is_arithmetic_v<T> || raw_structure<T>::value> {};
+
+		/// <summary>
+		/// Element type of T: TEXT if the value is stored as a string
+		/// </summary>
+		template<class T>
+		constexpr ELEMENT element_of()
+		{
+			if constexpr (std::is_enum_v<T>)
+				return element_of<std::underlying_type_t<T>>();
+			else if constexpr (std::is_same_v<T, bool>)
+				return ELEMENT::BOOL;
+			else if constexpr (std::is_integral_v<T>)
+			{
+				constexpr ELEMENT signed_types[] = { ELEMENT::INT8, ELEMENT::INT16, ELEMENT::INT32, ELEMENT::INT64 };
+				constexpr ELEMENT unsigned_types[] = { ELEMENT::UINT8, ELEMENT::UINT16, ELEMENT::UINT32, ELEMENT::UINT64 };
+				constexpr std::size_t index = std::bit_width(sizeof(T)) - 1;
+				return std::is_signed_v<T> ? signed_types[index] : unsigned_types[index];
+			}
+			else if constexpr (std::is_same_v<T, float>)
+				return ELEMENT::FLOAT32;
+			else if constexpr (std::is_same_v<T, double>)
+				return ELEMENT::FLOAT64;
+			else if constexpr (raw_structure<T>::value)
+			{
+				static_assert(std::is_trivially_copyable_v<T>, "A raw structure must be trivially copyable");
+				return ELEMENT::BYTES;
+			}
+			else
+				return ELEMENT::TEXT;
+		}
+
+		namespace details
+		{
+			template<class T>
+			struct array_element { using type = void; };
+
+			template<class T, class TAlloc>
+			struct array_element<std::vector<T, TAlloc>> { using type = T; };
+		}
+
+		//! True if T is stored raw as a single value
+		template<class T>
+		constexpr bool is_scalar_v = element_of<T>() != ELEMENT::TEXT;
+
+		//! True if T is a std::vector stored raw (std::vector<bool> is not contiguous: stored as text)
+		template<class T>
+		constexpr bool is_array_v = !std::is_void_v<typename details::array_element<T>::type> &&
+			!std::is_same_v<typename details::array_element<T>::type, bool> &&
+			is_scalar_v<typename details::array_element<T>::type>;
+
+		/// <summary>
+		/// Value of an entry, pointing into the serialized bytes (valid as long as the bytes are)
+		/// </summary>
+		struct value_view
+		{
+			std::string_view m_path;
+			ELEMENT m_element = ELEMENT::TEXT;
+			bool m_array = false;
+			const std::uint8_t* m_data = nullptr;
+			std::size_t m_bytes = 0;
+			std::size_t m_count = 0;
+
+			bool is_numeric() const noexcept { return m_element >= ELEMENT::BOOL && m_element <= ELEMENT::FLOAT64; }
+			bool is_integral() const noexcept { return m_element >= ELEMENT::BOOL && m_element <= ELEMENT::UINT64; }
+
+			//! String value. Throws std::runtime_error if the value is not a text
+			std::string_view text() const;
+
+			//! Numeric scalar as a double / an integer (converted from the stored type). Throws std::runtime_error if not numeric
+			double to_double() const;
+			std::int64_t to_int64() const;
+
+			/// <summary>
+			/// Scalar value. A numeric value stored with another numeric type is converted.
+			/// Throws std::runtime_error if the types don't match.
+			/// </summary>
+			template<class T>
+			T scalar() const
+			{
+				constexpr ELEMENT element = element_of<T>();
+				static_assert(element != ELEMENT::TEXT, "Not a binary scalar type");
+				if (!m_array && m_element == element && m_bytes == sizeof(T))
+				{
+					T value;
+					std::memcpy(&value, m_data, sizeof(T));
+					return value;
+				}
+				if constexpr (std::is_arithmetic_v<T>)
+				{
+					if (!m_array && is_numeric())
+					{
+						if constexpr (std::is_integral_v<T>)
+							return is_integral() ? static_cast<T>(to_int64()) : static_cast<T>(to_double());
+						else
+							return static_cast<T>(to_double());
+					}
+				}
+				mismatch(element, false);
+				return {};
+			}
+
+			/// <summary>
+			/// Array values, read in place (no copy). Throws std::runtime_error if the types don't match.
+			/// </summary>
+			template<class T>
+			std::span<const T> span() const
+			{
+				constexpr ELEMENT element = element_of<T>();
+				static_assert(element != ELEMENT::TEXT, "Not a binary array type");
+				if (!m_array || m_element != element || m_bytes != m_count * sizeof(T) || reinterpret_cast<std::uintptr_t>(m_data) % alignof(T) != 0)
+					mismatch(element, true);
+				return { reinterpret_cast<const T*>(m_data), m_count };
+			}
+
+		private:
+			[[noreturn]] void mismatch(ELEMENT expected, bool array) const;
+		};
+
+		/// <summary>
+		/// Serializer of configurable values
+		/// </summary>
+		class writer
+		{
+		public:
+
+			/// <summary>
+			/// Start a serialization
+			/// </summary>
+			/// <param name="key">Module key (alias)</param>
+			/// <param name="buffer">Buffer to reuse (its capacity is kept)</param>
+			explicit writer(std::string_view key, std::vector<std::uint8_t> buffer = {});
+
+			//! Write a value of any element type
+			void write(std::string_view path, ELEMENT element, bool array, const void* data, std::size_t bytes, std::size_t count);
+
+			void write_text(std::string_view path, std::string_view text) {
+				write(path, ELEMENT::TEXT, false, text.data(), text.size(), text.size());
+			}
+
+			template<class T>
+			void write_scalar(std::string_view path, const T& value) {
+				static_assert(is_scalar_v<T>, "Not a binary scalar type");
+				write(path, element_of<T>(), false, &value, sizeof(T), 1);
+			}
+
+			template<class T>
+			void write_array(std::string_view path, const T* data, std::size_t count) {
+				static_assert(is_scalar_v<T>, "Not a binary array type");
+				write(path, element_of<T>(), true, data, count * sizeof(T), count);
+			}
+
+			//! Write the index and return the serialized bytes
+			std::vector<std::uint8_t> finish();
+
+		private:
+			std::vector<std::uint8_t> m_buffer;
+			std::vector<index_entry> m_index;
+
+			void append(const void* data, std::size_t size);
+			void pad();
+		};
+	}
+}
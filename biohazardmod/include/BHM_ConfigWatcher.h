@@ -0,0 +1,126 @@
+#pragma once
+
+#include "BHM_Module.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace bhd
+{
+	/// <summary>
+	/// Report of a configuration file reload (see config_watcher)
+	/// </summary>
+	struct config_reload
+	{
+		std::filesystem::path m_file;
+		std::string m_error;					//Import error, empty if the file was imported. A failed import applies nothing
+		std::vector<std::string> m_changed;		//Paths of the configurables changed by the reload
+		std::uint64_t m_imports = 0;			//File imports merged into this reload
+		double m_parse_ms = 0.0;				//Import of the file (watcher thread)
+		double m_apply_ms = 0.0;				//Swap of the new values (apply caller)
+		double m_latency_ms = 0.0;				//From the detection of the change to the end of the swap
+
+		bool ok() const noexcept { return m_error.empty(); }
+
+		std::string to_string() const;
+	};
+
+	/// <summary>
+	/// Hot reload of the configuration file of a module, for long running processes.
+	/// A watcher thread waits for the file changes (inotify on Linux, modification time polling elsewhere), imports the
+	/// file into a private clone of the module (see IModule::ImportFile, IModule::Clone) and keeps the values changed
+	/// by the import. The processing loop calls apply() between two frames: the new values are swapped in at once on its
+	/// own thread, a frame never sees a half applied file. No lock on apply() while nothing is pending.
+	/// A reload applies the values that the file changed since the previous import (the module values at the watcher
+	/// creation for the first one): the configurables edited elsewhere and untouched by the file are kept.
+	/// A failed import (syntax error, half written file) is reported without changing the module, and the clone is synced
+	/// again from the module by the next apply().
+	/// The module must be cloneable (see TCloneable) and its structure must not change while watched.
+	/// Ex:
+	/// bilateral.ImportFile("bilateral.json");
+	/// bhd::config_watcher watcher(bilateral, "bilateral.json");
+	/// while (capture.read(frame))
+	/// {
+	///		if (auto reload = watcher.apply())
+	///			logger.LogInfo(reload->to_string());
+	///		bilateral.Execute(frame, out);
+	/// }
+	/// </summary>
+	class config_watcher
+	{
+	public:
+
+		using clock = std::chrono::steady_clock;
+
+		/// <summary>
+		/// Start watching a configuration file.
+		/// </summary>
+		/// <param name="module">Module configured by the file</param>
+		/// <param name="file_path">Configuration file (any ImportFile format). It may not exist yet</param>
+		/// <param name="period">Polling period, when the file notifications are not available</param>
+		config_watcher(IModule& module, std::filesystem::path file_path, clock::duration period = std::chrono::milliseconds(500));
+
+		config_watcher(const config_watcher&) = delete;
+		config_watcher& operator=(const config_watcher&) = delete;
+
+		~config_watcher();
+
+		/// <summary>
+		/// Apply the pending reload, if any. To call from the thread running the module, between two uses.
+		/// </summary>
+		/// <returns>The reload report, std::nullopt if the file didn't change</returns>
+		std::optional<config_reload> apply();
+
+		//! A reload is waiting for apply()
+		bool pending() const noexcept { return m_has_pending.load(std::memory_order_acquire); }
+
+		//! The file changes are notified by the system (else polled)
+		bool notified() const noexcept { return m_notify_fd >= 0; }
+
+		const std::filesystem::path& file() const noexcept { return m_file; }
+
+	private:
+
+		struct pending_reload
+		{
+			std::vector<std::pair<std::size_t, std::shared_ptr<const void>>> m_values;	//Changed values, by configurable index
+			config_reload m_report;
+			bool m_resync = false;		//An import failed: the staging holds a part of the file
+			clock::time_point m_detected;
+		};
+
+		IModule& m_module;
+		std::filesystem::path m_file;
+		clock::duration m_period;
+
+		std::mutex m_staging_mutex;						//Import (watcher thread) and resync (apply caller) of the staging
+		std::unique_ptr<IModule> m_staging;				//Import target
+		std::vector<IConfigurable*> m_targets;			//Configurables of the module, in the staging visit order
+		std::vector<const IConfigurable*> m_sources;	//Configurables of the staging
+		std::vector<std::string> m_paths;				//Paths of the configurables (see IModule::FindConfigurable)
+
+		std::mutex m_mutex;
+		std::condition_variable m_condition;
+		bool m_stop = false;
+		std::optional<pending_reload> m_pending;
+		bool m_reimport = false;		//Import the file again, without waiting for a change
+		std::atomic<bool> m_has_pending = false;
+
+		int m_notify_fd = -1;		//inotify instance (Linux)
+		int m_wake_fd = -1;			//Wakes the watcher thread up on destruction (Linux)
+		std::thread m_thread;
+
+		void run();
+		bool wait_notification();
+		void reload(clock::time_point detected);
+		void wake();
+	};
+}
@@ -1,14 +1,37 @@
 #pragma once
 
 #include <optional>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <functional>
+#include <memory>
+#include <concepts>
 #include <cstdlib>
+#include <cmath>
+#include <algorithm>
 #include <typeindex>
 #include <opencv2\opencv.hpp>
 #include "BHM_Serialization.h"
+#include "BHM_Hash.h"
+#include "BHM_BinarySerialization.h"
 
 namespace bhd
 {
 
+	namespace binary
+	{
+		//OpenCV value types: only values, stored raw (see raw_structure)
+		template<class T> struct raw_structure<cv::Point_<T>> : std::true_type {};
+		template<class T> struct raw_structure<cv::Point3_<T>> : std::true_type {};
+		template<class T> struct raw_structure<cv::Size_<T>> : std::true_type {};
+		template<class T> struct raw_structure<cv::Rect_<T>> : std::true_type {};
+		template<class T> struct raw_structure<cv::Scalar_<T>> : std::true_type {};
+		template<class T, int N> struct raw_structure<cv::Vec<T, N>> : std::true_type {};
+		template<class T, int M, int N> struct raw_structure<cv::Matx<T, M, N>> : std::true_type {};
+		template<> struct raw_structure<cv::Range> : std::true_type {};
+	}
+
 	//Configurable default types (for quick recompilation needs)
 	namespace configurable_types
 	{
@@ -130,6 +153,49 @@ namespace bhd
 			return *this;
 		}
 
+		/// <summary>
+		/// Immutable copy of the value, shared by the parameter snapshots (see parameter_publisher)
+		/// </summary>
+		/// <returns>Pointer on a copy of the data</returns>
+		virtual std::shared_ptr<const void> SnapshotValue() const {
+			assert(0 && "not implemented (virtual function)");
+			return {};
+		}
+
+		/// <summary>
+		/// Set the value from a copy made by SnapshotValue (of a configurable of the same type)
+		/// </summary>
+		/// <param name="value">Pointer on the data</param>
+		virtual void RestoreValue(const void* value) {
+			assert(0 && "not implemented (virtual function)");
+		}
+
+		/// <summary>
+		/// Hash of the configurable key and value (cache keys, see module_cache).
+		/// By default the string value is hashed: override it for a cheaper hash.
+		/// </summary>
+		virtual std::uint64_t Hash() const {
+			return hash_string(GetStringValue(), hash_string(GetKey()));
+		}
+
+		/// <summary>
+		/// Write the value into a binary snapshot (see module_snapshot).
+		/// By default the string value is written: override it for a compact encoding.
+		/// </summary>
+		/// <param name="out">Binary writer</param>
+		/// <param name="path">Entry path of the configurable</param>
+		virtual void WriteBinary(binary::writer& out, std::string_view path) const {
+			out.write_text(path, GetStringValue());
+		}
+
+		/// <summary>
+		/// Read the value from a binary snapshot entry (see WriteBinary)
+		/// </summary>
+		/// <param name="value">Entry value</param>
+		virtual void ReadBinary(const binary::value_view& value) {
+			SetStringValue(std::string(value.text()));
+		}
+
 		/// <summary>
 		/// Get the type index of the configurable
 		/// </summary>
@@ -140,6 +206,82 @@ namespace bhd
 		/// Reset the configurable. Virtual function
 		/// </summary>
 		virtual void Reset() = 0;
+
+		// --- Change tracking ---
+		// Every effective change of the value (Set, operator=, SetStringValue, read, CopyTo...) increments the version of the
+		// configurable, stamps it with a new global generation and calls the change callbacks.
+		// The mutable accessors (Value(), operator*, operator->...) are not tracked: call MarkChanged after an in-place edit.
+
+		using change_callback_t = std::function<void(IConfigurable&)>;
+
+		//! Number of changes of the value
+		std::uint64_t Version() const noexcept { return m_version.load(std::memory_order_acquire); }
+
+		//! Generation of the last change (0 if never changed)
+		std::uint64_t Generation() const noexcept { return m_generation.load(std::memory_order_acquire); }
+
+		//! Current global generation: a configurable changed after it if its generation is greater
+		static std::uint64_t CurrentGeneration() noexcept { return GenerationCounter().load(std::memory_order_acquire); }
+
+		/// <summary>
+		/// Record a change of the value and call the change callbacks
+		/// </summary>
+		void MarkChanged()
+		{
+			m_version.fetch_add(1, std::memory_order_acq_rel);
+			m_generation.store(GenerationCounter().fetch_add(1, std::memory_order_acq_rel) + 1, std::memory_order_release);
+
+			//Called unlocked, on a snapshot of the list: a callback may change the value or add / remove callbacks
+			std::shared_ptr<const callback_list_t> callbacks;
+			{
+				const std::lock_guard<std::mutex> lock(m_callbacksMutex);
+				callbacks = m_callbacks;
+			}
+			if (callbacks)
+				for (const auto& [id, callback] : *callbacks)
+					callback(*this);
+		}
+
+		/// <summary>
+		/// Add a callback called after each change, on the thread making the change.
+		/// A callback added or removed during a change takes effect from the next change.
+		/// </summary>
+		/// <param name="callback">Callback</param>
+		/// <returns>Id of the callback (see RemoveChangeCallback)</returns>
+		std::size_t AddChangeCallback(change_callback_t callback)
+		{
+			const std::lock_guard<std::mutex> lock(m_callbacksMutex);
+			auto callbacks = m_callbacks ? std::make_shared<callback_list_t>(*m_callbacks) : std::make_shared<callback_list_t>();
+			callbacks->emplace_back(++m_lastCallbackId, std::move(callback));
+			m_callbacks = std::move(callbacks);
+			return m_lastCallbackId;
+		}
+
+		//! Remove a change callback
+		void RemoveChangeCallback(std::size_t id)
+		{
+			const std::lock_guard<std::mutex> lock(m_callbacksMutex);
+			if (!m_callbacks)
+				return;
+			auto callbacks = std::make_shared<callback_list_t>(*m_callbacks);
+			std::erase_if(*callbacks, [id](const auto& callback) { return callback.first == id; });
+			m_callbacks = callbacks->empty() ? nullptr : std::move(callbacks);
+		}
+
+	private:
+
+		using callback_list_t = std::vector<std::pair<std::size_t, change_callback_t>>;
+
+		static std::atomic<std::uint64_t>& GenerationCounter() noexcept {
+			static std::atomic<std::uint64_t> counter = 0;
+			return counter;
+		}
+
+		std::atomic<std::uint64_t> m_version = 0;
+		std::atomic<std::uint64_t> m_generation = 0;
+		std::mutex m_callbacksMutex;
+		std::shared_ptr<const callback_list_t> m_callbacks;		//Copied on write: MarkChanged calls a snapshot, unlocked
+		std::size_t m_lastCallbackId = 0;
 	};
 
 	//Configurable including a data
@@ -182,11 +324,11 @@ namespace bhd
 
 		//Getters/setters
 
-		virtual void Set(const data_t& data)		{ m_data = data; }
-		virtual void Set(data_t&& data)				{ m_data = std::move(data); }
+		virtual void Set(const data_t& data)		{ if (Assign(data)) MarkChanged(); }
+		virtual void Set(data_t&& data)				{ if (Assign(std::move(data))) MarkChanged(); }
 		auto & Value()			const				{ return m_data; }
 		auto & Value()								{ return m_data; }
-		void SetDefault()							{ m_data = m_default.value_or(data_t{}); }
+		void SetDefault()							{ Set(m_default.value_or(data_t{})); }
 		auto DefaultValue()		const				{ return m_default.value_or(data_t{});   }
 		const auto & Default()	const				{ return m_default; }
 		auto & Default()							{ return m_default; }
@@ -240,11 +382,13 @@ namespace bhd
 				std::is_same_v<std::filesystem::path, data_t>
 				)
 			{
-				m_data = svalue;
+				Set(data_t(svalue));
 			}
 			else
 			{
-				deserialization::to_data(svalue, m_data);
+				data_t data = m_data;
+				deserialization::to_data(svalue, data);
+				Set(std::move(data));
 			}
 		}
 
@@ -265,14 +409,120 @@ namespace bhd
 		/// <param name="fs">Opencv Filestorage object</param>
 		void read(const cv::FileNode& fs) override {
 			if (auto key_node = fs[GetKey()]; !key_node.empty())
-				key_node >> m_data;
+			{
+				data_t data = m_data;
+				key_node >> data;
+				Set(std::move(data));
+			}
+		}
+
+		/// <summary>
+		/// Hash of the key and value. Numeric and enum values are hashed as raw bytes, without string conversion.
+		/// </summary>
+		std::uint64_t Hash() const override
+		{
+			if constexpr (std::is_arithmetic_v<data_t> || std::is_enum_v<data_t>)
+				return hash_value(m_data, hash_string(GetKey()));
+			else
+				return IConfigurable::Hash();
+		}
+
+		/// <summary>
+		/// Binary value: numeric, enum and trivially copyable data are written raw, vectors of them as arrays
+		/// (read in place by binary::value_view::span), other data as their string value.
+		/// </summary>
+		void WriteBinary(binary::writer& out, std::string_view path) const override
+		{
+			if constexpr (binary::is_scalar_v<data_t>)
+				out.write_scalar(path, m_data);
+			else if constexpr (binary::is_array_v<data_t>)
+				out.write_array(path, m_data.data(), m_data.size());
+			else
+				IConfigurable::WriteBinary(out, path);
+		}
+
+		void ReadBinary(const binary::value_view& value) override
+		{
+			if constexpr (binary::is_scalar_v<data_t>)
+				Set(value.scalar<data_t>());
+			else if constexpr (binary::is_array_v<data_t>)
+			{
+				const auto values = value.span<typename data_t::value_type>();
+				Set(data_t(values.begin(), values.end()));
+			}
+			else
+				IConfigurable::ReadBinary(value);
+		}
+
+		/// <summary>
+		/// Copy the data into another configurable of the same data type (through Set, so that a derived configurable applies its own rules).
+		/// </summary>
+		/// <param name="configurable">Configurable destination</param>
+		void CopyTo(IConfigurable& configurable) const override {
+			auto* destination = dynamic_cast<TDataConfigurable*>(&configurable);
+			assert(destination != nullptr && "Configurable data types don't match");
+			if (destination != nullptr && destination != this)
+				destination->Set(m_data);
+		}
+
+		std::shared_ptr<const void> SnapshotValue() const override {
+			return std::make_shared<const data_t>(m_data);
+		}
+
+		void RestoreValue(const void* value) override {
+			Set(*static_cast<const data_t*>(value));
 		}
 
+	protected:
+
+		//! Assign the data. Return false if the value is unchanged (not a change)
+		template<class T>
+		bool Assign(T&& data)
+		{
+			if constexpr (std::equality_comparable<data_t>)
+			{
+				if (m_data == data)
+					return false;
+			}
+			m_data = std::forward<T>(data);
+			return true;
+		}
+
+	};
+
+	/// <summary>
+	/// Type-erased access to a numeric configurable (CNumericConfigurable of any type) as a double,
+	/// for generic tools working on every numeric parameter of a module (parameter sweep, sliders...).
+	/// Ex:
+	/// if (auto* numeric = dynamic_cast<INumericConfigurable*>(configurable)) numeric->SetNumericValue(0.5);
+	/// </summary>
+	class INumericConfigurable
+	{
+	public:
+		virtual ~INumericConfigurable() = default;
+
+		//! Return the value as a double
+		virtual double GetNumericValue() const = 0;
+
+		//! Set the value from a double, clamped to the range and rounded for an integral type
+		virtual void SetNumericValue(double value) = 0;
+
+		//! Return the range minimum as a double
+		virtual double GetNumericMin() const = 0;
+
+		//! Return the range maximum as a double
+		virtual double GetNumericMax() const = 0;
+
+		//! Return true if a [min, max] range was given (not the limits of the type)
+		virtual bool HasRange() const = 0;
+
+		//! Return true for an integral type
+		virtual bool IsIntegral() const = 0;
 	};
 
 	//Configurable including a numerical data with a possible [min, max] range
 	template<typename TNumeric>
-	class CNumericConfigurable : public TDataConfigurable<TNumeric>
+	class CNumericConfigurable : public TDataConfigurable<TNumeric>, public INumericConfigurable
 	{
 	
 	public:
@@ -317,6 +567,29 @@ namespace bhd
 		template<typename ...Args>
 		decltype(auto) operator=(Args&&... args) { TDataConfigurable<numeric_t>::operator=(std::forward<Args>(args)...); return *this; }
 
+		//Range
+
+		data_t GetMin()			const				{ return m_minRange; }
+		data_t GetMax()			const				{ return m_maxRange; }
+		void SetRange(data_t min, data_t max)		{ assert(min <= max); m_minRange = min; m_maxRange = max; }
+		bool HasRange()			const override		{ return m_minRange != MIN_VALUE || m_maxRange != MAX_VALUE; }
+
+		//INumericConfigurable
+
+		double GetNumericValue()	const override	{ return static_cast<double>(this->m_data); }
+		double GetNumericMin()		const override	{ return static_cast<double>(m_minRange); }
+		double GetNumericMax()		const override	{ return static_cast<double>(m_maxRange); }
+		bool IsIntegral()			const override	{ return std::is_integral_v<data_t>; }
+
+		void SetNumericValue(double value) override
+		{
+			value = std::clamp(value, GetNumericMin(), GetNumericMax());
+			if constexpr (std::is_integral_v<data_t>)
+				this->Set(static_cast<data_t>(std::llround(value)));
+			else
+				this->Set(static_cast<data_t>(value));
+		}
+
 	private:
 		data_t m_minRange = MIN_VALUE;
 		data_t	m_maxRange = MAX_VALUE;
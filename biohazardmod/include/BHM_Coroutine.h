@@ -0,0 +1,276 @@
+#pragma once
+
+#include "BHM_ThreadPool.h"
+
+#include <coroutine>
+
+namespace bhd
+{
+	template<class T = void>
+	class task;
+
+	namespace details
+	{
+		//Result storage of a coroutine promise ('void' has no value)
+		template<class T>
+		class task_promise_result
+		{
+		protected:
+			std::optional<std::conditional_t<std::is_reference_v<T>, std::reference_wrapper<std::remove_reference_t<T>>, T>> m_value;
+
+		public:
+			template<class U>
+			void return_value(U&& value) {
+				m_value.emplace(std::forward<U>(value));
+			}
+
+			T take() {
+				return static_cast<T>(std::move(*m_value));
+			}
+		};
+
+		template<>
+		class task_promise_result<void>
+		{
+		public:
+			void return_void() noexcept {}
+			void take() noexcept {}
+		};
+
+		/// <summary>
+		/// Promise of bhd::task. The coroutine starts when awaited, and resumes its awaiter when it ends (symmetric transfer).
+		/// </summary>
+		template<class T>
+		class task_promise : public task_promise_result<T>
+		{
+			std::coroutine_handle<> m_continuation = std::noop_coroutine();
+			std::exception_ptr m_exception;
+
+			struct final_awaiter
+			{
+				bool await_ready() const noexcept { return false; }
+
+				std::coroutine_handle<> await_suspend(std::coroutine_handle<task_promise> handle) noexcept {
+					return handle.promise().m_continuation;
+				}
+
+				void await_resume() const noexcept {}
+			};
+
+		public:
+
+			task<T> get_return_object() noexcept {
+				return task<T>(std::coroutine_handle<task_promise>::from_promise(*this));
+			}
+
+			std::suspend_always initial_suspend() const noexcept { return {}; }
+			final_awaiter final_suspend() const noexcept { return {}; }
+
+			void unhandled_exception() noexcept {
+				m_exception = std::current_exception();
+			}
+
+			void set_continuation(std::coroutine_handle<> continuation) noexcept {
+				m_continuation = continuation;
+			}
+
+			//! Result of the finished coroutine, or rethrow its exception
+			T result()
+			{
+				if (m_exception)
+					std::rethrow_exception(m_exception);
+				return this->take();
+			}
+		};
+
+		/// <summary>
+		/// Awaiter on a task state: the coroutine is resumed by the thread completing the task, no thread waits.
+		/// The awaiter itself is the continuation node (it lives in the coroutine frame, no allocation).
+		/// </summary>
+		template<class T>
+		class task_state_awaiter final : public task_continuation
+		{
+			task_state_ptr<task_result_state<T>> m_state;
+			std::coroutine_handle<> m_handle;
+			std::atomic_bool m_registered = false;	//The second of await_suspend / invoke resumes the coroutine
+
+			void invoke() noexcept override
+			{
+				if (m_registered.exchange(true, std::memory_order_acq_rel))
+					m_handle.resume();
+			}
+
+			void discard() noexcept override {}
+
+		public:
+
+			explicit task_state_awaiter(task_state_ptr<task_result_state<T>> state) noexcept : m_state(std::move(state)) {}
+
+			bool await_ready() const noexcept { return m_state->is_done(); }
+
+			bool await_suspend(std::coroutine_handle<> handle) noexcept
+			{
+				m_handle = handle;
+				m_state->add_continuation(this);
+				//Already done while registering: continue without suspending
+				return !m_registered.exchange(true, std::memory_order_acq_rel);
+			}
+
+			T await_resume() {
+				return m_state->get();
+			}
+		};
+
+		//! Coroutine started immediately and destroyed at its end (nobody awaits it)
+		struct detached_coroutine
+		{
+			struct promise_type
+			{
+				detached_coroutine get_return_object() const noexcept { return {}; }
+				std::suspend_never initial_suspend() const noexcept { return {}; }
+				std::suspend_never final_suspend() const noexcept { return {}; }
+				void return_void() const noexcept {}
+				void unhandled_exception() const noexcept { std::terminate(); }
+			};
+		};
+	}
+
+	/// <summary>
+	/// Await a threaded_task from a coroutine without blocking any thread.
+	/// The coroutine goes on in the thread finishing the task (a pool worker). The task has to be enqueued.
+	/// Ex:
+	/// cv::Mat img = co_await pool.enqueue(cv::imread, path, cv::IMREAD_UNCHANGED);
+	/// </summary>
+	template<class T>
+	details::task_state_awaiter<T> operator co_await(const threaded_task<T>& task) noexcept
+	{
+		assert(task.valid() && "No task set");
+		return details::task_state_awaiter<T>(task.state());
+	}
+
+	/// <summary>
+	/// Lazy coroutine returning a T. It starts when awaited (co_await) or when spawned, in the calling thread:
+	/// use co_await pool.schedule() to move onto the pool, and co_await on threaded_task / task to chain the steps.
+	/// Ex:
+	/// bhd::task<void> process(bhd::thread_pool& pool, std::string path) {
+	///		co_await pool.schedule();
+	///		cv::Mat cube = read_hsi(path);								//I/O on a worker
+	///		cv::Mat result = co_await pool.enqueue(compute, cube);		//No thread waits meanwhile
+	///		save(result);
+	/// }
+	/// bhd::sync_wait(process(pool, path));
+	/// </summary>
+	template<class T>
+	class task
+	{
+	public:
+		using promise_type = details::task_promise<T>;
+
+	private:
+		std::coroutine_handle<promise_type> m_handle;
+
+		struct awaiter
+		{
+			std::coroutine_handle<promise_type> m_handle;
+
+			bool await_ready() const noexcept { return m_handle.done(); }
+
+			std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+				m_handle.promise().set_continuation(awaiting);
+				return m_handle;	//Start the coroutine
+			}
+
+			T await_resume() {
+				return m_handle.promise().result();
+			}
+		};
+
+		template<class U>
+		friend threaded_task<U> spawn(task<U> coroutine);
+
+	public:
+
+		task() = default;
+		explicit task(std::coroutine_handle<promise_type> handle) noexcept : m_handle(handle) {}
+		task(task&& other) noexcept : m_handle(std::exchange(other.m_handle, nullptr)) {}
+		task(const task&) = delete;
+		task& operator=(const task&) = delete;
+
+		task& operator=(task&& other) noexcept
+		{
+			if (this != &other) {
+				if (m_handle)
+					m_handle.destroy();
+				m_handle = std::exchange(other.m_handle, nullptr);
+			}
+			return *this;
+		}
+
+		~task()
+		{
+			if (m_handle)
+				m_handle.destroy();
+		}
+
+		//! Return true if a coroutine is attached
+		bool valid() const noexcept { return static_cast<bool>(m_handle); }
+
+		//! Return true if the coroutine has finished
+		bool is_ready() const noexcept { return m_handle && m_handle.done(); }
+
+		awaiter operator co_await() const noexcept
+		{
+			assert(valid() && "No coroutine");
+			return { m_handle };
+		}
+	};
+
+	/// <summary>
+	/// Start a coroutine now (in the calling thread) and return a threaded_task on its result,
+	/// usable with get(), then(), when_all()... No thread is held while the coroutine is suspended.
+	/// </summary>
+	/// <param name="coroutine">Coroutine to start (consumed)</param>
+	/// <returns>Task completed with the coroutine result or exception</returns>
+	template<class T>
+	threaded_task<T> spawn(task<T> coroutine)
+	{
+		assert(coroutine.valid() && "No coroutine");
+		auto handle = coroutine.m_handle;
+
+		//The state owns the coroutine frame, and reads its result once the coroutine is done
+		auto state = details::make_task_state<T>([coroutine = std::move(coroutine)]() mutable -> T {
+			return coroutine.m_handle.promise().result();
+		});
+		state->set_dependencies(1);
+
+		struct final_step
+		{
+			std::coroutine_handle<typename task<T>::promise_type> m_handle;
+			bool await_ready() const noexcept { return false; }
+			std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+				m_handle.promise().set_continuation(awaiting);
+				return m_handle;
+			}
+			void await_resume() const noexcept {}	//The result (or exception) is read by the state
+		};
+
+		[](std::coroutine_handle<typename task<T>::promise_type> handle, details::task_state_ptr<details::task_state_base> state) -> details::detached_coroutine
+		{
+			co_await final_step{ handle };
+			if (state->release_dependency())
+				state->try_run();
+		}(handle, state);
+
+		return threaded_task<T>(std::move(state));
+	}
+
+	/// <summary>
+	/// Run a coroutine and block until its result is available (bridge from synchronous code).
+	/// A pool worker calling it keeps running other pool tasks while waiting.
+	/// </summary>
+	template<class T>
+	T sync_wait(task<T> coroutine)
+	{
+		return spawn(std::move(coroutine)).get();
+	}
+}
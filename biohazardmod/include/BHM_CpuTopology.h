@@ -0,0 +1,40 @@
+#pragma once
+
+#include <vector>
+#include <string>
+
+namespace bhd
+{
+	/// <summary>
+	/// Level of the CPU groups returned by cpu_domains
+	/// </summary>
+	enum class CPU_DOMAIN
+	{
+		NUMA_NODE = 0,	//CPUs sharing the same memory controller (socket)
+		L3_CACHE,		//CPUs sharing the same last level cache
+		N_COUNT
+	};
+
+	/// <summary>
+	/// Group the logical CPUs of the machine by NUMA node or by L3 cache.
+	/// When the topology is not available, a single group with every CPU is returned.
+	/// Ex:
+	/// for (const auto& cpus : bhd::cpu_domains(bhd::CPU_DOMAIN::NUMA_NODE)) ...
+	/// </summary>
+	/// <param name="level">Grouping level</param>
+	/// <returns>Logical CPU indices of each group (never empty)</returns>
+	std::vector<std::vector<int>> cpu_domains(CPU_DOMAIN level);
+
+	/// <summary>
+	/// Restrict the calling thread to a set of logical CPUs.
+	/// </summary>
+	/// <param name="cpus">Logical CPU indices. On Windows, only the processor group of the first CPU is used</param>
+	/// <returns>true on success, false if not supported or refused by the system</returns>
+	bool set_current_thread_affinity(const std::vector<int>& cpus);
+
+	/// <summary>
+	/// Name the calling thread (visible in top, perf, gdb or the Visual Studio debugger).
+	/// Linux truncates names to 15 characters.
+	/// </summary>
+	void set_current_thread_name(const std::string& name);
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <string_view>
+
+namespace bhd
+{
+	/// <summary>
+	/// Non-cryptographic 64 bits hashes (cache keys, change detection).
+	/// hash_bytes reads 8 bytes at a time on four independent lanes (same structure as xxHash64),
+	/// so a large image buffer is hashed at memory speed.
+	/// </summary>
+	namespace hashing
+	{
+		constexpr std::uint64_t PRIME_1 = 0x9E3779B185EBCA87ull;
+		constexpr std::uint64_t PRIME_2 = 0xC2B2AE3D27D4EB4Full;
+		constexpr std::uint64_t PRIME_3 = 0x165667B19E3779F9ull;
+		constexpr std::uint64_t PRIME_4 = 0x85EBCA77C2B2AE63ull;
+		constexpr std::uint64_t PRIME_5 = 0x27D4EB2F165667C5ull;
+
+		constexpr std::uint64_t rotl(std::uint64_t x, int r) noexcept { return (x << r) | (x >> (64 - r)); }
+
+		constexpr std::uint64_t round(std::uint64_t acc, std::uint64_t input) noexcept {
+			return rotl(acc + input * PRIME_2, 31) * PRIME_1;
+		}
+
+		constexpr std::uint64_t merge(std::uint64_t acc, std::uint64_t lane) noexcept {
+			return (acc ^ round(0, lane)) * PRIME_1 + PRIME_4;
+		}
+
+		inline std::uint64_t read64(const unsigned char* p) noexcept {
+			std::uint64_t v;
+			std::memcpy(&v, p, sizeof(v));
+			return v;
+		}
+
+		//! Final mix: every input bit affects every output bit
+		constexpr std::uint64_t avalanche(std::uint64_t h) noexcept
+		{
+			h ^= h >> 33;
+			h *= PRIME_2;
+			h ^= h >> 29;
+			h *= PRIME_3;
+			h ^= h >> 32;
+			return h;
+		}
+	}
+
+	/// <summary>
+	/// Hash a memory block
+	/// </summary>
+	/// <param name="data">Block address</param>
+	/// <param name="size">Size in bytes</param>
+	/// <param name="seed">Seed, or the hash of the previous block to hash several blocks as one</param>
+	inline std::uint64_t hash_bytes(const void* data, std::size_t size, std::uint64_t seed = 0) noexcept
+	{
+		using namespace hashing;
+		const auto* p = static_cast<const unsigned char*>(data);
+		const auto* const end = p + size;
+		std::uint64_t h;
+
+		if (size >= 32)
+		{
+			std::uint64_t v1 = seed + PRIME_1 + PRIME_2, v2 = seed + PRIME_2, v3 = seed, v4 = seed - PRIME_1;
+			const auto* const limit = end - 32;
+			do
+			{
+				v1 = round(v1, read64(p));
+				v2 = round(v2, read64(p + 8));
+				v3 = round(v3, read64(p + 16));
+				v4 = round(v4, read64(p + 24));
+				p += 32;
+			} while (p <= limit);
+
+			h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+			h = merge(h, v1);
+			h = merge(h, v2);
+			h = merge(h, v3);
+			h = merge(h, v4);
+		}
+		else
+			h = seed + PRIME_5;
+
+		h += static_cast<std::uint64_t>(size);
+		for (; p + 8 <= end; p += 8)
+			h = rotl(h ^ round(0, read64(p)), 27) * PRIME_1 + PRIME_4;
+		for (; p < end; p++)
+			h = rotl(h ^ (*p * PRIME_5), 11) * PRIME_1;
+		return avalanche(h);
+	}
+
+	//! Hash a string
+	inline std::uint64_t hash_string(std::string_view str, std::uint64_t seed = 0) noexcept {
+		return hash_bytes(str.data(), str.size(), seed);
+	}
+
+	//! Hash of a trivially copyable value (arithmetic types, enums...)
+	template<class T>
+	std::uint64_t hash_value(const T& value, std::uint64_t seed = 0) noexcept {
+		return hash_bytes(&value, sizeof(T), seed);
+	}
+
+	//! Combine two hashes (order dependent)
+	constexpr std::uint64_t hash_combine(std::uint64_t h, std::uint64_t value) noexcept {
+		return hashing::avalanche(h ^ (value + hashing::PRIME_1 + (h << 6) + (h >> 2)));
+	}
+}
@@ -37,8 +37,9 @@ namespace bhd::imgproc
 	//if oColor == { r, g , b } with r >= 0, oColor is used to paint the arrows
 	//if oColor == { -1, a , b }, rng color is used with values define randomly in [a,b]
 	//if oColor == { -2, n, - } , a color LUT is used on the arrow norm using GetColorLUT, (if n > 0, n are used to normalize all arrows, else n is defined with the max norm of the arrow list)
+	//The image is drawn by horizontal bands on the default thread pool. iNThreads limits the number of bands (<= 0: automatic)
 	template <typename T1, typename T2>
-	cv::Mat DrawArrowedLines(const cv::Mat oInMat, const std::vector<cv::Point_<T1>> & vPts1, const std::vector<cv::Point_<T2>> & vPts2, float dScale = 10.0f, cv::Scalar oColor = { -1 , 0 , 255 , 0 }, int iThickness = 5, int iNThreads = 4);
+	cv::Mat DrawArrowedLines(const cv::Mat oInMat, const std::vector<cv::Point_<T1>> & vPts1, const std::vector<cv::Point_<T2>> & vPts2, float dScale = 10.0f, cv::Scalar oColor = { -1 , 0 , 255 , 0 }, int iThickness = 5, int iNThreads = 0);
 	
 	//Return a color in function of a LUT (blue to red) computed from a value define between [0,1]
 	cv::Scalar  GetColorLUT(double dDist, bool bSwapRB = true);
@@ -4,6 +4,12 @@
 #include "BHM_Configurable.h"
 
 #include <variant>
+#include <memory>
+#include <stdexcept>
+#include <string_view>
+#include <unordered_map>
+#include <atomic>
+#include <optional>
 
 namespace bhd
 {
@@ -14,6 +20,73 @@ namespace bhd
 		using string_t = std::string;   //From c++17, use u8"blah blah" for utf8 encoding
 	}
 
+	namespace details
+	{
+		struct transparent_string_hash
+		{
+			using is_transparent = void;
+			std::size_t operator()(std::string_view s) const noexcept { return std::hash<std::string_view>{}(s); }
+		};
+
+		//Structure of a module tree: (instance id, structure generation) of each module, in visit order
+		using structure_stamp = std::vector<std::pair<std::uint64_t, std::uint64_t>>;
+
+		//Configurables of a module tree by path
+		struct configurable_index
+		{
+			structure_stamp m_structure;		//Structure of the indexed tree (see IModule::StructureChanged)
+			mutable std::atomic<std::uint64_t> m_checked = 0;	//Last structure epoch for which m_structure was checked
+			std::unordered_map<std::string, IConfigurable*, transparent_string_hash, std::equal_to<>> m_paths;
+		};
+
+		//Structure generation of a module. A copy starts its own count, an assignment changes the structure
+		struct structure_generation
+		{
+			std::atomic<std::uint64_t> m_value = 0;
+
+			structure_generation() = default;
+			structure_generation(const structure_generation&) noexcept {}
+			structure_generation& operator=(const structure_generation&) noexcept { changed(); return *this; }
+
+			//! Count a change of the module, then of the process epoch: an index checked after an epoch sees the changes before it
+			void changed() noexcept {
+				m_value.fetch_add(1, std::memory_order_acq_rel);
+				epoch().fetch_add(1, std::memory_order_acq_rel);
+			}
+
+			//! Structure changes of all modules: the indexes of a stable process are checked by a single compare
+			static std::atomic<std::uint64_t>& epoch() noexcept {
+				static std::atomic<std::uint64_t> counter = 1;
+				return counter;
+			}
+		};
+
+		//Index cache of a module. Not copied with the module: a copy builds its own index
+		struct configurable_index_cache
+		{
+			mutable std::atomic<std::shared_ptr<const configurable_index>> m_index;
+
+			configurable_index_cache() = default;
+			configurable_index_cache(const configurable_index_cache&) noexcept {}
+			configurable_index_cache& operator=(const configurable_index_cache&) noexcept { m_index.store(nullptr); return *this; }
+		};
+
+		//Unique id of a module object, never reused. Not copied with the module: a copy is an other object
+		struct module_instance_id
+		{
+			std::uint64_t m_value = next();
+
+			module_instance_id() = default;
+			module_instance_id(const module_instance_id&) noexcept {}
+			module_instance_id& operator=(const module_instance_id&) noexcept { return *this; }
+
+			static std::uint64_t next() noexcept {
+				static std::atomic<std::uint64_t> counter = 0;
+				return counter.fetch_add(1, std::memory_order_relaxed) + 1;
+			}
+		};
+	}
+
 	/// <summary>
 	/// Module interface class.
 	/// The interface class is defined to manipulated (mainly to import/export in file) a list of configurables and submodules.
@@ -46,6 +119,9 @@ namespace bhd
 
 		configurable_register_t m_vConfigurables;   //! List of configurable pointers
 		module_register_t m_vpSubModules;           //! List of submodules (as a object, pointer or ref)
+		details::configurable_index_cache m_index;  //! Configurables by path (see FindConfigurable)
+		details::module_instance_id m_instanceId;   //! See InstanceId
+		details::structure_generation m_structure;  //! See StructureChanged
 
 		IModule(const IModule&) = default;
 		IModule(IModule&&) = default;
@@ -97,6 +173,173 @@ namespace bhd
 		//! Return the type index of the module
 		std::type_index TypeIndex() const { return std::type_index(typeid(*this)); }
 
+		//! Unique id of this module object, unlike its address never reused by an other module (a copy gets a new id)
+		std::uint64_t InstanceId() const noexcept { return m_instanceId.m_value; }
+
+		/// <summary>
+		/// Hash of the module state: key, configurable values and submodule states (see IConfigurable::Hash).
+		/// Two instances of a module with the same configuration have the same hash.
+		/// </summary>
+		std::uint64_t StateHash() const
+		{
+			std::uint64_t hash = hash_string(GetKey());
+			for (const auto* config : m_vConfigurables)
+				hash = hash_combine(hash, config->Hash());
+			for (const auto& submodule : m_vpSubModules)
+				hash = hash_combine(hash, submodule->StateHash());
+			return hash;
+		}
+
+		/// <summary>
+		/// Generation of the last change of a configurable of the module or of its submodules (see IConfigurable::Generation)
+		/// </summary>
+		std::uint64_t Generation() const
+		{
+			std::uint64_t generation = 0;
+			for (const auto* config : m_vConfigurables)
+				generation = std::max(generation, config->Generation());
+			for (const auto& submodule : m_vpSubModules)
+				generation = std::max(generation, submodule->Generation());
+			return generation;
+		}
+
+		/// <summary>
+		/// Return true if a configurable of the module or of its submodules changed after a generation.
+		/// Ex:
+		/// auto generation = IConfigurable::CurrentGeneration();
+		/// ...
+		/// if (module.ChangedSince(generation)) Rerun();
+		/// </summary>
+		bool ChangedSince(std::uint64_t generation) const { return Generation() > generation; }
+
+		/// <summary>
+		/// Paths of the configurables (see FindConfigurable) changed after a generation
+		/// </summary>
+		std::vector<key_t> ChangesSince(std::uint64_t generation) const
+		{
+			std::vector<key_t> paths;
+			VisitConfigurables([&](const key_t& path, const IConfigurable& config) {
+				if (config.Generation() > generation)
+					paths.push_back(path);
+			});
+			return paths;
+		}
+
+		/// <summary>
+		/// Find a configurable from its path relative to this module: "KEY" for a configurable of the module,
+		/// "SUB/KEY" for a configurable of the submodule SUB (alias), and so on. The path may start with the module alias ("MODULE/SUB/KEY").
+		/// Constant time: the paths are indexed once, and the index is checked by a single compare while no module structure changes (see ConfigurableIndex).
+		/// </summary>
+		/// <param name="path">Configurable path</param>
+		/// <returns>The configurable, nullptr if the path is unknown</returns>
+		IConfigurable* FindConfigurable(std::string_view path) {
+			return LookupConfigurable(path);
+		}
+
+		const IConfigurable* FindConfigurable(std::string_view path) const {
+			return LookupConfigurable(path);
+		}
+
+		/// <summary>
+		/// Index of the configurables of the module tree by path. Built on the first lookup and rebuilt after a structure change
+		/// of the module or of one of its submodules (Register* functions). Call StructureChanged after editing m_vConfigurables,
+		/// m_vpSubModules or an alias directly.
+		/// The first lookup after a structure change of any module walks the module tree once (one compare per module) to keep
+		/// the index when the change was elsewhere.
+		/// </summary>
+		std::shared_ptr<const details::configurable_index> ConfigurableIndex() const
+		{
+			const auto epoch = details::structure_generation::epoch().load(std::memory_order_acquire);
+			if (auto index = m_index.m_index.load(std::memory_order_acquire); index)
+			{
+				if (index->m_checked.load(std::memory_order_acquire) == epoch)
+					return index;
+				//A module changed somewhere: checked once against this tree, then a single compare again
+				if (SameStructure(index->m_structure))
+				{
+					index->m_checked.store(epoch, std::memory_order_release);
+					return index;
+				}
+			}
+
+			auto index = std::make_shared<details::configurable_index>();
+			index->m_checked.store(epoch, std::memory_order_relaxed);
+			StructureStamp(index->m_structure);
+			IndexConfigurables(index->m_paths, {});
+			m_index.m_index.store(index, std::memory_order_release);
+			return index;
+		}
+
+		//! Invalidate the configurable indexes of the module and of the modules containing it
+		void StructureChanged() noexcept {
+			m_structure.changed();
+		}
+
+		/// <summary>
+		/// Set a configurable from its string value (see IConfigurable::SetStringValue)
+		/// </summary>
+		/// <param name="path">Configurable path (see FindConfigurable)</param>
+		/// <param name="svalue">String value</param>
+		/// <returns>False if the path is unknown</returns>
+		bool SetConfigurableValue(std::string_view path, const std::string& svalue)
+		{
+			auto* config = FindConfigurable(path);
+			if (config == nullptr)
+				return false;
+			config->SetStringValue(svalue);
+			return true;
+		}
+
+		//! String value of a configurable, std::nullopt if the path is unknown
+		std::optional<std::string> GetConfigurableValue(std::string_view path) const
+		{
+			if (const auto* config = FindConfigurable(path))
+				return config->GetStringValue();
+			return std::nullopt;
+		}
+
+		/// <summary>
+		/// Set configurables from (path, string value) pairs: command line, configuration overlay...
+		/// Ex:
+		/// module.ApplyConfigurableValues(std::map<std::string, std::string>{ {"SIGMA_COLOR", "20"}, {"FILTER/KERNEL", "5"} });
+		/// </summary>
+		/// <param name="values">Range of pairs (std::map, std::unordered_map, std::vector of std::pair...)</param>
+		/// <returns>The unknown paths (not applied)</returns>
+		template<class TPairs>
+		std::vector<std::string> ApplyConfigurableValues(const TPairs& values)
+		{
+			std::vector<std::string> unknown;
+			for (const auto& [path, svalue] : values)
+			{
+				if (auto* config = FindConfigurable(path))
+					config->SetStringValue(svalue);
+				else
+					unknown.emplace_back(path);
+			}
+			return unknown;
+		}
+
+		/// <summary>
+		/// Call f(path, configurable) for every configurable of the module and of its submodules (path as in FindConfigurable).
+		/// </summary>
+		template<class F>
+		void VisitConfigurables(F&& f, const key_t& prefix = {})
+		{
+			for (auto* config : m_vConfigurables)
+				f(prefix + config->GetKey(), *config);
+			for (auto& submodule : m_vpSubModules)
+				submodule->VisitConfigurables(f, prefix + submodule->GetAlias() + "/");
+		}
+
+		template<class F>
+		void VisitConfigurables(F&& f, const key_t& prefix = {}) const
+		{
+			for (const auto* config : m_vConfigurables)
+				f(prefix + config->GetKey(), *config);
+			for (const auto& submodule : m_vpSubModules)
+				submodule->VisitConfigurables(f, prefix + submodule->GetAlias() + "/");
+		}
+
 
 		/// <summary>
 		/// Copy all configurables, all submodules inside a other same module.
@@ -105,7 +348,7 @@ namespace bhd
 		/// <param name="module">Destination module</param>
 		void CopyTo(IModule& imodule) const
 		{
-			if (imodule.GetKey() != imodule.GetKey())
+			if (GetKey() != imodule.GetKey())
 				return;
 			//Configurables
 			{
@@ -132,16 +375,46 @@ namespace bhd
 		};
 
 		/// <summary>
-		/// clone the module. Create a new instance of the module and copy the state of its configurables.
+		/// Create a new default instance of the module type. Implemented by TCloneable:
+		/// a module type not derived from it throws std::logic_error.
+		/// </summary>
+		virtual std::unique_ptr<IModule> NewInstance() const
+		{
+			throw std::logic_error("Module " + GetKey() + " is not cloneable: derive it from TCloneable");
+		}
+
+		/// <summary>
+		/// Clone the module: a new instance of the module type (see NewInstance), with the state of its configurables and submodules.
 		/// </summary>
 		/// <returns>Return a copy of the module</returns>
-		IModule Clone() const
+		std::unique_ptr<IModule> Clone() const
 		{
-			IModule clone;
-			CopyTo(clone);
+			auto clone = CloneInstance();
+			CopyTo(*clone);
 			return clone;
 		}
 
+		/// <summary>
+		/// New instance of the module type (see NewInstance) with the key, the alias and the instance state (see CopyInstanceTo)
+		/// of the module, but its configurables at their default values. The module configurables are not read.
+		/// </summary>
+		std::unique_ptr<IModule> CloneInstance() const
+		{
+			auto clone = NewInstance();
+			//Same identity: CopyTo only copies between modules of the same key, and the files address the module by its alias
+			clone->m_sKey = m_sKey;
+			clone->m_sAlias = m_sAlias;
+			CopyInstanceTo(*clone);
+			return clone;
+		}
+
+		/// <summary>
+		/// Copy the state shared by the clones of the module, which is not a configurable (loggers...). Called by Clone.
+		/// </summary>
+		/// <param name="clone">Clone of the module</param>
+		virtual void CopyInstanceTo(IModule& clone) const
+		{		}
+
 
 		/// <summary>
 		/// Export the configurables/submodule status of the module into a file. If the file can't be exported, return a error.
@@ -150,6 +423,8 @@ namespace bhd
 		/// <returns>Empty if not error, else message error</returns>
 		std::string ExportFile(const std::filesystem::path & file_path) const noexcept
 		{ 
+			if (file_path.extension() == binary::FILE_EXTENSION)
+				return ExportBinary(file_path);
 			try
 			{
 				cv::FileStorage fs(file_path.generic_string(), cv::FileStorage::WRITE);
@@ -197,12 +472,14 @@ namespace bhd
 		}
 
 		/// <summary>
-		/// Import configurable/submodule values from a file
+		/// Import configurable/submodule values from a file. See config_watcher to reload it on each change.
 		/// </summary>
 		/// <param name="file_path">File path</param>
 		/// <returns>Empty if not error, else message error</returns>
 		std::string ImportFile(const std::filesystem::path & file_path) noexcept
 		{ 
+			if (file_path.extension() == binary::FILE_EXTENSION)
+				return ImportBinary(file_path);
 			try
 			{
 				cv::FileStorage fs(file_path.generic_string(), cv::FileStorage::READ);
@@ -215,6 +492,22 @@ namespace bhd
 			return {};
 		}
 
+		/// <summary>
+		/// Export the configurables/submodule status of the module into a binary snapshot file (see module_snapshot).
+		/// ExportFile uses it for the binary::FILE_EXTENSION extension.
+		/// </summary>
+		/// <param name="file_path">File path</param>
+		/// <returns>Empty if not error, else message error</returns>
+		std::string ExportBinary(const std::filesystem::path& file_path) const noexcept;
+
+		/// <summary>
+		/// Import configurable/submodule values from a binary snapshot file (see module_snapshot).
+		/// ImportFile uses it for the binary::FILE_EXTENSION extension.
+		/// </summary>
+		/// <param name="file_path">File path</param>
+		/// <returns>Empty if not error, else message error</returns>
+		std::string ImportBinary(const std::filesystem::path& file_path) noexcept;
+
 		/// <summary>
 		/// Try to import configurable/submodule values from a file
 		/// If fail, the file is created as template
@@ -241,6 +534,7 @@ namespace bhd
 		/// <param name="configurable">Configurable reference</param>
 		void RegisterConfigurable(IConfigurable & configurable) {
 			m_vConfigurables.emplace_back(&configurable);
+			StructureChanged();
 		}
 
 		/// <summary>
@@ -268,6 +562,7 @@ namespace bhd
 		{
 			m_vConfigurables.reserve(std::size(m_vConfigurables) + std::size(list));
 			m_vConfigurables.insert(std::end(m_vConfigurables), std::begin(list), std::end(list));
+			StructureChanged();
 		}
 
 		/// <summary>
@@ -279,19 +574,23 @@ namespace bhd
 		{
 			m_vConfigurables.reserve(m_vConfigurables.size() + std::size(container));
 			m_vConfigurables.insert(std::begin(m_vConfigurables), std::begin(container), std::end(container));
+			StructureChanged();
 		}
 
 		void RegisterSubModule(IModule& submodule) {
 			m_vpSubModules.emplace_back(&submodule);
+			StructureChanged();
 		}
 
 		void RegisterSubModule(IModule&& submodule) {
 			m_vpSubModules.emplace_back(std::move(submodule));
+			StructureChanged();
 		}
 
 		void RegisterSubModule(IModule & submodule, const key_t & alias) {
 			submodule.m_sAlias = alias;
 			m_vpSubModules.emplace_back(&submodule);
+			StructureChanged();
 		}
 
 		template <typename ...Args>
@@ -332,6 +631,56 @@ namespace bhd
 		}
 
 private:
+
+		IConfigurable* LookupConfigurable(std::string_view path) const
+		{
+			const auto index = ConfigurableIndex();
+			if (auto it = index->m_paths.find(path); it != index->m_paths.end())
+				return it->second;
+
+			const auto& alias = GetAlias();
+			if (path.size() > alias.size() && path[alias.size()] == '/' && path.starts_with(alias))
+			{
+				if (auto it = index->m_paths.find(path.substr(alias.size() + 1)); it != index->m_paths.end())
+					return it->second;
+			}
+			return nullptr;
+		}
+
+		//Paths as in VisitConfigurables. The registered pointers are kept as is: the index serves both FindConfigurable overloads
+		template<class TPaths>
+		void IndexConfigurables(TPaths& paths, const key_t& prefix) const
+		{
+			for (auto* config : m_vConfigurables)
+				paths.try_emplace(prefix + config->GetKey(), config);
+			for (const auto& submodule : m_vpSubModules)
+				submodule->IndexConfigurables(paths, prefix + submodule->GetAlias() + "/");
+		}
+
+		//The parents do not know their submodules' changes: an index compares the structure of the whole tree
+		void StructureStamp(details::structure_stamp& stamp) const
+		{
+			stamp.emplace_back(InstanceId(), m_structure.m_value.load(std::memory_order_acquire));
+			for (const auto& submodule : m_vpSubModules)
+				submodule->StructureStamp(stamp);
+		}
+
+		bool SameStructure(const details::structure_stamp& stamp) const
+		{
+			std::size_t position = 0;
+			return SameStructure(stamp, position) && position == stamp.size();
+		}
+
+		bool SameStructure(const details::structure_stamp& stamp, std::size_t& position) const
+		{
+			if (position == stamp.size() || stamp[position] != std::pair{ InstanceId(), m_structure.m_value.load(std::memory_order_acquire) })
+				return false;
+			position++;
+			for (const auto& submodule : m_vpSubModules)
+				if (!submodule->SameStructure(stamp, position))
+					return false;
+			return true;
+		}
 	
 		void Reset(IModule & module)
 		{
@@ -420,4 +769,31 @@ private:
 		{		}
 	};
 
+	/// <summary>
+	/// Polymorphic clone of a module type (see IModule::Clone): derive the module from TCloneable<Module, Base> instead of Base.
+	/// The clone is a new default constructed instance set to the state of the module: it has its own configurables,
+	/// submodules and buffers.
+	/// Ex:
+	/// class BilateralModule : public TCloneable<BilateralModule, CModule<BilateralConfigurables>>
+	/// {
+	/// public:
+	///		BilateralModule() : TCloneable("BILATERAL") {}
+	/// };
+	/// std::unique_ptr<IModule> copy = bilateral.Clone();
+	/// </summary>
+	template<class TDerived, class TBase = IModule>
+	class TCloneable : public TBase
+	{
+	public:
+		static_assert(std::is_base_of_v<IModule, TBase>, "TCloneable base must be a module");
+
+		using TBase::TBase;
+
+		std::unique_ptr<IModule> NewInstance() const override
+		{
+			static_assert(std::is_default_constructible_v<TDerived>, "A cloneable module must be default constructible");
+			return std::make_unique<TDerived>();
+		}
+	};
+
 }
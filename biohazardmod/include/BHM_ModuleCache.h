@@ -0,0 +1,163 @@
+#pragma once
+
+#include "BHM_Module.h"
+#include "BHM_Hash.h"
+
+#include <list>
+#include <mutex>
+#include <chrono>
+#include <string>
+#include <unordered_map>
+#include <opencv2/opencv.hpp>
+
+namespace bhd
+{
+	/// <summary>
+	/// Hash of an image: type, size and pixel values (the step / padding of the rows is ignored).
+	/// </summary>
+	std::uint64_t mat_hash(const cv::Mat& mat);
+
+	/// <summary>
+	/// Statistics of a module_cache
+	/// </summary>
+	struct module_cache_stats
+	{
+		std::uint64_t m_hits = 0;
+		std::uint64_t m_misses = 0;
+		std::uint64_t m_insertions = 0;
+		std::uint64_t m_evictions = 0;		//Entries removed to stay under the budget
+		std::uint64_t m_rejected = 0;		//Results larger than the whole budget (not cached)
+		std::size_t m_entries = 0;
+		std::size_t m_bytes = 0;
+		std::size_t m_budget = 0;
+		double m_saved_ms = 0.0;			//Computation time of the results served by the cache
+		double m_hash_ms = 0.0;				//Time spent hashing the inputs
+
+		double hit_rate() const noexcept {
+			return m_hits + m_misses > 0 ? static_cast<double>(m_hits) / static_cast<double>(m_hits + m_misses) : 0.0;
+		}
+
+		std::string to_string() const;
+	};
+
+	/// <summary>
+	/// Memoization of module results: a result is cached under the module type, the module state (IModule::StateHash)
+	/// and the input image hash. Rerunning an unchanged stage (GUI live update, parameter sweep) returns its result at once.
+	/// The cached images are kept in LRU order within a memory budget.
+	/// Chained stages are cheap to key: the output of a cached stage is recognized by its buffer and is not hashed again
+	/// (only a newly allocated output: a result sharing its input buffer or kept by the module is hashed as any input).
+	/// The results are shared (no copy): do not modify them in place. The modules must be deterministic.
+	/// Thread safe. Two threads missing the same key at the same time both compute the result.
+	/// Ex:
+	/// bhd::module_cache cache(256 << 20);
+	/// cv::Mat denoised = cache.get_or_compute(denoise, input, [&](const cv::Mat& in, cv::Mat& out) { denoise.Execute(in, out); });
+	/// cv::Mat mask = cache.get_or_compute(threshold, denoised, [&](const cv::Mat& in, cv::Mat& out) { threshold.Execute(in, out); });
+	/// </summary>
+	class module_cache
+	{
+	public:
+
+		struct key
+		{
+			std::uint64_t m_module = 0;		//Module type and key
+			std::uint64_t m_state = 0;		//Configurable values
+			std::uint64_t m_input = 0;		//Input image
+
+			bool operator==(const key&) const = default;
+		};
+
+		static constexpr std::size_t DEFAULT_BUDGET = std::size_t(512) << 20;
+
+		//! Cache holding at most 'budget' bytes of images
+		explicit module_cache(std::size_t budget = DEFAULT_BUDGET) : m_budget(budget) {}
+
+		module_cache(const module_cache&) = delete;
+		module_cache& operator=(const module_cache&) = delete;
+
+		//! Key of a module run on an input
+		key make_key(const IModule& module, const cv::Mat& input) const;
+
+		//! Return true and the cached result if the key is known
+		bool find(const key& k, cv::Mat& result);
+
+		/// <summary>
+		/// Store a result. The least recently used entries are evicted to stay within the budget.
+		/// </summary>
+		/// <param name="k">Key (see make_key)</param>
+		/// <param name="result">Result, shared with the cache. Recognized by its buffer (see make_key) if no other cv::Mat references it</param>
+		/// <param name="cost">Computation time of the result (statistics)</param>
+		void insert(const key& k, const cv::Mat& result, std::chrono::nanoseconds cost = {});
+
+		/// <summary>
+		/// Return the cached result of the module on this input, or compute and cache it.
+		/// compute is either cv::Mat(const cv::Mat& input) or void(const cv::Mat& input, cv::Mat& output).
+		/// </summary>
+		template<class F>
+		cv::Mat get_or_compute(const IModule& module, const cv::Mat& input, F&& compute)
+		{
+			const key k = make_key(module, input);
+			cv::Mat result;
+			if (find(k, result))
+				return result;
+
+			const auto start = std::chrono::steady_clock::now();
+			if constexpr (std::is_invocable_v<F&, const cv::Mat&, cv::Mat&>)
+				compute(input, result);
+			else
+				result = compute(input);
+			insert(k, result, std::chrono::steady_clock::now() - start);
+			return result;
+		}
+
+		//! Remove every entry of a module type (whatever its state)
+		void erase(const IModule& module);
+
+		//! Remove every entry
+		void clear();
+
+		//! Change the memory budget (evicts if needed)
+		void set_budget(std::size_t budget);
+		std::size_t budget() const;
+
+		module_cache_stats stats() const;
+		void reset_stats();
+
+	private:
+
+		struct key_hasher
+		{
+			std::size_t operator()(const key& k) const noexcept {
+				return static_cast<std::size_t>(hash_combine(hash_combine(k.m_module, k.m_state), k.m_input));
+			}
+		};
+
+		struct entry
+		{
+			key m_key;
+			cv::Mat m_result;
+			std::size_t m_bytes = 0;
+			double m_cost_ms = 0.0;
+		};
+
+		//Result buffer of a live entry: its hash is the hash of the entry key, no need to hash the pixels
+		struct known_buffer
+		{
+			std::uint64_t m_hash = 0;
+			int m_rows = 0;
+			int m_cols = 0;
+			int m_type = 0;
+		};
+
+		mutable std::mutex m_mutex;
+		std::size_t m_budget;
+		std::list<entry> m_lru;		//Most recently used first
+		std::unordered_map<key, std::list<entry>::iterator, key_hasher> m_index;
+		std::unordered_map<const void*, known_buffer> m_buffers;
+		mutable module_cache_stats m_stats;
+
+		static std::uint64_t module_id(const IModule& module);
+		static std::uint64_t result_hash(const key& k) noexcept;
+		void evict(std::size_t budget);
+		void remove(std::list<entry>::iterator it);
+	};
+}
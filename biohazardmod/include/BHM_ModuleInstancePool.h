@@ -0,0 +1,86 @@
+#pragma once
+
+#include "BHM_Module.h"
+#include "BHM_ParameterSnapshot.h"
+
+#include <atomic>
+#include <memory>
+#include <string>
+
+namespace bhd
+{
+	/// <summary>
+	/// Statistics of a module_instance_pool
+	/// </summary>
+	struct module_instance_pool_stats
+	{
+		std::uint64_t m_calls = 0;
+		std::uint64_t m_instances = 0;	//Instances created
+		std::uint64_t m_syncs = 0;		//Instances set to a new master configuration
+
+		std::string to_string() const;
+	};
+
+	/// <summary>
+	/// Per-thread instances of modules: each thread gets its own instance of a master module type (see IModule::Clone),
+	/// with its own buffers, and reuses it across calls. An instance is synced to the master configuration only when
+	/// the master changed since the last call (see IModule::Generation). One instance per thread and module type.
+	/// The instances live in thread local storage: no lock on the calls. They are released when their thread exits, or
+	/// by the next call of their thread after the pool destruction or clear().
+	/// Ex:
+	/// bhd::module_instance_pool instances;
+	/// pool.enqueue_n(images.size(), [&](std::size_t i) {
+	///		auto& bilateral = instances.local(master);		//Instance of this worker, in the master configuration
+	///		bilateral.Execute(images[i], outputs[i]);
+	/// }).wait();
+	/// </summary>
+	class module_instance_pool
+	{
+	public:
+
+		module_instance_pool();
+
+		module_instance_pool(const module_instance_pool&) = delete;
+		module_instance_pool& operator=(const module_instance_pool&) = delete;
+
+		/// <summary>
+		/// Instance of the calling thread, in the master configuration. The master must not be edited during the call:
+		/// use the parameter_snapshot overload when an other thread edits it.
+		/// </summary>
+		/// <param name="master">Module of reference (its type must be cloneable, see TCloneable)</param>
+		IModule& local(const IModule& master);
+
+		/// <summary>
+		/// Instance of the calling thread, set to a snapshot of the master parameters (see parameter_publisher).
+		/// The master values are not read: the master can be edited concurrently.
+		/// </summary>
+		IModule& local(const IModule& master, const parameter_snapshot& parameters);
+
+		template<class TModule>
+		TModule& local(const TModule& master) {
+			return static_cast<TModule&>(local(static_cast<const IModule&>(master)));
+		}
+
+		template<class TModule>
+		TModule& local(const TModule& master, const parameter_snapshot& parameters) {
+			return static_cast<TModule&>(local(static_cast<const IModule&>(master), parameters));
+		}
+
+		//! Release the instances of every thread (recreated by their next call). The instances must not be in use
+		void clear() noexcept { m_epoch.fetch_add(1, std::memory_order_acq_rel); }
+
+		module_instance_pool_stats stats() const;
+
+	private:
+
+		std::shared_ptr<int> m_alive;		//Expires with the pool: the thread instances of a destroyed pool are released
+		std::uint64_t m_id;
+		std::atomic<std::uint64_t> m_epoch = 0;
+		std::atomic<std::uint64_t> m_calls = 0;
+		std::atomic<std::uint64_t> m_instances = 0;
+		std::atomic<std::uint64_t> m_syncs = 0;
+
+		template<class FSync>
+		IModule& local(const IModule& master, std::uint64_t generation, FSync&& sync);
+	};
+}
@@ -150,6 +150,16 @@ namespace bhd
 		virtual ~CImProcModule()
 		{	}
 
+		/// <summary>
+		/// The clones share the loggers of the module
+		/// </summary>
+		void CopyInstanceTo(IModule& clone) const override
+		{
+			IModule::CopyInstanceTo(clone);
+			if (auto* logger = dynamic_cast<ILoggerProc*>(&clone); logger != nullptr)
+				*logger = static_cast<const ILoggerProc&>(*this);
+		}
+
 	};
 
 }
\ No newline at end of file
@@ -0,0 +1,96 @@
+#pragma once
+
+#include "BHM_Module.h"
+#include "BHM_BinarySerialization.h"
+
+#include <span>
+#include <vector>
+#include <optional>
+#include <filesystem>
+#include <string_view>
+
+namespace bhd
+{
+	/// <summary>
+	/// Binary snapshot of a module state: every configurable of the module and of its submodules, keyed by its path
+	/// ("KEY", "SUB/KEY"... see IModule::FindConfigurable). Format: see binary namespace.
+	/// Much smaller and faster than the cv::FileStorage text formats: a snapshot per image or per sweep point is cheap.
+	/// Entries are found by key through a hash index, and array values (CVectorConfigurable) are read in place.
+	/// A snapshot restores the same values as the text format (the non numeric values are stored as their string value).
+	/// Ex:
+	/// bhd::module_snapshot snapshot(module);
+	/// snapshot.save("state.bhms");
+	/// auto kernel = bhd::module_snapshot::load("state.bhms").find("FILTER/KERNEL")->span<float>();
+	/// snapshot.apply(other_module);
+	/// </summary>
+	class module_snapshot
+	{
+	public:
+
+		//! Empty snapshot
+		module_snapshot() = default;
+
+		/// <summary>
+		/// Capture the state of a module
+		/// </summary>
+		/// <param name="module">Module</param>
+		/// <param name="buffer">Buffer to reuse (capacity of a previous snapshot, see release)</param>
+		explicit module_snapshot(const IModule& module, std::vector<std::uint8_t> buffer = {});
+
+		//! Snapshot from serialized bytes. Throws std::runtime_error if the bytes are not a valid snapshot
+		explicit module_snapshot(std::vector<std::uint8_t> bytes);
+
+		//! Snapshot over serialized bytes owned by the caller (memory mapped file...), without copy. The bytes must outlive the snapshot
+		static module_snapshot view(std::span<const std::uint8_t> bytes);
+
+		//! Read a snapshot file. Throws std::runtime_error on failure
+		static module_snapshot load(const std::filesystem::path& file_path);
+
+		//! Write the snapshot into a file. Throws std::runtime_error on failure
+		void save(const std::filesystem::path& file_path) const;
+
+		bool empty() const noexcept { return bytes().empty(); }
+
+		//! Serialized bytes
+		std::span<const std::uint8_t> bytes() const noexcept { return m_view.data() != nullptr ? m_view : std::span<const std::uint8_t>(m_buffer); }
+
+		//! Take the owned bytes (reused by a next capture)
+		std::vector<std::uint8_t> release() noexcept;
+
+		//! Key (alias) of the captured module
+		std::string_view key() const noexcept;
+
+		//! Number of entries (configurables)
+		std::size_t size() const noexcept { return m_header.m_entries; }
+
+		//! Entry of a configurable path, std::nullopt if unknown
+		std::optional<binary::value_view> find(std::string_view path) const;
+
+		//! Call f(const binary::value_view&) for every entry, in the module order
+		template<class F>
+		void for_each(F&& f) const
+		{
+			std::size_t offset = entries_offset();
+			for (std::uint32_t i = 0; i < m_header.m_entries; i++)
+				f(entry(offset));
+		}
+
+		/// <summary>
+		/// Set the configurables of a module to the snapshot values. The configurables not in the snapshot are unchanged.
+		/// Throws std::invalid_argument if the module key doesn't match, std::runtime_error if a value type doesn't match.
+		/// </summary>
+		/// <returns>The number of configurables set</returns>
+		std::size_t apply(IModule& module) const;
+
+	private:
+		std::vector<std::uint8_t> m_buffer;			//Owned bytes
+		std::span<const std::uint8_t> m_view;		//Or bytes of the caller
+		binary::file_header m_header;
+
+		void validate();
+		std::size_t entries_offset() const noexcept { return binary::align(sizeof(binary::file_header) + m_header.m_key_size); }
+
+		//! Entry at offset, and offset of the next entry
+		binary::value_view entry(std::size_t& offset) const;
+	};
+}
@@ -0,0 +1,199 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <algorithm>
+#include <type_traits>
+
+namespace bhd
+{
+	/// <summary>
+	/// Bounded multi-producer / multi-consumer queue on a ring buffer (D. Vyukov algorithm):
+	/// try_push / try_pop are lock-free, a single CAS on the position plus a sequence number per cell.
+	/// push / pop block on a full / empty queue (atomic wait, no mutex), until close().
+	/// T must be default constructible and move assignable.
+	/// Ex:
+	/// bhd::mpmc_queue<cv::Mat> frames(8);
+	/// producer: frames.push(std::move(frame)); ... frames.close();
+	/// consumer: cv::Mat frame; while (frames.pop(frame)) process(frame);
+	/// </summary>
+	template<class T>
+	class mpmc_queue
+	{
+		static_assert(std::is_default_constructible_v<T> && std::is_move_assignable_v<T>);
+
+		struct alignas(64) cell
+		{
+			std::atomic<std::size_t> m_sequence;
+			T m_value;
+		};
+
+		std::unique_ptr<cell[]> m_cells;
+		std::size_t m_mask;
+
+		alignas(64) std::atomic<std::size_t> m_enqueue_pos = 0;
+		alignas(64) std::atomic<std::size_t> m_dequeue_pos = 0;
+
+		// blocking side: counters waited on by the blocked consumers / producers
+		alignas(64) std::atomic<std::uint32_t> m_pushes = 0;
+		alignas(64) std::atomic<std::uint32_t> m_pops = 0;
+		std::atomic<bool> m_closed = false;
+
+		static std::size_t round_capacity(std::size_t capacity) noexcept
+		{
+			std::size_t size = 2;
+			while (size < capacity)
+				size <<= 1;
+			return size;
+		}
+
+		template<class U>
+		bool emplace(U&& value)
+		{
+			std::size_t pos = m_enqueue_pos.load(std::memory_order_relaxed);
+			for (;;)
+			{
+				cell& c = m_cells[pos & m_mask];
+				const std::size_t sequence = c.m_sequence.load(std::memory_order_acquire);
+				const auto diff = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(pos);
+				if (diff == 0)
+				{
+					if (m_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					{
+						c.m_value = std::forward<U>(value);
+						c.m_sequence.store(pos + 1, std::memory_order_release);
+						return true;
+					}
+				}
+				else if (diff < 0)
+					return false;	//Full
+				else
+					pos = m_enqueue_pos.load(std::memory_order_relaxed);
+			}
+		}
+
+	public:
+
+		//! Queue of at least 'capacity' elements (rounded up to a power of two)
+		explicit mpmc_queue(std::size_t capacity) :
+			m_cells(std::make_unique<cell[]>(round_capacity(capacity))),
+			m_mask(round_capacity(capacity) - 1)
+		{
+			for (std::size_t i = 0; i <= m_mask; i++)
+				m_cells[i].m_sequence.store(i, std::memory_order_relaxed);
+		}
+
+		mpmc_queue(const mpmc_queue&) = delete;
+		mpmc_queue& operator=(const mpmc_queue&) = delete;
+
+		//! Push an element if the queue is not full (never blocks)
+		bool try_push(T&& value)
+		{
+			if (!emplace(std::move(value)))
+				return false;
+			m_pushes.fetch_add(1, std::memory_order_release);
+			m_pushes.notify_one();
+			return true;
+		}
+
+		bool try_push(const T& value)
+		{
+			if (!emplace(value))
+				return false;
+			m_pushes.fetch_add(1, std::memory_order_release);
+			m_pushes.notify_one();
+			return true;
+		}
+
+		//! Pop the oldest element if the queue is not empty (never blocks)
+		bool try_pop(T& value)
+		{
+			std::size_t pos = m_dequeue_pos.load(std::memory_order_relaxed);
+			for (;;)
+			{
+				cell& c = m_cells[pos & m_mask];
+				const std::size_t sequence = c.m_sequence.load(std::memory_order_acquire);
+				const auto diff = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(pos + 1);
+				if (diff == 0)
+				{
+					if (m_dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					{
+						value = std::move(c.m_value);
+						c.m_value = T{};	//Release the resources (image buffers) held by the cell
+						c.m_sequence.store(pos + m_mask + 1, std::memory_order_release);
+						m_pops.fetch_add(1, std::memory_order_release);
+						m_pops.notify_one();
+						return true;
+					}
+				}
+				else if (diff < 0)
+					return false;	//Empty
+				else
+					pos = m_dequeue_pos.load(std::memory_order_relaxed);
+			}
+		}
+
+		/// <summary>
+		/// Push an element, waiting for a free cell. Return false (the element is not queued) once the queue is closed.
+		/// </summary>
+		bool push(T value)
+		{
+			for (;;)
+			{
+				const std::uint32_t seen = m_pops.load(std::memory_order_acquire);
+				if (m_closed.load(std::memory_order_acquire))
+					return false;
+				if (try_push(std::move(value)))
+					return true;
+				m_pops.wait(seen, std::memory_order_acquire);
+			}
+		}
+
+		/// <summary>
+		/// Pop the oldest element, waiting for one. Return false once the queue is closed and empty.
+		/// </summary>
+		bool pop(T& value)
+		{
+			for (;;)
+			{
+				const std::uint32_t seen = m_pushes.load(std::memory_order_acquire);
+				if (try_pop(value))
+					return true;
+				if (m_closed.load(std::memory_order_acquire))
+					return try_pop(value);
+				m_pushes.wait(seen, std::memory_order_acquire);
+			}
+		}
+
+		/// <summary>
+		/// End of the stream: the blocked producers and consumers are released, push fails, pop drains the remaining elements.
+		/// Call it after the last push.
+		/// </summary>
+		void close() noexcept
+		{
+			m_closed.store(true, std::memory_order_release);
+			m_pushes.fetch_add(1, std::memory_order_release);
+			m_pops.fetch_add(1, std::memory_order_release);
+			m_pushes.notify_all();
+			m_pops.notify_all();
+		}
+
+		bool closed() const noexcept { return m_closed.load(std::memory_order_acquire); }
+
+		//! Number of cells
+		std::size_t capacity() const noexcept { return m_mask + 1; }
+
+		//! Approximate number of queued elements (exact when no push / pop runs)
+		std::size_t size() const noexcept
+		{
+			const std::size_t enqueued = m_enqueue_pos.load(std::memory_order_acquire);
+			const std::size_t dequeued = m_dequeue_pos.load(std::memory_order_acquire);
+			return enqueued > dequeued ? std::min(enqueued - dequeued, capacity()) : 0;
+		}
+
+		bool empty() const noexcept { return size() == 0; }
+	};
+}
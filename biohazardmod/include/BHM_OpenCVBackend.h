@@ -0,0 +1,47 @@
+#pragma once
+
+#include "BHM_ThreadPool.h"
+
+#include <opencv2/opencv.hpp>
+
+#define BHD_HAS_OPENCV_PARALLEL_BACKEND (CV_VERSION_MAJOR > 4 || (CV_VERSION_MAJOR == 4 && (CV_VERSION_MINOR > 5 || (CV_VERSION_MINOR == 5 && CV_VERSION_REVISION >= 2))))
+
+#if BHD_HAS_OPENCV_PARALLEL_BACKEND
+#include <opencv2/core/parallel/parallel_backend.hpp>
+#endif
+
+namespace bhd
+{
+#if BHD_HAS_OPENCV_PARALLEL_BACKEND
+	/// <summary>
+	/// OpenCV parallel backend running cv::parallel_for_ on a bhd::thread_pool (OpenCV 4.5.2 and later).
+	/// The calling thread takes part in the loop and a worker waiting for the loop keeps running pool tasks,
+	/// so OpenCV calls nested in pool tasks (and pool tasks nested in OpenCV loops) do not deadlock.
+	/// </summary>
+	class opencv_parallel_backend : public cv::parallel::ParallelForAPI
+	{
+		thread_pool& m_pool;
+		std::atomic_int m_threads = 0;	//Concurrency limit set by cv::setNumThreads, 0 for the whole pool
+
+	public:
+		explicit opencv_parallel_backend(thread_pool& pool) noexcept : m_pool(pool) {}
+
+		void parallel_for(int tasks, FN_parallel_for_body_cb_t body_callback, void* callback_data) override;
+		int getThreadNum() const override;
+		int getNumThreads() const override;
+		int setNumThreads(int nThreads) override;
+		const char* getName() const override { return "bhd::thread_pool"; }
+	};
+#endif
+
+	/// <summary>
+	/// Make OpenCV run its internal parallel loops on a thread pool: one set of threads and one concurrency budget
+	/// for the OpenCV functions and the pool tasks, instead of two pools competing for the cores.
+	/// The pool must outlive the OpenCV calls (the default instance does).
+	/// Ex:
+	/// bhd::set_opencv_parallel_backend();	//At startup
+	/// </summary>
+	/// <param name="pool">Pool running the OpenCV loops</param>
+	/// <returns>false if OpenCV is older than 4.5.2 (no backend API): its own threads are kept</returns>
+	bool set_opencv_parallel_backend(thread_pool& pool = thread_pool::instance());
+}
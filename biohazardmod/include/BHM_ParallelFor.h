@@ -0,0 +1,71 @@
+#pragma once
+
+#include "BHM_ThreadPool.h"
+
+#include <opencv2/opencv.hpp>
+
+namespace bhd
+{
+	namespace details
+	{
+		/// <summary>
+		/// Default tile when none is given: full-width bands (row major, cache friendly) giving a few bands per thread.
+		/// </summary>
+		inline cv::Size auto_tile_size(const thread_pool& pool, const cv::Size& area)
+		{
+			const int nbands = static_cast<int>(std::min<std::size_t>(pool.auto_chunk_count(), static_cast<std::size_t>(std::max(area.height, 1))));
+			return { area.width, std::max(1, (area.height + nbands - 1) / nbands) };
+		}
+	}
+
+	/// <summary>
+	/// Parallel loop over the tiles of a rectangle area. The calling thread takes part in the loop.
+	/// Tiles are given in row-major order. Border tiles are clipped to the area.
+	/// Ex:
+	/// parallel_for_2d(pool, cv::Rect(0, 0, img.cols, img.rows), { 256, 256 }, [&](const cv::Rect& tile) { process(img(tile)); });
+	/// </summary>
+	/// <param name="pool">Thread pool</param>
+	/// <param name="area">Area to cover</param>
+	/// <param name="tile">Tile size. An empty size (0 width or height) gives full-width bands automatically</param>
+	/// <param name="fn">Tile function, called as fn(const cv::Rect& tile)</param>
+	template<class F>
+	void parallel_for_2d(thread_pool& pool, const cv::Rect& area, cv::Size tile, F&& fn)
+	{
+		if (area.empty())
+			return;
+
+		if (tile.width <= 0 || tile.height <= 0)
+			tile = details::auto_tile_size(pool, area.size());
+
+		const int ntiles_x = (area.width + tile.width - 1) / tile.width;
+		const int ntiles_y = (area.height + tile.height - 1) / tile.height;
+		const std::size_t ntiles = static_cast<std::size_t>(ntiles_x) * ntiles_y;
+
+		pool.parallel_chunks(ntiles, [&](std::size_t c)
+		{
+			const int tx = static_cast<int>(c % ntiles_x);
+			const int ty = static_cast<int>(c / ntiles_x);
+			const cv::Rect rect(area.x + tx * tile.width, area.y + ty * tile.height, tile.width, tile.height);
+			fn(rect & area);
+		});
+	}
+
+	//! Parallel loop over the tiles of the area [0, size)
+	template<class F>
+	void parallel_for_2d(thread_pool& pool, const cv::Size& size, const cv::Size& tile, F&& fn) {
+		parallel_for_2d(pool, cv::Rect({ 0, 0 }, size), tile, std::forward<F>(fn));
+	}
+
+	//! Parallel loop over the tiles of a rectangle area with the default thread pool
+	template<class F>
+	void parallel_for_2d(const cv::Rect& area, const cv::Size& tile, F&& fn) {
+		parallel_for_2d(thread_pool::instance(), area, tile, std::forward<F>(fn));
+	}
+
+	//! Parallel loop over the tiles of the area [0, size) with the default thread pool
+	template<class F>
+	void parallel_for_2d(const cv::Size& size, const cv::Size& tile, F&& fn) {
+		parallel_for_2d(thread_pool::instance(), cv::Rect({ 0, 0 }, size), tile, std::forward<F>(fn));
+	}
+
+}
@@ -0,0 +1,132 @@
+#pragma once
+
+#include "BHM_Module.h"
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <string_view>
+#include <unordered_map>
+
+namespace bhd
+{
+	namespace details
+	{
+		//Configurables of a published module, shared by all its snapshots
+		struct parameter_layout
+		{
+			std::vector<IConfigurable*> m_configurables;
+			std::vector<std::string> m_paths;
+			std::unordered_map<const IConfigurable*, std::size_t> m_index;
+			std::unordered_map<std::string, std::size_t> m_path_index;
+		};
+	}
+
+	/// <summary>
+	/// Immutable, consistent set of the parameter values of a module, published by a parameter_publisher.
+	/// The values are shared between successive snapshots: only the configurables changed in between are copies.
+	/// Safe to read from any thread while the module is being edited.
+	/// </summary>
+	class parameter_snapshot
+	{
+	public:
+
+		//! Global generation of the values (see IConfigurable::Generation)
+		std::uint64_t generation() const noexcept { return m_generation; }
+
+		//! Number of configurables
+		std::size_t size() const noexcept { return m_values.size(); }
+
+		/// <summary>
+		/// Value of a configurable of the published module.
+		/// Throws std::out_of_range if the configurable is not part of the module.
+		/// </summary>
+		template<class T>
+		const T& get(const TDataConfigurable<T>& configurable) const
+		{
+			const auto it = m_layout->m_index.find(&configurable);
+			if (it == m_layout->m_index.end())
+				throw std::out_of_range("parameter_snapshot: " + configurable.GetKey() + " is not a configurable of the module");
+			return *static_cast<const T*>(m_values[it->second].get());
+		}
+
+		/// <summary>
+		/// Value of a configurable from its path (see IModule::FindConfigurable).
+		/// Throws std::out_of_range if the path is unknown, std::invalid_argument if the type doesn't match.
+		/// </summary>
+		template<class T>
+		const T& get(const std::string& path) const
+		{
+			const auto it = m_layout->m_path_index.find(path);
+			if (it == m_layout->m_path_index.end())
+				throw std::out_of_range("parameter_snapshot: unknown configurable " + path);
+			if (dynamic_cast<const TDataConfigurable<T>*>(m_layout->m_configurables[it->second]) == nullptr)
+				throw std::invalid_argument("parameter_snapshot: type mismatch of " + path);
+			return *static_cast<const T*>(m_values[it->second].get());
+		}
+
+		/// <summary>
+		/// Set the configurables of a module of the same type (worker instance...) to the snapshot values.
+		/// Only the values that differ are copied.
+		/// </summary>
+		void apply(IModule& module) const;
+
+	private:
+		friend class parameter_publisher;
+
+		std::shared_ptr<const details::parameter_layout> m_layout;
+		std::vector<std::shared_ptr<const void>> m_values;		//One per configurable, in the layout order
+		std::uint64_t m_generation = 0;
+	};
+
+	/// <summary>
+	/// Read-copy-update of the parameters of a module between an editing thread (GUI) and processing threads.
+	/// The editing thread changes the configurables as usual and publishes them; a processing task acquires the
+	/// current snapshot when it starts and reads its values from it: it sees a consistent parameter set for its
+	/// whole run, while the editing thread keeps editing. No mutex: acquiring is an atomic shared pointer load,
+	/// publishing copies only the configurables changed since the last publication (see IConfigurable::Generation)
+	/// and swaps the snapshot pointer. The old snapshots are released by their last reader.
+	/// The module structure (configurables, submodules) must not change after the publisher creation.
+	/// Ex:
+	/// bhd::parameter_publisher publisher(bilateral);
+	/// //GUI thread, after edits
+	/// publisher.publish();
+	/// //Task launch
+	/// task = [params = publisher.acquire(), &bilateral] { cv::bilateralFilter(in, out, params->get(bilateral.m_iDiameter), ...); };
+	/// </summary>
+	class parameter_publisher
+	{
+	public:
+
+		//! Publisher of a module. The current values are published
+		explicit parameter_publisher(IModule& module);
+
+		parameter_publisher(const parameter_publisher&) = delete;
+		parameter_publisher& operator=(const parameter_publisher&) = delete;
+
+		/// <summary>
+		/// Publish the current values. Editing thread only.
+		/// </summary>
+		/// <param name="force">Copy every configurable: needed after in-place edits that were not marked (see IConfigurable::MarkChanged)</param>
+		/// <returns>True if a new snapshot was published (some values changed)</returns>
+		bool publish(bool force = false);
+
+		//! Current snapshot. Any thread
+		std::shared_ptr<const parameter_snapshot> acquire() const {
+			return m_current.load(std::memory_order_acquire);
+		}
+
+		IModule& module() noexcept { return m_module; }
+
+		//! Number of values copied by the publications (statistics)
+		std::size_t copies() const noexcept { return m_copies; }
+
+	private:
+		IModule& m_module;
+		std::shared_ptr<const details::parameter_layout> m_layout;
+		std::atomic<std::shared_ptr<const parameter_snapshot>> m_current;
+		std::size_t m_copies = 0;
+	};
+}
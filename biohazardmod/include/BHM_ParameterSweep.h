@@ -0,0 +1,181 @@
+#pragma once
+
+#include "BHM_Module.h"
+#include "BHM_ThreadPool.h"
+
+#include <memory>
+#include <string>
+#include <mutex>
+#include <vector>
+#include <functional>
+#include <filesystem>
+
+namespace bhd
+{
+	/// <summary>
+	/// Sampling of the parameter space
+	/// </summary>
+	enum class SWEEP_SAMPLING
+	{
+		GRID = 0,			//Every combination of 'steps' values per parameter
+		RANDOM,				//Uniform random points
+		LATIN_HYPERCUBE,	//Random points, each parameter range cut in as many strata as points, one point per stratum
+		N_COUNT
+	};
+
+	/// <summary>
+	/// Swept parameter: a numeric configurable (CNumericConfigurable) of the module and its range
+	/// </summary>
+	struct sweep_parameter
+	{
+		std::string m_path;			//Configurable path in the module (see IModule::FindConfigurable)
+		double m_min = 0.0;
+		double m_max = 0.0;
+		std::size_t m_steps = 5;	//Number of values of the grid sampling
+		bool m_integral = false;
+	};
+
+	/// <summary>
+	/// Evaluated point of a sweep
+	/// </summary>
+	struct sweep_point
+	{
+		std::vector<double> m_values;	//One value per parameter, in the add_parameter order
+		double m_score = 0.0;
+		double m_ms = 0.0;				//Evaluation time
+		std::string m_error;			//Empty if the evaluation succeeded
+
+		bool ok() const noexcept { return m_error.empty(); }
+	};
+
+	/// <summary>
+	/// Results of a sweep, ranked from the best score to the worst (failed points last)
+	/// </summary>
+	struct sweep_report
+	{
+		std::vector<sweep_parameter> m_parameters;
+		std::vector<sweep_point> m_points;
+		std::size_t m_workers = 0;
+		double m_wall_ms = 0.0;
+
+		//! Best point, nullptr if every point failed
+		const sweep_point* best() const noexcept;
+
+		//! Ranked table of the 'top' best points and the failures count
+		std::string to_string(std::size_t top = 10) const;
+
+		//! Write the ranked table (rank, parameter values, score, time, error)
+		void write_csv(const std::filesystem::path& path) const;
+	};
+
+	/// <summary>
+	/// Parallel parameter sweep of a module: the points of the parameter space are evaluated concurrently on the pool,
+	/// each evaluation with its own module instance (created by the factory, configured as the prototype), and ranked by score.
+	/// The parameters are numeric configurables; their range comes from the configurable (CNumericConfigurable min / max)
+	/// or is given explicitly.
+	/// Ex:
+	/// bhd::parameter_sweep sweep(
+	///		[] { return std::make_unique<BilateralModule>(); },
+	///		[&](bhd::IModule& module, const std::vector<cv::Mat>& images) { return score(static_cast<BilateralModule&>(module), images, truths); });
+	/// sweep.add_parameter("SIGMA_COLOR", 5.0, 80.0, 8).add_parameter("DIAMETER", 3, 15, 7);
+	/// auto report = sweep.run(images, bhd::SWEEP_SAMPLING::LATIN_HYPERCUBE, 200);
+	/// sweep.apply(*report.best(), sweep.prototype());
+	/// </summary>
+	class parameter_sweep
+	{
+	public:
+
+		using module_factory = std::function<std::unique_ptr<IModule>()>;
+		using score_function = std::function<double(IModule&, const std::vector<cv::Mat>&)>;
+		using progress_function = std::function<void(const sweep_point&, std::size_t done, std::size_t total)>;
+
+		/// <summary>
+		/// Parameter sweep
+		/// </summary>
+		/// <param name="factory">Create a new module instance (never called concurrently)</param>
+		/// <param name="score">Run a configured module on the image set and return its score. Called concurrently, each time with a different instance</param>
+		/// <param name="pool">Pool evaluating the points</param>
+		parameter_sweep(module_factory factory, score_function score, thread_pool& pool = thread_pool::instance());
+
+		parameter_sweep(const parameter_sweep&) = delete;
+		parameter_sweep& operator=(const parameter_sweep&) = delete;
+
+		//! Module holding the values of the parameters not swept
+		IModule& prototype() noexcept { return *m_prototype; }
+
+		/// <summary>
+		/// Sweep a numeric configurable over its own [min, max] range. Throws std::invalid_argument if the path is not
+		/// a numeric configurable or if it has no range.
+		/// </summary>
+		parameter_sweep& add_parameter(const std::string& path, std::size_t steps = 5);
+
+		/// <summary>
+		/// Sweep a numeric configurable over [min, max] (clamped to the configurable range, and to the integers within for an
+		/// integral one). Throws std::invalid_argument if the path is not a numeric configurable or if the range holds no value.
+		/// </summary>
+		parameter_sweep& add_parameter(const std::string& path, double min, double max, std::size_t steps = 5);
+
+		//! Sweep every numeric configurable having a range (submodules included)
+		parameter_sweep& add_all_parameters(std::size_t steps = 5);
+
+		const std::vector<sweep_parameter>& parameters() const noexcept { return m_parameters; }
+
+		//! Higher scores are better (default), or lower scores
+		void set_maximize(bool maximize) noexcept { m_maximize = maximize; }
+
+		//! Callback called after each point (serialized: it does not have to be thread safe). Its exceptions are ignored
+		void set_progress(progress_function progress) { m_progress = std::move(progress); }
+
+		/// <summary>
+		/// Points of the parameter space (one value per parameter)
+		/// </summary>
+		/// <param name="sampling">Sampling method</param>
+		/// <param name="count">Number of points of the random samplings (ignored by the grid)</param>
+		/// <param name="seed">Random seed</param>
+		std::vector<std::vector<double>> sample(SWEEP_SAMPLING sampling, std::size_t count = 0, std::uint64_t seed = 0) const;
+
+		/// <summary>
+		/// Evaluate the points of the sampling on an image set. Must not be called from a worker of the pool.
+		/// </summary>
+		sweep_report run(const std::vector<cv::Mat>& images, SWEEP_SAMPLING sampling = SWEEP_SAMPLING::GRID, std::size_t count = 0, std::uint64_t seed = 0);
+
+		//! Evaluate given points
+		sweep_report run(const std::vector<cv::Mat>& images, std::vector<std::vector<double>> points);
+
+		//! Set the parameters of a module to the values of a point
+		void apply(const sweep_point& point, IModule& module) const;
+
+	private:
+
+		module_factory m_factory;
+		score_function m_score;
+		thread_pool& m_pool;
+		progress_function m_progress;
+		bool m_maximize = true;
+
+		std::unique_ptr<IModule> m_prototype;
+		std::vector<sweep_parameter> m_parameters;
+		std::vector<std::unique_ptr<IModule>> m_modules;	//At least one per worker and one for the calling thread
+		std::vector<IModule*> m_free;						//Instances not used by an evaluation
+		std::mutex m_modules_mutex;							//Protects m_modules and m_free during a run
+
+		IModule& acquire_module();
+		void release_module(IModule& module) noexcept;
+		void apply(const std::vector<double>& values, IModule& module) const;
+	};
+
+	/// <summary>
+	/// Create a parameter sweep from a factory of a concrete module type: the score function receives this type.
+	/// </summary>
+	template<class TFactory, class TScore>
+	parameter_sweep make_parameter_sweep(TFactory factory, TScore score, thread_pool& pool = thread_pool::instance())
+	{
+		using module_t = typename std::invoke_result_t<TFactory&>::element_type;
+		static_assert(std::is_base_of_v<IModule, module_t>, "The factory must return a std::unique_ptr of a module");
+
+		return parameter_sweep(
+			[factory = std::move(factory)]() mutable -> std::unique_ptr<IModule> { return factory(); },
+			[score = std::move(score)](IModule& module, const std::vector<cv::Mat>& images) -> double { return score(static_cast<module_t&>(module), images); },
+			pool);
+	}
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "BHM_ThreadPool.h"
+#include "BHM_Logger.h"
+
+namespace bhd
+{
+	/// <summary>
+	/// Periodic dump of the instrumentation of a thread_pool, from its own thread.
+	/// Each period, the stats report is sent to a logger (if any) and the queue depths are sampled.
+	/// On destruction, the task events and the queue samples are written as a Chrome trace (if a path is given).
+	/// The pool should be built with POOL_STATS::COUNTERS (or TRACE for the task events), and must outlive the monitor.
+	/// Ex:
+	/// bhd::thread_pool_options options;
+	/// options.m_stats = bhd::POOL_STATS::TRACE;
+	/// bhd::thread_pool pool(options);
+	/// bhd::pool_monitor monitor(pool, std::chrono::seconds(1), &bhd::logging::Logger(), "pool_trace.json");
+	/// </summary>
+	class pool_monitor
+	{
+		thread_pool& m_pool;
+		std::chrono::steady_clock::duration m_period;
+		const logging::CLogger* m_logger;
+		std::filesystem::path m_trace_path;
+
+		std::vector<queue_sample> m_samples;
+		std::mutex m_mutex;
+		std::condition_variable m_condition;
+		bool m_stop = false;
+		std::thread m_thread;
+
+		void run()
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			while (!m_condition.wait_for(lock, m_period, [this] { return m_stop; }))
+			{
+				//Sample and log unlocked: samples() and the destructor don't wait for the report
+				lock.unlock();
+				auto sample = m_pool.sample_queues();
+				if (m_logger != nullptr)
+					m_logger->LogInfo(m_pool.stats().to_string());
+				lock.lock();
+				m_samples.push_back(std::move(sample));
+			}
+		}
+
+	public:
+
+		/// <summary>
+		/// Start the monitoring thread.
+		/// </summary>
+		/// <param name="pool">Monitored pool</param>
+		/// <param name="period">Time between two dumps</param>
+		/// <param name="logger">Destination of the periodic reports, nullptr to only sample the queues</param>
+		/// <param name="trace_path">Chrome trace written on destruction, empty for none</param>
+		pool_monitor(thread_pool& pool, std::chrono::steady_clock::duration period, const logging::CLogger* logger = nullptr, std::filesystem::path trace_path = {})
+			: m_pool(pool), m_period(period), m_logger(logger), m_trace_path(std::move(trace_path)), m_thread([this] { run(); })
+		{
+		}
+
+		pool_monitor(const pool_monitor&) = delete;
+		pool_monitor& operator=(const pool_monitor&) = delete;
+
+		~pool_monitor()
+		{
+			{
+				const std::lock_guard<std::mutex> lock(m_mutex);
+				m_stop = true;
+			}
+			m_condition.notify_all();
+			m_thread.join();
+
+			if (m_trace_path.empty())
+				return;
+			try {
+				write_chrome_trace(m_trace_path, m_pool.trace(), m_samples);
+			}
+			catch (const std::exception& e) {
+				if (m_logger != nullptr)
+					m_logger->LogError(e.what());
+			}
+		}
+
+		//! Queue depth samples recorded so far
+		std::vector<queue_sample> samples()
+		{
+			const std::lock_guard<std::mutex> lock(m_mutex);
+			return m_samples;
+		}
+	};
+}
@@ -0,0 +1,171 @@
+#pragma once
+
+#include <array>
+#include <mutex>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <filesystem>
+
+namespace bhd
+{
+	/// <summary>
+	/// Instrumentation level of a thread_pool (see thread_pool_options::m_stats)
+	/// </summary>
+	enum class POOL_STATS
+	{
+		OFF = 0,	//No measurement (default, no overhead)
+		COUNTERS,	//Per-worker counters and latency / duration histograms
+		TRACE,		//COUNTERS + one event per task, for a Chrome trace (chrome://tracing, Perfetto)
+		N_COUNT
+	};
+
+	/// <summary>
+	/// Histogram of durations with power-of-two buckets: bucket b counts the durations in [2^b, 2^(b+1)) ns.
+	/// </summary>
+	class duration_histogram
+	{
+	public:
+		static constexpr std::size_t N_BUCKETS = 40;	//Up to ~18 minutes
+
+		std::array<std::uint64_t, N_BUCKETS> m_counts = {};
+
+		//! Bucket of a duration in nanoseconds
+		static std::size_t bucket(std::int64_t ns) noexcept
+		{
+			std::size_t b = 0;
+			for (std::uint64_t v = ns > 0 ? static_cast<std::uint64_t>(ns) : 0; v > 1 && b + 1 < N_BUCKETS; v >>= 1)
+				b++;
+			return b;
+		}
+
+		void add(std::int64_t ns) noexcept { m_counts[bucket(ns)]++; }
+
+		void merge(const duration_histogram& other) noexcept
+		{
+			for (std::size_t b = 0; b < N_BUCKETS; b++)
+				m_counts[b] += other.m_counts[b];
+		}
+
+		std::uint64_t count() const noexcept;
+
+		/// <summary>
+		/// Duration below which a fraction p of the samples lies (upper bound of the matching bucket).
+		/// </summary>
+		/// <param name="p">Fraction in [0, 1] (0.5: median, 0.99: 99th percentile)</param>
+		/// <returns>Duration in milliseconds, 0 without sample</returns>
+		double percentile_ms(double p) const noexcept;
+	};
+
+	/// <summary>
+	/// Counters of one worker
+	/// </summary>
+	struct worker_stats
+	{
+		std::uint64_t m_executed = 0;	//Tasks run by the worker (including the ones run while helping in get())
+		std::uint64_t m_stolen = 0;		//Tasks taken from another worker or from the injection queue (possibly run meanwhile by get())
+		double m_busy_ms = 0.0;			//Time spent running tasks (the nested tasks run while helping in get() are counted once)
+		double m_idle_ms = 0.0;			//Time spent parked (completed parking periods)
+		double m_steal_ms = 0.0;		//Time spent looking for work in the other queues
+		std::size_t m_queue_depth = 0;	//Current size of its deques
+	};
+
+	/// <summary>
+	/// Snapshot of the instrumentation of a thread_pool (see thread_pool::stats)
+	/// </summary>
+	struct pool_stats
+	{
+		double m_elapsed_ms = 0.0;			//Time since the pool construction
+		std::vector<worker_stats> m_workers;
+		std::size_t m_queued = 0;			//Tasks currently queued (all queues)
+		std::size_t m_max_queued = 0;		//High-water mark of the queued tasks
+		duration_histogram m_latency;		//Enqueue to start latency
+		duration_histogram m_duration;		//Task durations
+
+		//! Multi-line human readable report
+		std::string to_string() const;
+	};
+
+	/// <summary>
+	/// One task execution, recorded in POOL_STATS::TRACE mode
+	/// </summary>
+	struct trace_event
+	{
+		std::int64_t m_start_ns = 0;	//Since the pool construction
+		std::int64_t m_duration_ns = 0;
+	};
+
+	/// <summary>
+	/// Queue depth sample (see pool_monitor)
+	/// </summary>
+	struct queue_sample
+	{
+		std::int64_t m_time_ns = 0;		//Since the pool construction
+		std::vector<std::size_t> m_depths;	//Per worker deque, then the injection queue last
+	};
+
+	/// <summary>
+	/// Write a Chrome trace JSON file (chrome://tracing or https://ui.perfetto.dev):
+	/// one track per worker with its tasks, and a counter track with the queue depths.
+	/// </summary>
+	/// <param name="path">Output file</param>
+	/// <param name="workers">Task events of each worker</param>
+	/// <param name="samples">Queue depth samples (can be empty)</param>
+	/// <param name="name">Process name shown in the viewer</param>
+	void write_chrome_trace(const std::filesystem::path& path, const std::vector<std::vector<trace_event>>& workers,
+		const std::vector<queue_sample>& samples, const std::string& name = "bhd::thread_pool");
+
+	namespace details
+	{
+		/// <summary>
+		/// Live counters of a thread_pool. Each worker slot is only written by its worker (relaxed atomics, own cache line).
+		/// </summary>
+		class pool_instrumentation
+		{
+		public:
+			using clock = std::chrono::steady_clock;
+
+			struct alignas(64) worker_slot
+			{
+				std::atomic<std::uint64_t> m_executed = 0;
+				std::atomic<std::uint64_t> m_stolen = 0;
+				std::atomic<std::int64_t> m_busy_ns = 0;
+				std::atomic<std::int64_t> m_idle_ns = 0;
+				std::atomic<std::int64_t> m_steal_ns = 0;
+				std::int64_t m_accounted_ns = 0;	//Busy + idle + steal time recorded so far (worker only): excludes the nested tasks from the busy time
+				std::array<std::atomic<std::uint64_t>, duration_histogram::N_BUCKETS> m_latency = {};
+				std::array<std::atomic<std::uint64_t>, duration_histogram::N_BUCKETS> m_duration = {};
+
+				std::mutex m_trace_mutex;	//Only contended while a trace is being read
+				std::vector<trace_event> m_trace;
+			};
+
+			POOL_STATS m_level;
+			clock::time_point m_origin = clock::now();
+			std::vector<std::unique_ptr<worker_slot>> m_slots;	//One per worker
+			std::atomic<std::size_t> m_max_queued = 0;
+			std::size_t m_trace_capacity;	//Maximum number of events kept per worker
+
+			pool_instrumentation(POOL_STATS level, std::size_t nworkers, std::size_t trace_capacity);
+
+			std::int64_t since_origin(clock::time_point t) const noexcept {
+				return std::chrono::duration_cast<std::chrono::nanoseconds>(t - m_origin).count();
+			}
+
+			void on_queued(std::size_t queued) noexcept;
+			//! Time accounted on a worker slot, to pass to on_task (from its worker only)
+			std::int64_t accounted(std::size_t slot) const noexcept { return m_slots[slot]->m_accounted_ns; }
+
+			//! 'accounted' is accounted(slot) at the task start: the tasks run meanwhile by the same worker (help in get()) are not counted twice as busy
+			void on_task(std::size_t slot, clock::time_point queued_at, clock::time_point start, clock::time_point end, std::int64_t accounted);
+			void on_steal(std::size_t slot, clock::duration span, bool found) noexcept;
+			void on_idle(std::size_t slot, clock::duration span) noexcept;
+
+			pool_stats snapshot() const;
+			std::vector<std::vector<trace_event>> trace() const;
+		};
+	}
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+namespace cv
+{
+	class MatAllocator;
+}
+
+namespace bhd
+{
+	/// <summary>
+	/// Bump allocator for the temporaries of a task: an allocation is a pointer increment in a reused chunk,
+	/// and everything is released at once by rolling back to a marker. No malloc / free in the steady state.
+	/// Each thread has its own arena (see local()): a pool task rolls it back when it ends (on a worker or inline in get()),
+	/// and a scratch_scope does the same for a function running anywhere.
+	/// Not thread safe: an arena is only used by its thread.
+	/// </summary>
+	class scratch_arena
+	{
+	public:
+
+		//! Position in the arena, see mark() / rollback()
+		struct marker
+		{
+			std::size_t m_chunk = 0;
+			std::size_t m_offset = 0;
+			std::size_t m_live = 0;		//Live Mat buffers at the mark
+		};
+
+		static constexpr std::size_t DEFAULT_CHUNK_SIZE = std::size_t(1) << 20;
+
+		explicit scratch_arena(std::size_t chunk_size = DEFAULT_CHUNK_SIZE);
+		~scratch_arena();
+		scratch_arena(const scratch_arena&) = delete;
+		scratch_arena& operator=(const scratch_arena&) = delete;
+
+		//! Arena of the calling thread
+		static scratch_arena& local();
+
+		/// <summary>
+		/// Allocate a block valid until the next rollback before it. A new chunk is added if the current one is full.
+		/// </summary>
+		/// <param name="size">Size in bytes</param>
+		/// <param name="alignment">Power of two alignment</param>
+		void* allocate(std::size_t size, std::size_t alignment = alignof(std::max_align_t));
+
+		//! Give back a block. The memory is only reused if it is the last allocated block (stack order), else at the rollback
+		void deallocate(void* ptr, std::size_t size) noexcept;
+
+		//! Current position
+		marker mark() const noexcept { return { m_current, m_chunks.empty() ? 0 : m_chunks[m_current].m_offset, m_live }; }
+
+		/// <summary>
+		/// Release every block allocated since the marker. Rolling back to the start also merges the chunks
+		/// into a single one, so that the next tasks with the same footprint use one chunk.
+		/// </summary>
+		void rollback(const marker& mark) noexcept;
+
+		//! Release everything
+		void reset() noexcept { rollback({}); }
+
+		//! Bytes currently allocated
+		std::size_t used() const noexcept;
+
+		//! Bytes reserved by the chunks
+		std::size_t capacity() const noexcept;
+
+		//! Maximum of used() since the construction
+		std::size_t high_water() const noexcept { return m_high_water; }
+
+		//! Number of chunks
+		std::size_t chunks() const noexcept { return m_chunks.size(); }
+
+		/// <summary>
+		/// OpenCV allocator backed by this arena (see BHM_ScratchMat.h). A Mat using it must not outlive the current scope.
+		/// </summary>
+		cv::MatAllocator* mat_allocator();
+
+		//! Bookkeeping of the Mat allocator: buffers still referenced by a Mat
+		void add_live(std::ptrdiff_t count) noexcept { m_live += count; }
+
+	private:
+
+		struct chunk
+		{
+			std::unique_ptr<std::byte[]> m_data;
+			std::size_t m_size = 0;
+			std::size_t m_offset = 0;
+		};
+
+		std::size_t m_chunk_size;
+		std::vector<chunk> m_chunks;
+		std::size_t m_current = 0;
+		std::size_t m_live = 0;
+		std::size_t m_high_water = 0;
+		std::unique_ptr<cv::MatAllocator> m_mat_allocator;
+
+		void* allocate_in(chunk& c, std::size_t size, std::size_t alignment) noexcept;
+	};
+
+	/// <summary>
+	/// Scope of temporaries: every block allocated from the arena during the scope is released at its end.
+	/// Scopes nest (a task calling get() may run other tasks inside its own scope).
+	/// Ex:
+	/// bhd::scratch_scope scope;
+	/// cv::Mat tmp = bhd::scratch_mat();
+	/// cv::blur(in, tmp, ksize);
+	/// </summary>
+	class scratch_scope
+	{
+		scratch_arena& m_arena;
+		scratch_arena::marker m_mark;
+
+	public:
+		explicit scratch_scope(scratch_arena& arena = scratch_arena::local()) noexcept : m_arena(arena), m_mark(arena.mark()) {}
+		~scratch_scope() { m_arena.rollback(m_mark); }
+		scratch_scope(const scratch_scope&) = delete;
+		scratch_scope& operator=(const scratch_scope&) = delete;
+
+		scratch_arena& arena() const noexcept { return m_arena; }
+	};
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "BHM_ScratchArena.h"
+
+#include <opencv2/opencv.hpp>
+
+namespace bhd
+{
+	/// <summary>
+	/// cv::MatAllocator placing the Mat buffers (and their UMatData) in a scratch_arena.
+	/// Releasing the last created Mat gives its memory back immediately, the others at the end of the scratch scope.
+	/// </summary>
+	class scratch_mat_allocator : public cv::MatAllocator
+	{
+		scratch_arena& m_arena;
+
+	public:
+		explicit scratch_mat_allocator(scratch_arena& arena) noexcept : m_arena(arena) {}
+
+		cv::UMatData* allocate(int dims, const int* sizes, int type, void* data0, size_t* step, cv::AccessFlag flags, cv::UMatUsageFlags usageFlags) const override;
+		bool allocate(cv::UMatData* data, cv::AccessFlag accessflags, cv::UMatUsageFlags usageFlags) const override;
+		void deallocate(cv::UMatData* data) const override;
+	};
+
+	/// <summary>
+	/// Empty Mat allocating from the arena of the calling thread. Valid until the end of the enclosing
+	/// scratch_scope or pool task: copy the result to a regular Mat before returning it.
+	/// Ex:
+	/// cv::Mat mu = bhd::scratch_mat();
+	/// cv::blur(image, mu, ksize);		//No malloc once the arena is warm
+	/// </summary>
+	inline cv::Mat scratch_mat()
+	{
+		cv::Mat mat;
+		mat.allocator = scratch_arena::local().mat_allocator();
+		return mat;
+	}
+
+	//! Mat of the given size and type allocated from the arena of the calling thread (see scratch_mat())
+	inline cv::Mat scratch_mat(cv::Size size, int type)
+	{
+		cv::Mat mat = scratch_mat();
+		mat.create(size, type);
+		return mat;
+	}
+}
@@ -0,0 +1,446 @@
+#pragma once
+
+#include "BHM_Module.h"
+#include "BHM_MpmcQueue.h"
+
+#include <map>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <chrono>
+#include <cassert>
+#include <exception>
+#include <functional>
+
+namespace bhd
+{
+	/// <summary>
+	/// Metrics of a pipeline stage
+	/// </summary>
+	struct stage_stats
+	{
+		std::string m_name;
+		std::size_t m_workers = 0;
+		std::uint64_t m_frames = 0;			//Frames out of the stage (errors included)
+		std::uint64_t m_errors = 0;			//Frames on which the stage threw
+		double m_busy_ms = 0.0;				//Processing time, sum of the workers
+		double m_wait_input_ms = 0.0;		//Time blocked on an empty input queue (starving)
+		double m_wait_output_ms = 0.0;		//Time blocked on a full output queue (backpressure of the next stage)
+		double m_throughput = 0.0;			//Frames per second since the start
+		double m_utilization = 0.0;			//Busy time / (elapsed time * workers), in [0, 1]
+		std::size_t m_queue_size = 0;		//Current depth of the input queue
+		std::size_t m_queue_capacity = 0;
+		std::size_t m_queue_peak = 0;		//Maximum depth seen by the workers
+		double m_queue_fill = 0.0;			//Average fill ratio of the input queue seen by the workers, in [0, 1]
+	};
+
+	/// <summary>
+	/// Metrics of a stage pipeline: the stage with the highest utilization is the bottleneck,
+	/// a full queue in front of it and empty queues after it confirm it.
+	/// </summary>
+	struct pipeline_stats
+	{
+		std::vector<stage_stats> m_stages;
+		double m_elapsed_ms = 0.0;
+		std::uint64_t m_frames_in = 0;
+		std::uint64_t m_frames_out = 0;
+
+		//! Stage with the highest utilization, nullptr without stage
+		const stage_stats* bottleneck() const noexcept;
+
+		//! Human readable report, one line per stage
+		std::string to_string() const;
+	};
+
+	namespace details
+	{
+		//! Counters of a stage, updated by its workers
+		struct stage_counters
+		{
+			alignas(64) std::atomic<std::uint64_t> m_frames = 0;
+			std::atomic<std::uint64_t> m_errors = 0;
+			std::atomic<std::int64_t> m_busy_ns = 0;
+			std::atomic<std::int64_t> m_wait_input_ns = 0;
+			std::atomic<std::int64_t> m_wait_output_ns = 0;
+			std::atomic<std::uint64_t> m_fill_sum = 0;		//Sum of the input depths seen at each pop
+			std::atomic<std::size_t> m_fill_peak = 0;
+
+			void sample_fill(std::size_t depth) noexcept
+			{
+				m_fill_sum.fetch_add(depth, std::memory_order_relaxed);
+				std::size_t peak = m_fill_peak.load(std::memory_order_relaxed);
+				while (depth > peak && !m_fill_peak.compare_exchange_weak(peak, depth, std::memory_order_relaxed)) {}
+			}
+		};
+	}
+
+	/// <summary>
+	/// Streaming pipeline of image processing stages (denoise -> threshold -> contours...).
+	/// Each stage runs on its own threads, connected to the next stage by a bounded lock-free queue (mpmc_queue):
+	/// frame N+1 is denoised while frame N is thresholded. A full queue blocks the previous stage (backpressure),
+	/// so the memory in flight is bounded by the queue capacities.
+	/// A stage with several workers processes several frames at once; the output keeps the input order anyway: the frames
+	/// out of order wait for their predecessors in a reorder buffer. push() admits a frame only while the frames in flight
+	/// (queued, processed or waiting in the reorder buffer) fit in the pipeline (queue capacities + workers), so a slow
+	/// frame holds back the producer rather than growing the reorder buffer.
+	/// If a stage throws, the next stages skip the frame and pop() rethrows the exception for this frame.
+	/// TFrame is the data travelling through the stages (cv::Mat, or a structure with the image and the results).
+	/// Ex:
+	/// bhd::stage_pipeline<Frame> pipeline(4);
+	/// pipeline.add_module_stage("denoise", [] { return std::make_unique<DenoiseModule>(); },
+	///		[](DenoiseModule& module, Frame& frame) { module.Execute(frame.m_image, frame.m_image); }, 2);
+	/// pipeline.add_stage("contours", [](Frame& frame) { cv::findContours(frame.m_image, frame.m_contours, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE); });
+	/// pipeline.start();
+	/// producer: pipeline.push(std::move(frame)); ... pipeline.close();
+	/// consumer: Frame frame; while (pipeline.pop(frame)) show(frame);
+	/// </summary>
+	template<class TFrame = cv::Mat>
+	class stage_pipeline
+	{
+	public:
+
+		using frame_t = TFrame;
+		using stage_function = std::function<void(TFrame&)>;
+
+	private:
+
+		using clock = std::chrono::steady_clock;
+
+		struct item
+		{
+			std::uint64_t m_index = 0;
+			TFrame m_frame = {};
+			std::exception_ptr m_error;
+		};
+
+		using queue_t = mpmc_queue<item>;
+
+		struct stage
+		{
+			std::string m_name;
+			std::vector<stage_function> m_functions;	//One per worker
+			std::unique_ptr<queue_t> m_input;
+			details::stage_counters m_counters;
+			std::atomic<std::size_t> m_active = 0;		//Running workers: the last one closes the next queue
+			std::vector<std::thread> m_threads;
+		};
+
+		std::size_t m_queue_capacity;
+		std::vector<std::unique_ptr<stage>> m_stages;
+		std::unique_ptr<queue_t> m_output;
+		bool m_started = false;
+		clock::time_point m_start;
+
+		// producer side
+		std::atomic<std::uint64_t> m_next_in = 0;
+		std::size_t m_window = 0;						//Maximum frames in flight, reorder buffer included
+		std::atomic<std::uint32_t> m_delivered = 0;		//Waited on by a producer with a full window (deliveries and close)
+
+		// consumer side: frames out of order wait for their predecessors (at most m_window)
+		std::atomic<std::uint64_t> m_next_out = 0;
+		std::map<std::uint64_t, item> m_reorder;
+
+		//! Wait until a frame fits in the window. false once the pipeline is closed
+		bool wait_window()
+		{
+			for (;;)
+			{
+				const std::uint32_t seen = m_delivered.load(std::memory_order_acquire);
+				if (m_stages.front()->m_input->closed())
+					return false;
+				if (in_flight() < m_window)
+					return true;
+				m_delivered.wait(seen, std::memory_order_acquire);
+			}
+		}
+
+		void run_stage(stage& s, std::size_t worker, queue_t& output)
+		{
+			auto& counters = s.m_counters;
+			item current;
+			for (;;)
+			{
+				const auto wait_start = clock::now();
+				const std::size_t depth = s.m_input->size();
+				if (!s.m_input->pop(current))
+					break;
+				const auto start = clock::now();
+				counters.m_wait_input_ns.fetch_add((start - wait_start).count(), std::memory_order_relaxed);
+				counters.sample_fill(depth);
+
+				if (!current.m_error)
+				{
+					try
+					{
+						s.m_functions[worker](current.m_frame);
+					}
+					catch (...)
+					{
+						current.m_error = std::current_exception();
+						counters.m_errors.fetch_add(1, std::memory_order_relaxed);
+					}
+				}
+				const auto end = clock::now();
+				counters.m_busy_ns.fetch_add((end - start).count(), std::memory_order_relaxed);
+				counters.m_frames.fetch_add(1, std::memory_order_relaxed);
+
+				output.push(std::move(current));
+				counters.m_wait_output_ns.fetch_add((clock::now() - end).count(), std::memory_order_relaxed);
+			}
+
+			if (s.m_active.fetch_sub(1) == 1)
+				output.close();
+		}
+
+		bool deliver(item& current, TFrame& frame)
+		{
+			m_next_out.fetch_add(1, std::memory_order_relaxed);
+			m_delivered.fetch_add(1, std::memory_order_release);
+			m_delivered.notify_one();
+			if (current.m_error)
+				std::rethrow_exception(current.m_error);
+			frame = std::move(current.m_frame);
+			return true;
+		}
+
+	public:
+
+		/// <summary>
+		/// Empty pipeline
+		/// </summary>
+		/// <param name="queue_capacity">Capacity of each queue (input of every stage and output), rounded up to a power of two</param>
+		explicit stage_pipeline(std::size_t queue_capacity = 8) :
+			m_queue_capacity(std::max<std::size_t>(queue_capacity, 2))
+		{	}
+
+		stage_pipeline(const stage_pipeline&) = delete;
+		stage_pipeline& operator=(const stage_pipeline&) = delete;
+
+		//! Close the input and wait for the stages: frames not popped yet are dropped
+		~stage_pipeline()
+		{
+			if (!m_started)
+				return;
+			close();
+			//Drain the output so that no stage stays blocked on a full queue
+			item current;
+			while (m_output->pop(current)) {}
+			for (auto& s : m_stages)
+				for (auto& thread : s->m_threads)
+					thread.join();
+		}
+
+		/// <summary>
+		/// Append a stage running a function. With several workers, the function is called concurrently and must be thread safe.
+		/// </summary>
+		/// <param name="name">Stage name (metrics)</param>
+		/// <param name="function">Processing of a frame, in place</param>
+		/// <param name="workers">Number of threads of the stage</param>
+		stage_pipeline& add_stage(std::string name, stage_function function, std::size_t workers = 1)
+		{
+			return add_stage(std::move(name), std::vector<stage_function>(std::max<std::size_t>(workers, 1), std::move(function)));
+		}
+
+		/// <summary>
+		/// Append a stage with one function per worker
+		/// </summary>
+		stage_pipeline& add_stage(std::string name, std::vector<stage_function> functions)
+		{
+			assert(!m_started && "Stages are added before start()");
+			assert(!functions.empty());
+			auto s = std::make_unique<stage>();
+			s->m_name = std::move(name);
+			s->m_functions = std::move(functions);
+			s->m_input = std::make_unique<queue_t>(m_queue_capacity);
+			m_stages.push_back(std::move(s));
+			return *this;
+		}
+
+		/// <summary>
+		/// Append a stage running a module: each worker gets its own instance from the factory, configured as the first one
+		/// (so the module needs no lock). process(module, frame) processes a frame in place.
+		/// </summary>
+		/// <param name="name">Stage name (metrics)</param>
+		/// <param name="factory">Return a std::unique_ptr of a module</param>
+		/// <param name="process">Processing of a frame with a module instance</param>
+		/// <param name="workers">Number of threads (and module instances) of the stage</param>
+		template<class TFactory, class TProcess>
+		stage_pipeline& add_module_stage(std::string name, TFactory factory, TProcess process, std::size_t workers = 1)
+		{
+			using module_t = typename std::invoke_result_t<TFactory&>::element_type;
+			static_assert(std::is_base_of_v<IModule, module_t>, "The factory must return a std::unique_ptr of a module");
+
+			std::vector<stage_function> functions;
+			std::shared_ptr<module_t> first;
+			for (std::size_t i = 0; i < std::max<std::size_t>(workers, 1); i++)
+			{
+				std::shared_ptr<module_t> module = factory();
+				if (!first)
+					first = module;
+				else
+					first->CopyTo(*module);
+				functions.emplace_back([module, process](TFrame& frame) { process(*module, frame); });
+			}
+			return add_stage(std::move(name), std::move(functions));
+		}
+
+		/// <summary>
+		/// Start the stage threads. The pipeline is fixed from now on.
+		/// </summary>
+		void start()
+		{
+			assert(!m_started && "Pipeline already started");
+			assert(!m_stages.empty() && "No stage");
+			m_output = std::make_unique<queue_t>(m_queue_capacity);
+			m_start = clock::now();
+			m_started = true;
+			m_window = m_output->capacity();
+			for (const auto& s : m_stages)
+				m_window += s->m_input->capacity() + s->m_functions.size();
+			for (std::size_t i = 0; i < m_stages.size(); i++)
+			{
+				stage& s = *m_stages[i];
+				queue_t& output = i + 1 < m_stages.size() ? *m_stages[i + 1]->m_input : *m_output;
+				s.m_active = s.m_functions.size();
+				for (std::size_t worker = 0; worker < s.m_functions.size(); worker++)
+					s.m_threads.emplace_back([this, &s, worker, &output] { run_stage(s, worker, output); });
+			}
+		}
+
+		/// <summary>
+		/// Send a frame into the pipeline, waiting if the first stage is full or if the pipeline holds as many frames as it can
+		/// (waiting for the consumer). Single producer.
+		/// </summary>
+		/// <returns>false if the pipeline is closed</returns>
+		bool push(TFrame frame)
+		{
+			assert(m_started && "start() the pipeline first");
+			if (!wait_window() || !m_stages.front()->m_input->push(item{ m_next_in.load(std::memory_order_relaxed), std::move(frame), nullptr }))
+				return false;
+			m_next_in.fetch_add(1, std::memory_order_relaxed);
+			return true;
+		}
+
+		/// <summary>
+		/// Send a frame if the first stage has room (never blocks): a live source can drop the frame instead of lagging.
+		/// On failure, the frame is left untouched.
+		/// </summary>
+		bool try_push(TFrame& frame)
+		{
+			assert(m_started && "start() the pipeline first");
+			if (in_flight() >= m_window)
+				return false;
+			item current{ m_next_in.load(std::memory_order_relaxed), std::move(frame), nullptr };
+			if (!m_stages.front()->m_input->try_push(std::move(current)))
+			{
+				frame = std::move(current.m_frame);
+				return false;
+			}
+			m_next_in.fetch_add(1, std::memory_order_relaxed);
+			return true;
+		}
+
+		/// <summary>
+		/// Next processed frame, in the push order, waiting for it. Single consumer.
+		/// Rethrows the exception of a stage which failed on this frame (the frame is consumed).
+		/// </summary>
+		/// <returns>false once the pipeline is closed and every frame is out</returns>
+		bool pop(TFrame& frame)
+		{
+			assert(m_started && "start() the pipeline first");
+			for (;;)
+			{
+				if (auto it = m_reorder.find(m_next_out); it != m_reorder.end())
+				{
+					item current = std::move(it->second);
+					m_reorder.erase(it);
+					return deliver(current, frame);
+				}
+
+				item current;
+				if (!m_output->pop(current))
+					return false;
+				if (current.m_index == m_next_out)
+					return deliver(current, frame);
+				m_reorder.emplace(current.m_index, std::move(current));
+			}
+		}
+
+		/// <summary>
+		/// Next processed frame if it is already out (never blocks)
+		/// </summary>
+		bool try_pop(TFrame& frame)
+		{
+			assert(m_started && "start() the pipeline first");
+			item current;
+			while (m_output->try_pop(current))
+			{
+				if (current.m_index == m_next_out)
+					return deliver(current, frame);
+				m_reorder.emplace(current.m_index, std::move(current));
+			}
+			if (auto it = m_reorder.find(m_next_out); it != m_reorder.end())
+			{
+				current = std::move(it->second);
+				m_reorder.erase(it);
+				return deliver(current, frame);
+			}
+			return false;
+		}
+
+		/// <summary>
+		/// End of the stream: the stages finish the queued frames, then pop() returns false. Call it after the last push.
+		/// </summary>
+		void close() noexcept
+		{
+			if (!m_started)
+				return;
+			m_stages.front()->m_input->close();
+			m_delivered.fetch_add(1, std::memory_order_release);
+			m_delivered.notify_all();
+		}
+
+		//! Number of stages
+		std::size_t size() const noexcept { return m_stages.size(); }
+
+		//! Frames pushed and not popped yet
+		std::uint64_t in_flight() const noexcept { return m_next_in.load(std::memory_order_relaxed) - m_next_out.load(std::memory_order_relaxed); }
+
+		/// <summary>
+		/// Snapshot of the stage metrics (can be called from any thread while the pipeline runs)
+		/// </summary>
+		pipeline_stats stats() const
+		{
+			pipeline_stats stats;
+			stats.m_elapsed_ms = m_started ? std::chrono::duration<double, std::milli>(clock::now() - m_start).count() : 0.0;
+			stats.m_frames_in = m_next_in.load(std::memory_order_relaxed);
+			stats.m_frames_out = m_next_out.load(std::memory_order_relaxed);
+			for (const auto& s : m_stages)
+			{
+				const auto& counters = s->m_counters;
+				stage_stats st;
+				st.m_name = s->m_name;
+				st.m_workers = s->m_functions.size();
+				st.m_frames = counters.m_frames.load(std::memory_order_relaxed);
+				st.m_errors = counters.m_errors.load(std::memory_order_relaxed);
+				st.m_busy_ms = static_cast<double>(counters.m_busy_ns.load(std::memory_order_relaxed)) * 1e-6;
+				st.m_wait_input_ms = static_cast<double>(counters.m_wait_input_ns.load(std::memory_order_relaxed)) * 1e-6;
+				st.m_wait_output_ms = static_cast<double>(counters.m_wait_output_ns.load(std::memory_order_relaxed)) * 1e-6;
+				st.m_queue_size = s->m_input->size();
+				st.m_queue_capacity = s->m_input->capacity();
+				st.m_queue_peak = counters.m_fill_peak.load(std::memory_order_relaxed);
+				if (st.m_frames > 0)
+					st.m_queue_fill = static_cast<double>(counters.m_fill_sum.load(std::memory_order_relaxed)) / static_cast<double>(st.m_frames * st.m_queue_capacity);
+				if (stats.m_elapsed_ms > 0.0)
+				{
+					st.m_throughput = 1000.0 * static_cast<double>(st.m_frames) / stats.m_elapsed_ms;
+					st.m_utilization = st.m_busy_ms / (stats.m_elapsed_ms * static_cast<double>(st.m_workers));
+				}
+				stats.m_stages.push_back(std::move(st));
+			}
+			return stats;
+		}
+	};
+}
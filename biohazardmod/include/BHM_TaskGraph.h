@@ -0,0 +1,266 @@
+#pragma once
+
+#include "BHM_ThreadPool.h"
+
+#include <tuple>
+#include <functional>
+
+namespace bhd
+{
+	/// <summary>
+	/// Result of when_any: index of the first finished task, and all the input tasks given back.
+	/// </summary>
+	template<class T>
+	struct when_any_result
+	{
+		std::size_t m_index = 0;
+		std::vector<threaded_task<T>> m_tasks;
+	};
+
+	/// <summary>
+	/// Task done when all the input tasks are done. No thread blocks while waiting: the task completes
+	/// on the thread finishing the last input. The inputs are given back with their results (or exceptions) available.
+	/// The input tasks have to be enqueued (or run) by someone, else the returned task never completes.
+	/// Ex:
+	/// auto all = when_all(std::move(tiles));
+	/// for (auto& tile : all.get()) tile.get();
+	/// </summary>
+	/// <param name="tasks">Input tasks (consumed)</param>
+	/// <returns>Task giving back the input tasks</returns>
+	template<class T>
+	threaded_task<std::vector<threaded_task<T>>> when_all(std::vector<threaded_task<T>> tasks)
+	{
+		using result_t = std::vector<threaded_task<T>>;
+
+		std::vector<details::task_state_base*> inputs;
+		inputs.reserve(tasks.size());
+		for (const auto& task : tasks) {
+			assert(task.valid() && "No task set");
+			inputs.push_back(task.state().get());
+		}
+
+		auto state = details::make_task_state<result_t>([tasks = std::move(tasks)]() mutable -> result_t { return std::move(tasks); });
+		state->set_dependencies(static_cast<int>(inputs.size()));
+		for (auto* input : inputs)
+			details::task_edge::attach(*input, state, nullptr);
+		if (inputs.empty())
+			state->try_run();
+		return threaded_task<result_t>(std::move(state));
+	}
+
+	/// <summary>
+	/// Task done when all the input tasks (of any types) are done. See when_all(std::vector).
+	/// Ex:
+	/// auto [img, mask] = when_all(std::move(load_img), std::move(load_mask)).get();
+	/// </summary>
+	/// <param name="tasks">Input tasks (consumed)</param>
+	/// <returns>Task giving back the input tasks as a tuple</returns>
+	template<class... Ts>
+	threaded_task<std::tuple<threaded_task<Ts>...>> when_all(threaded_task<Ts>&&... tasks)
+	{
+		using result_t = std::tuple<threaded_task<Ts>...>;
+
+		assert((tasks.valid() && ...) && "No task set");
+		details::task_state_base* inputs[] = { tasks.state().get()..., nullptr };
+
+		auto state = details::make_task_state<result_t>([tuple = result_t(std::move(tasks)...)]() mutable -> result_t { return std::move(tuple); });
+		state->set_dependencies(static_cast<int>(sizeof...(Ts)));
+		for (std::size_t i = 0; i < sizeof...(Ts); i++)
+			details::task_edge::attach(*inputs[i], state, nullptr);
+		if constexpr (sizeof...(Ts) == 0)
+			state->try_run();
+		return threaded_task<result_t>(std::move(state));
+	}
+
+	/// <summary>
+	/// Task done when the first of the input tasks is done. The others keep running, and are given back in the result.
+	/// </summary>
+	/// <param name="tasks">Input tasks (consumed), at least one</param>
+	/// <returns>Task giving the index of the first finished task and the input tasks</returns>
+	template<class T>
+	threaded_task<when_any_result<T>> when_any(std::vector<threaded_task<T>> tasks)
+	{
+		using result_t = when_any_result<T>;
+
+		if (tasks.empty())
+			throw std::invalid_argument("when_any needs at least one task");
+
+		std::vector<details::task_state_base*> inputs;
+		inputs.reserve(tasks.size());
+		for (const auto& task : tasks) {
+			assert(task.valid() && "No task set");
+			inputs.push_back(task.state().get());
+		}
+
+		//Single dependency: the first finished input releases it, the next ones only decrement the counter
+		auto state = details::make_task_state<result_t>([tasks = std::move(tasks)]() mutable -> result_t
+		{
+			result_t result;
+			while (result.m_index < tasks.size() && !tasks[result.m_index].is_ready())
+				result.m_index++;
+			result.m_tasks = std::move(tasks);
+			return result;
+		});
+		state->set_dependencies(1);
+		for (auto* input : inputs)
+			details::task_edge::attach(*input, state, nullptr);
+		return threaded_task<result_t>(std::move(state));
+	}
+
+	/// <summary>
+	/// Static graph of tasks (DAG). Each node runs once all its predecessors are done.
+	/// A graph can be run several times, each run builds fresh tasks: no thread waits on a dependency.
+	/// If a node throws, the nodes not started yet are skipped and the run task rethrows the first exception.
+	/// Ex:
+	/// bhd::task_graph graph;
+	/// auto load = graph.emplace([&] { img = cv::imread(path); });
+	/// auto blur = graph.emplace([&] { cv::GaussianBlur(img, blurred, { 5, 5 }, 0); });
+	/// auto edges = graph.emplace([&] { cv::Canny(img, contours, 50, 150); });
+	/// graph.precede(load, blur);
+	/// graph.precede(load, edges);
+	/// graph.run(pool).get();
+	/// </summary>
+	class task_graph
+	{
+		std::vector<std::function<void()>> m_nodes;
+		std::vector<std::vector<std::size_t>> m_successors;
+
+		struct run_context
+		{
+			std::atomic_bool m_failed = false;
+			std::exception_ptr m_exception;
+		};
+
+		//! Number of predecessors of each node. Throw std::logic_error if the graph has a cycle
+		std::vector<int> in_degrees() const
+		{
+			std::vector<int> degrees(m_nodes.size(), 0);
+			for (const auto& successors : m_successors)
+				for (std::size_t next : successors)
+					degrees[next]++;
+
+			//Kahn's algorithm, only to detect cycles
+			std::vector<int> remaining = degrees;
+			std::vector<std::size_t> ready;
+			for (std::size_t i = 0; i < remaining.size(); i++)
+				if (remaining[i] == 0)
+					ready.push_back(i);
+			std::size_t nvisited = 0;
+			while (!ready.empty())
+			{
+				std::size_t node = ready.back();
+				ready.pop_back();
+				nvisited++;
+				for (std::size_t next : m_successors[node])
+					if (--remaining[next] == 0)
+						ready.push_back(next);
+			}
+			if (nvisited != m_nodes.size())
+				throw std::logic_error("task_graph has a cycle");
+			return degrees;
+		}
+
+	public:
+
+		/// <summary>
+		/// Add a node.
+		/// </summary>
+		/// <param name="f">Node function, called as f()</param>
+		/// <returns>Node index</returns>
+		template<class F>
+		std::size_t emplace(F&& f)
+		{
+			m_nodes.emplace_back(std::forward<F>(f));
+			m_successors.emplace_back();
+			return m_nodes.size() - 1;
+		}
+
+		/// <summary>
+		/// Add a dependency: 'after' runs once 'before' is done.
+		/// </summary>
+		void precede(std::size_t before, std::size_t after)
+		{
+			if (before >= m_nodes.size() || after >= m_nodes.size())
+				throw std::out_of_range("task_graph node index out of range");
+			m_successors[before].push_back(after);
+		}
+
+		//! Number of nodes
+		std::size_t size() const noexcept { return m_nodes.size(); }
+
+		void clear()
+		{
+			m_nodes.clear();
+			m_successors.clear();
+		}
+
+		/// <summary>
+		/// Submit the graph to a thread pool. The root nodes are enqueued immediately, the other ones as their inputs complete.
+		/// The node functions are copied: the graph can be modified or destroyed while running.
+		/// </summary>
+		/// <param name="pool">Thread pool</param>
+		/// <returns>Task done when all the nodes are done (or skipped after an exception)</returns>
+		threaded_task<void> run(thread_pool& pool) const
+		{
+			using state_ptr_t = details::task_state_ptr<details::task_result_state<void>>;
+
+			const std::vector<int> degrees = in_degrees();
+			auto context = std::make_shared<run_context>();
+
+			std::vector<state_ptr_t> states;
+			states.reserve(m_nodes.size());
+			for (const auto& node : m_nodes)
+			{
+				states.push_back(details::make_task_state<void>([context, node]()
+				{
+					if (context->m_failed.load(std::memory_order_acquire))
+						return;
+					try {
+						node();
+					}
+					catch (...) {
+						if (!context->m_failed.exchange(true))
+							context->m_exception = std::current_exception();
+					}
+				}));
+			}
+
+			//Last task, waiting for the leaves (and thus for every node)
+			int nleaves = 0;
+			for (const auto& successors : m_successors)
+				nleaves += successors.empty() ? 1 : 0;
+			state_ptr_t sink = details::make_task_state<void>([context]()
+			{
+				if (context->m_exception)
+					std::rethrow_exception(context->m_exception);
+			});
+
+			//All the counters are set before the first edge can fire
+			sink->set_dependencies(nleaves);
+			for (std::size_t i = 0; i < states.size(); i++)
+				states[i]->set_dependencies(degrees[i]);
+
+			for (std::size_t i = 0; i < states.size(); i++)
+			{
+				for (std::size_t next : m_successors[i])
+					details::task_edge::attach(*states[i], states[next], &pool);
+				if (m_successors[i].empty())
+					details::task_edge::attach(*states[i], sink, nullptr);
+			}
+
+			if (nleaves == 0)
+				sink->try_run();
+			for (std::size_t i = 0; i < states.size(); i++)
+				if (degrees[i] == 0)
+					pool.submit(states[i]);
+
+			return threaded_task<void>(std::move(sink));
+		}
+
+		//! Submit the graph to the default thread pool
+		threaded_task<void> run() const {
+			return run(thread_pool::instance());
+		}
+	};
+
+}
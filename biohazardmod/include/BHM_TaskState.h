@@ -0,0 +1,584 @@
+#pragma once
+
+#include "BHM_ScratchArena.h"
+
+#include <new>
+#include <cstdint>
+#include <mutex>
+#include <atomic>
+#include <utility>
+#include <memory>
+#include <chrono>
+#include <optional>
+#include <exception>
+#include <stdexcept>
+#include <functional>
+#include <type_traits>
+#include <cassert>
+
+namespace bhd
+{
+	namespace details { class task_state_base; }
+
+	/// <summary>
+	/// Exception stored in a task dropped before it started (cancelled or past its deadline),
+	/// or thrown by a task polling its cancellation token.
+	/// </summary>
+	class task_cancelled : public std::runtime_error
+	{
+	public:
+		using std::runtime_error::runtime_error;
+	};
+
+	/// <summary>
+	/// Cooperative cancellation flag shared by all its copies.
+	/// A queued task holding a cancelled token is dropped (its get() throws task_cancelled).
+	/// A running task has to poll the token itself.
+	/// Ex:
+	/// m_token.cancel();					//Stale preview
+	/// m_token = bhd::cancellation_token();	//Token of the next preview
+	/// </summary>
+	class cancellation_token
+	{
+		friend class details::task_state_base;
+		std::shared_ptr<std::atomic_bool> m_cancelled = std::make_shared<std::atomic_bool>(false);
+
+	public:
+
+		void cancel() noexcept {
+			m_cancelled->store(true, std::memory_order_release);
+		}
+
+		bool is_cancelled() const noexcept {
+			return m_cancelled->load(std::memory_order_acquire);
+		}
+
+		//! Throw task_cancelled if cancelled (polling point inside a task)
+		void throw_if_cancelled() const
+		{
+			if (is_cancelled())
+				throw task_cancelled("task cancelled");
+		}
+	};
+}
+
+namespace bhd::details
+{
+	/// <summary>
+	/// Recycler of fixed-size memory blocks.
+	/// Each thread keeps a small cache of free blocks (no lock). When the cache is empty or full,
+	/// a batch of blocks is exchanged with a central list under a single lock.
+	/// Blocks freed by a worker thus flow back to the producer thread that allocates them.
+	/// </summary>
+	template<std::size_t BlockSize>
+	class block_pool
+	{
+		static_assert(BlockSize >= sizeof(void*));
+
+		struct node { node* m_next; };
+
+		static constexpr std::size_t BATCH_SIZE = 32;
+		static constexpr std::size_t MAX_LOCAL = 2 * BATCH_SIZE;
+
+		struct central_list
+		{
+			std::mutex m_mutex;
+			node* m_head = nullptr;
+		};
+
+		//Never destroyed: worker threads of static pools may still release blocks during the static destruction
+		static central_list& central() {
+			static central_list* list = new central_list;
+			return *list;
+		}
+
+		struct local_cache
+		{
+			node* m_head = nullptr;
+			std::size_t m_count = 0;
+
+			~local_cache() {
+				if (m_head != nullptr)
+					give_back(m_count);
+			}
+
+			//Move n blocks of the local cache into the central list
+			void give_back(std::size_t n)
+			{
+				node* first = m_head;
+				node* last = m_head;
+				for (std::size_t i = 1; i < n; i++)
+					last = last->m_next;
+				m_head = last->m_next;
+				m_count -= n;
+
+				auto& list = central();
+				const std::lock_guard<std::mutex> lock(list.m_mutex);
+				last->m_next = list.m_head;
+				list.m_head = first;
+			}
+
+			//Move up to BATCH_SIZE blocks of the central list into the local cache
+			void take_back()
+			{
+				auto& list = central();
+				const std::lock_guard<std::mutex> lock(list.m_mutex);
+				for (std::size_t i = 0; i < BATCH_SIZE && list.m_head != nullptr; i++)
+				{
+					node* n = list.m_head;
+					list.m_head = n->m_next;
+					n->m_next = m_head;
+					m_head = n;
+					m_count++;
+				}
+			}
+		};
+
+		static local_cache& local() {
+			static thread_local local_cache cache;
+			return cache;
+		}
+
+	public:
+
+		static void* allocate()
+		{
+			auto& cache = local();
+			if (cache.m_head == nullptr)
+				cache.take_back();
+			if (cache.m_head == nullptr)
+				return ::operator new(BlockSize);
+
+			node* n = cache.m_head;
+			cache.m_head = n->m_next;
+			cache.m_count--;
+			return n;
+		}
+
+		static void deallocate(void* p) noexcept
+		{
+			auto& cache = local();
+			node* n = static_cast<node*>(p);
+			n->m_next = cache.m_head;
+			cache.m_head = n;
+			if (++cache.m_count > MAX_LOCAL)
+				cache.give_back(BATCH_SIZE);
+		}
+	};
+
+	//! Size class (multiple of a cache line) used to recycle the task states
+	constexpr std::size_t block_size_class(std::size_t size) {
+		return (size + 63) & ~std::size_t(63);
+	}
+
+	/// <summary>
+	/// Callback registered on a task state, invoked once the task is done (intrusive list node).
+	/// invoke is called exactly once and has to release the node itself.
+	/// </summary>
+	class task_continuation
+	{
+	public:
+		task_continuation* m_next = nullptr;
+
+		virtual void invoke() noexcept = 0;
+
+		//! Release the node without invoking it (the task will never run)
+		virtual void discard() noexcept = 0;
+
+	protected:
+		~task_continuation() = default;
+	};
+
+	/// <summary>
+	/// Type erased part of a task: intrusive reference counter, execution status, input dependencies and continuations.
+	/// A task runs at most once: the first caller of try_run (worker or waiting thread) executes it,
+	/// and never before all its input dependencies are released.
+	/// </summary>
+	class task_state_base
+	{
+	public:
+		enum status_t : int
+		{
+			PENDING,	//Not yet started
+			RUNNING,	//Running by a thread
+			DONE		//Result or exception available
+		};
+
+	protected:
+		std::atomic<int> m_status = PENDING;
+		std::atomic<int> m_refs = 1;
+		std::atomic<int> m_dependencies = 0;
+		std::atomic<bool> m_scheduled = false;		//Queued, waited by its inputs or started: something will run it
+		std::atomic<task_continuation*> m_continuations = nullptr;
+		std::exception_ptr m_exception;
+
+		//Optional limits checked before the task starts
+		std::shared_ptr<const std::atomic_bool> m_cancelled;
+		std::chrono::steady_clock::time_point m_deadline = std::chrono::steady_clock::time_point::max();
+
+		//Marker of a closed continuation list (the task is done)
+		static task_continuation* closed_list() noexcept {
+			return reinterpret_cast<task_continuation*>(std::uintptr_t(1));
+		}
+
+		virtual ~task_state_base()
+		{
+			//Continuations of a task that never ran are dropped
+			auto* node = m_continuations.load(std::memory_order_acquire);
+			while (node != nullptr && node != closed_list()) {
+				auto* next = node->m_next;
+				node->discard();
+				node = next;
+			}
+		}
+
+		void run_continuations() noexcept
+		{
+			auto* node = m_continuations.exchange(closed_list(), std::memory_order_acq_rel);
+			while (node != nullptr) {
+				auto* next = node->m_next;
+				node->invoke();
+				node = next;
+			}
+		}
+
+		//! Publish the result and run the continuations
+		void finish() noexcept
+		{
+			release_function();
+			m_status.store(DONE, std::memory_order_release);
+			m_status.notify_all();
+			run_continuations();
+		}
+
+		//! Return true if the task has to be dropped instead of executed
+		bool expired() const noexcept
+		{
+			if (m_cancelled && m_cancelled->load(std::memory_order_acquire))
+				return true;
+			return m_deadline != std::chrono::steady_clock::time_point::max() && std::chrono::steady_clock::now() > m_deadline;
+		}
+
+		//! Execute the task and store its result (or exception)
+		virtual void invoke() noexcept = 0;
+
+		//! Destroy the callable and its captures (run or dropped task: they are no longer needed)
+		virtual void release_function() noexcept = 0;
+
+		//! Destroy the object and recycle its memory
+		virtual void destroy() noexcept = 0;
+
+	public:
+
+		task_state_base() = default;
+		task_state_base(const task_state_base&) = delete;
+		task_state_base& operator=(const task_state_base&) = delete;
+
+		/// <summary>
+		/// Run the task if nobody has started it yet.
+		/// </summary>
+		/// <returns>true if the task was executed by this call</returns>
+		bool try_run() noexcept
+		{
+			if (m_dependencies.load(std::memory_order_acquire) > 0)
+				return false;
+			int expected = PENDING;
+			if (!m_status.compare_exchange_strong(expected, RUNNING, std::memory_order_acquire))
+				return false;
+			m_scheduled.store(true, std::memory_order_relaxed);
+			if (expired())
+				m_exception = std::make_exception_ptr(task_cancelled("task dropped before it started (cancelled or deadline passed)"));
+			else
+			{
+				//The scratch temporaries of the task are released with it, whatever the thread running it
+				const scratch_scope scratch;
+				invoke();
+			}
+			finish();
+			return true;
+		}
+
+		/// <summary>
+		/// Complete the task with a task_cancelled exception if nobody has started it yet.
+		/// </summary>
+		/// <returns>true if the task was dropped by this call</returns>
+		bool try_drop(const char* reason) noexcept
+		{
+			int expected = PENDING;
+			if (!m_status.compare_exchange_strong(expected, RUNNING, std::memory_order_acquire))
+				return false;
+			m_exception = std::make_exception_ptr(task_cancelled(reason));
+			finish();
+			return true;
+		}
+
+		/// <summary>
+		/// Attach a cancellation token and/or a deadline. Has to be called before the task is queued.
+		/// </summary>
+		void set_limits(const std::optional<cancellation_token>& token, std::chrono::steady_clock::time_point deadline) noexcept
+		{
+			if (token)
+				m_cancelled = token->m_cancelled;
+			m_deadline = deadline;
+		}
+
+		//! Set the number of inputs to wait for before the task can run. Has to be called before any continuation is attached on the inputs
+		void set_dependencies(int count) noexcept {
+			m_dependencies.store(count, std::memory_order_release);
+			if (count > 0)
+				m_scheduled.store(true, std::memory_order_release);
+		}
+
+		//! Flag the task as scheduled. Return true if it was not yet (never queued, waited or started)
+		bool mark_scheduled() noexcept {
+			return !m_scheduled.exchange(true, std::memory_order_acq_rel);
+		}
+
+		//! Release one input dependency. Return true for the release that makes the task runnable
+		bool release_dependency() noexcept {
+			return m_dependencies.fetch_sub(1, std::memory_order_acq_rel) == 1;
+		}
+
+		/// <summary>
+		/// Register a continuation. It is invoked immediately if the task is already done.
+		/// </summary>
+		void add_continuation(task_continuation* node) noexcept
+		{
+			auto* head = m_continuations.load(std::memory_order_acquire);
+			do
+			{
+				if (head == closed_list()) {
+					node->invoke();
+					return;
+				}
+				node->m_next = head;
+			} while (!m_continuations.compare_exchange_weak(head, node, std::memory_order_release, std::memory_order_acquire));
+		}
+
+		//! Return true if the result (or the exception) is available
+		bool is_done() const noexcept {
+			return m_status.load(std::memory_order_acquire) == DONE;
+		}
+
+		//! Block until the task is done
+		void wait() const noexcept
+		{
+			for (int status = m_status.load(std::memory_order_acquire); status != DONE; status = m_status.load(std::memory_order_acquire))
+				m_status.wait(status, std::memory_order_acquire);
+		}
+
+		void add_ref() noexcept {
+			m_refs.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		void release() noexcept {
+			if (m_refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+				destroy();
+		}
+	};
+
+	/// <summary>
+	/// Task state typed on the result.
+	/// </summary>
+	template<class T>
+	class task_result_state : public task_state_base
+	{
+	protected:
+		//References are stored as std::reference_wrapper
+		using storage_t = std::conditional_t<std::is_reference_v<T>, std::reference_wrapper<std::remove_reference_t<T>>, T>;
+		using value_t = std::conditional_t<std::is_void_v<T>, bool, storage_t>;
+
+		std::optional<value_t> m_result;
+		bool m_taken = false;		//The result was moved out by get()
+
+	public:
+
+		/// <summary>
+		/// Get the result or rethrow the task exception. The task has to be done.
+		/// The result is moved out of the state: it can be taken once (as std::future::get). The exception can be rethrown again.
+		/// </summary>
+		T get()
+		{
+			assert(is_done());
+			if (m_exception)
+				std::rethrow_exception(m_exception);
+			if constexpr (std::is_void_v<T>)
+				return;
+			else if constexpr (std::is_reference_v<T>)
+				return m_result->get();
+			else
+			{
+				assert(!m_taken && "task result already taken by a previous get() or co_await");
+				m_taken = true;
+				return std::move(*m_result);
+			}
+		}
+	};
+
+	/// <summary>
+	/// Concrete task state. The callable is stored inline and the whole object lives in a recycled memory block.
+	/// </summary>
+	template<class T, class F>
+	class task_state final : public task_result_state<T>
+	{
+		using pool_t = block_pool<block_size_class(sizeof(task_result_state<T>) + sizeof(std::optional<F>))>;
+
+		std::optional<F> m_fct;
+
+		template<class TF>
+		explicit task_state(TF&& f) : m_fct(std::in_place, std::forward<TF>(f)) {}
+
+		void invoke() noexcept override
+		{
+			try
+			{
+				if constexpr (std::is_void_v<T>) {
+					std::invoke(*m_fct);
+					this->m_result.emplace(true);
+				}
+				else
+					this->m_result.emplace(std::invoke(*m_fct));
+			}
+			catch (...) {
+				this->m_exception = std::current_exception();
+			}
+		}
+
+		void release_function() noexcept override {
+			m_fct.reset();
+		}
+
+		void destroy() noexcept override
+		{
+			this->~task_state();
+			pool_t::deallocate(this);
+		}
+
+	public:
+
+		template<class TF>
+		static task_state* make(TF&& f)
+		{
+			static_assert(sizeof(task_state) <= block_size_class(sizeof(task_result_state<T>) + sizeof(std::optional<F>)));
+			static_assert(alignof(task_state) <= __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+
+			void* memory = pool_t::allocate();
+			try {
+				return ::new (memory) task_state(std::forward<TF>(f));
+			}
+			catch (...) {
+				pool_t::deallocate(memory);
+				throw;
+			}
+		}
+	};
+
+	/// <summary>
+	/// Intrusive pointer on a task state (a copy is a reference count increment, never an allocation).
+	/// </summary>
+	template<class TState>
+	class task_state_ptr
+	{
+		template<class> friend class task_state_ptr;
+		TState* m_ptr = nullptr;
+
+	public:
+
+		task_state_ptr() = default;
+
+		//! Adopt a new state (reference already counted)
+		explicit task_state_ptr(TState* ptr) noexcept : m_ptr(ptr) {}
+
+		task_state_ptr(const task_state_ptr& other) noexcept : m_ptr(other.m_ptr) {
+			if (m_ptr) m_ptr->add_ref();
+		}
+
+		task_state_ptr(task_state_ptr&& other) noexcept : m_ptr(std::exchange(other.m_ptr, nullptr)) {}
+
+		template<class TOther, class = std::enable_if_t<std::is_convertible_v<TOther*, TState*>>>
+		task_state_ptr(const task_state_ptr<TOther>& other) noexcept : m_ptr(other.m_ptr) {
+			if (m_ptr) m_ptr->add_ref();
+		}
+
+		template<class TOther, class = std::enable_if_t<std::is_convertible_v<TOther*, TState*>>>
+		task_state_ptr(task_state_ptr<TOther>&& other) noexcept : m_ptr(std::exchange(other.m_ptr, nullptr)) {}
+
+		task_state_ptr& operator=(task_state_ptr other) noexcept {
+			std::swap(m_ptr, other.m_ptr);
+			return *this;
+		}
+
+		~task_state_ptr() {
+			if (m_ptr) m_ptr->release();
+		}
+
+		TState* get() const noexcept { return m_ptr; }
+		TState* operator->() const noexcept { return m_ptr; }
+		TState& operator*() const noexcept { return *m_ptr; }
+		explicit operator bool() const noexcept { return m_ptr != nullptr; }
+	};
+
+	/// <summary>
+	/// Move-only unit of work stored in the pool queues (the state pointer and the enqueue time).
+	/// Calling it runs the task unless it has already been started elsewhere (by threaded_task::get for example).
+	/// </summary>
+	class pool_task
+	{
+		task_state_ptr<task_state_base> m_state;
+
+	public:
+		std::chrono::steady_clock::time_point m_queued_at = {};	//Only set by an instrumented pool (see POOL_STATS)
+		bool m_admitted = false;	//Admitted under the capacity of a bounded pool: the only tasks its DROP_OLDEST policy drops
+
+		pool_task() = default;
+		pool_task(pool_task&&) noexcept = default;
+		pool_task& operator=(pool_task&&) noexcept = default;
+		pool_task(const pool_task&) = delete;
+		pool_task& operator=(const pool_task&) = delete;
+
+		explicit pool_task(task_state_ptr<task_state_base> state) noexcept : m_state(std::move(state)) {}
+
+		//! Flag the task as scheduled (see task_state_base::mark_scheduled), once admitted in a queue
+		void mark_scheduled() noexcept {
+			m_state->mark_scheduled();
+		}
+
+		//! Run the task, return false if it had already been started elsewhere
+		bool operator()() {
+			assert(m_state);
+			return m_state->try_run();
+		}
+
+		//! Complete the task with a task_cancelled exception instead of running it (unless already started)
+		void drop(const char* reason) noexcept {
+			assert(m_state);
+			m_state->try_drop(reason);
+		}
+
+		explicit operator bool() const noexcept { return static_cast<bool>(m_state); }
+	};
+
+	/// <summary>
+	/// Bind a callable with its arguments (copied/moved as std::bind would do) without any std::function wrapper.
+	/// </summary>
+	template<class F, class... Args>
+	auto bind_task(F&& f, Args&&... args)
+	{
+		if constexpr (sizeof...(Args) == 0)
+			return std::decay_t<F>(std::forward<F>(f));
+		else
+			return[f = std::forward<F>(f), ...args = std::forward<Args>(args)]() mutable -> decltype(auto) {
+				return std::invoke(f, args...);
+			};
+	}
+
+	/// <summary>
+	/// Create a new task state for the callable. The memory comes from the task block pool.
+	/// </summary>
+	template<class T, class F>
+	task_state_ptr<task_result_state<T>> make_task_state(F&& f)
+	{
+		using state_t = task_state<T, std::decay_t<F>>;
+		return task_state_ptr<task_result_state<T>>(state_t::make(std::forward<F>(f)));
+	}
+}
@@ -1,17 +1,38 @@
 #pragma once
 
+#include "BHM_TaskState.h"
+#include "BHM_PoolStats.h"
+
+#include <array>
+#include <iterator>
 #include <vector>
+#include <deque>
 #include <queue>
+#include <chrono>
+#include <coroutine>
+#include <memory>
+#include <atomic>
+#include <thread>
 #include <mutex>
 #include <condition_variable>
-#include <future>
-#include <functional>
+#include <optional>
+#include <algorithm>
+#include <string>
+#include <stdexcept>
 #include <type_traits>
 
 namespace bhd
 {
+	class thread_pool;
+
 	namespace details
 	{
+		/// <summary>
+		/// Block until the task is done. On a worker thread, the other pending tasks of its pool
+		/// are run meanwhile: nested enqueue / get never starves the pool.
+		/// </summary>
+		void wait_task(const task_state_base& state);
+
 		//Result trick when result is 'void' type
 		template<class T>
 		struct threaded_task_result {
@@ -26,16 +47,304 @@ namespace bhd
 			using TRef = void;
 			using TCRef = void;
 		};
+
+		/// <summary>
+		/// Double-ended task queue owned by a worker.
+		/// The owner pushes and pops at the back (LIFO, hot cache), thieves steal at the front (FIFO, oldest/biggest work).
+		/// Each queue has its own lock, so workers only contend when they steal from the same victim.
+		/// </summary>
+		class work_stealing_queue
+		{
+		public:
+			using task_t = pool_task;
+
+		private:
+			std::deque<task_t> m_tasks;
+			mutable std::mutex m_mutex;
+
+		public:
+
+			void push(task_t&& task)
+			{
+				const std::lock_guard<std::mutex> lock(m_mutex);
+				m_tasks.emplace_back(std::move(task));
+			}
+
+			//! Push a whole batch under a single lock
+			template<class It>
+			void push_bulk(It begin, It end)
+			{
+				const std::lock_guard<std::mutex> lock(m_mutex);
+				m_tasks.insert(m_tasks.end(), std::make_move_iterator(begin), std::make_move_iterator(end));
+			}
+
+			bool pop(task_t& task)
+			{
+				const std::lock_guard<std::mutex> lock(m_mutex);
+				if (m_tasks.empty())
+					return false;
+				task = std::move(m_tasks.back());
+				m_tasks.pop_back();
+				return true;
+			}
+
+			bool steal(task_t& task)
+			{
+				const std::lock_guard<std::mutex> lock(m_mutex);
+				if (m_tasks.empty())
+					return false;
+				task = std::move(m_tasks.front());
+				m_tasks.pop_front();
+				return true;
+			}
+
+			//! Steal the oldest task matching a predicate
+			template<class Pred>
+			bool steal_if(task_t& task, Pred&& pred)
+			{
+				const std::lock_guard<std::mutex> lock(m_mutex);
+				auto it = std::find_if(m_tasks.begin(), m_tasks.end(), pred);
+				if (it == m_tasks.end())
+					return false;
+				task = std::move(*it);
+				m_tasks.erase(it);
+				return true;
+			}
+
+			std::size_t size() const
+			{
+				const std::lock_guard<std::mutex> lock(m_mutex);
+				return m_tasks.size();
+			}
+		};
+	}
+
+	/// <summary>
+	/// Priority level of a queued task. Workers always take the pending tasks of the highest level first.
+	/// </summary>
+	enum class TASK_PRIORITY
+	{
+		HIGH = 0,	//Interactive work (GUI live preview...)
+		NORMAL,
+		LOW,		//Background / batch work
+		N_COUNT
+	};
+
+	/// <summary>
+	/// Scheduling options of a queued task.
+	/// Ex:
+	/// bhd::task_options options;
+	/// options.m_priority = bhd::TASK_PRIORITY::HIGH;
+	/// options.m_token = m_token;
+	/// options.m_deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(100);
+	/// auto preview = pool.enqueue(options, render, params);
+	/// </summary>
+	struct task_options
+	{
+		TASK_PRIORITY m_priority = TASK_PRIORITY::NORMAL;
+		std::optional<cancellation_token> m_token;		//Queued task dropped once cancelled
+		std::chrono::steady_clock::time_point m_deadline = std::chrono::steady_clock::time_point::max();	//Queued task dropped once passed
+		int m_worker = -1;		//Locality hint: queue the task on this worker (modulo the pool size), -1 for none. Other workers may still steal it
+		bool m_unbounded = false;	//Not subject to the capacity of a bounded pool (fork/join helpers): never refused, blocked nor dropping other tasks
+	};
+
+	/// <summary>
+	/// Behavior of a bounded thread_pool when its queues are full
+	/// </summary>
+	enum class OVERFLOW_POLICY
+	{
+		BLOCK = 0,		//The producer waits for a free slot (a worker of the pool runs queued tasks instead of waiting)
+		DROP_OLDEST,	//The oldest queued task (lowest priority first) is dropped: its get() throws task_cancelled. Unbounded tasks are never dropped
+		REJECT,			//enqueue throws queue_full
+		N_COUNT
+	};
+
+	/// <summary>
+	/// Exception thrown by enqueue on a full bounded pool with the REJECT policy
+	/// </summary>
+	class queue_full : public std::runtime_error
+	{
+	public:
+		using std::runtime_error::runtime_error;
+	};
+
+	namespace details
+	{
+		/// <summary>
+		/// Job of the timer thread of a thread_pool (see thread_pool::schedule_after / schedule_every)
+		/// </summary>
+		class timer_job : public std::enable_shared_from_this<timer_job>
+		{
+		public:
+			std::atomic_bool m_cancelled = false;
+
+			virtual ~timer_job() = default;
+
+			//! Called by the timer thread at the due time. Return true to be called again at the updated 'due'
+			virtual bool fire(thread_pool& pool, std::chrono::steady_clock::time_point& due) = 0;
+
+			//! Called instead of fire if the pool is destroyed before the due time
+			virtual void discard() noexcept {}
+		};
+
+		//! Entry of the timer heap
+		struct timer_entry
+		{
+			std::chrono::steady_clock::time_point m_due;
+			std::uint64_t m_seq = 0;	//Insertion order of the jobs due at the same time
+			std::shared_ptr<timer_job> m_job;
+
+			//! Reversed order: std::priority_queue gives the earliest entry first
+			bool operator<(const timer_entry& other) const noexcept {
+				return m_due > other.m_due || (m_due == other.m_due && m_seq > other.m_seq);
+			}
+		};
+
+		//! One-shot job: submits its task state (created with one dependency) at the due time
+		class delayed_job final : public timer_job
+		{
+			task_state_ptr<task_state_base> m_state;
+			TASK_PRIORITY m_priority;
+
+		public:
+			delayed_job(task_state_ptr<task_state_base> state, TASK_PRIORITY priority) noexcept :
+				m_state(std::move(state)), m_priority(priority) {}
+
+			bool fire(thread_pool& pool, std::chrono::steady_clock::time_point& due) override;
+			void discard() noexcept override;
+		};
+
+		/// <summary>
+		/// Periodic job: submits one tick per period to the pool. The ticks stay on the initial time grid (no drift),
+		/// a tick is skipped (counted as missed) when the previous one is still running or when the timer is late.
+		/// </summary>
+		class periodic_job_base : public timer_job
+		{
+		public:
+			std::chrono::steady_clock::duration m_period;
+			TASK_PRIORITY m_priority;
+			std::atomic_bool m_running = false;		//A tick is queued or running
+			std::atomic<std::uint64_t> m_ticks = 0;
+			std::atomic<std::uint64_t> m_missed = 0;
+
+			mutable std::mutex m_error_mutex;
+			std::exception_ptr m_error;		//Exception thrown by a tick (it cancels the timer)
+
+			periodic_job_base(std::chrono::steady_clock::duration period, TASK_PRIORITY priority) noexcept :
+				m_period(period), m_priority(priority) {}
+
+			bool fire(thread_pool& pool, std::chrono::steady_clock::time_point& due) override;
+
+		protected:
+			virtual void run_tick() = 0;
+
+			struct tick_runner;	//Callable of a tick task, ends the tick even if the task is dropped
+			void tick() noexcept;
+			void end_tick() noexcept;
+		};
+
+		template<class F>
+		class periodic_job final : public periodic_job_base
+		{
+			F m_fct;
+
+			void run_tick() override { m_fct(); }
+
+		public:
+			periodic_job(F fct, std::chrono::steady_clock::duration period, TASK_PRIORITY priority) :
+				periodic_job_base(period, priority), m_fct(std::move(fct)) {}
+		};
 	}
 
+	/// <summary>
+	/// Handle on a periodic job of a thread_pool (see thread_pool::schedule_every).
+	/// Dropping the handle does not stop the job.
+	/// </summary>
+	class timer_handle
+	{
+		std::shared_ptr<details::periodic_job_base> m_job;
+
+	public:
+
+		timer_handle() = default;
+		explicit timer_handle(std::shared_ptr<details::periodic_job_base> job) noexcept : m_job(std::move(job)) {}
+
+		//! Return true if a job is attached
+		bool valid() const noexcept { return static_cast<bool>(m_job); }
+
+		//! Return true until the job is cancelled (by cancel, stop or an exception of a tick)
+		bool active() const noexcept { return m_job && !m_job->m_cancelled.load(); }
+
+		//! No new tick is started. Does not wait for a running tick: can be called from the job itself
+		void cancel() noexcept
+		{
+			if (m_job)
+				m_job->m_cancelled.store(true);
+		}
+
+		//! Cancel the job and wait for the end of its running tick. Not from the job itself
+		void stop() noexcept
+		{
+			if (!m_job)
+				return;
+			m_job->m_cancelled.store(true);
+			while (m_job->m_running.load())
+				m_job->m_running.wait(true);
+		}
+
+		//! Number of completed ticks
+		std::uint64_t ticks() const noexcept { return m_job ? m_job->m_ticks.load() : 0; }
+
+		//! Number of skipped ticks (previous tick still running, or timer late by more than a period)
+		std::uint64_t missed() const noexcept { return m_job ? m_job->m_missed.load() : 0; }
+
+		//! Exception which stopped the job, if any
+		std::exception_ptr error() const
+		{
+			if (!m_job)
+				return nullptr;
+			const std::lock_guard<std::mutex> lock(m_job->m_error_mutex);
+			return m_job->m_error;
+		}
+	};
+
+	/// <summary>
+	/// Construction options of a thread_pool.
+	/// Ex: one worker pinned on each CPU of the first NUMA node
+	/// auto cpus = bhd::cpu_domains(bhd::CPU_DOMAIN::NUMA_NODE)[0];
+	/// bhd::thread_pool_options options;
+	/// options.m_threads = cpus.size();
+	/// options.m_cpus = cpus;
+	/// options.m_one_cpu_per_worker = true;
+	/// options.m_name = "bhd-node0";
+	/// bhd::thread_pool pool(options);
+	/// </summary>
+	struct thread_pool_options
+	{
+		std::size_t m_threads = std::thread::hardware_concurrency();
+		std::vector<int> m_cpus;			//CPUs of the workers (see BHM_CpuTopology.h), empty for no affinity
+		bool m_one_cpu_per_worker = false;	//true: worker i pinned on m_cpus[i % size], false: every worker free on the whole m_cpus set
+		std::string m_name = "bhd-worker";	//Worker thread names: m_name + "-" + index
+		std::size_t m_capacity = 0;			//Maximum number of queued (not started) tasks, 0 for unbounded. The parallel loop helpers and continuations are not bounded
+		OVERFLOW_POLICY m_overflow = OVERFLOW_POLICY::BLOCK;	//Behavior of enqueue on a full bounded pool
+		POOL_STATS m_stats = POOL_STATS::OFF;	//Instrumentation level (see thread_pool::stats and thread_pool::trace)
+		std::size_t m_trace_capacity = 1 << 16;	//Maximum number of task events kept per worker in POOL_STATS::TRACE mode
+	};
+
+	/// <summary>
+	/// Handle on a task executed by the thread_pool.
+	/// The task state (callable, status and result) lives in a recycled memory block and is shared
+	/// by reference counting with the pool queue, so neither set nor enqueue allocate in the steady state.
+	/// </summary>
 	template<class T>
 	class threaded_task : public details::threaded_task_result<T>
 	{
 		friend class thread_pool;
+		template<class> friend class threaded_task;
 		using TRef = details::threaded_task_result<T>::TRef;	//reference on the result T or void
-	
-		std::function<void()> m_fct;
-		std::future<T> m_future;
+		using state_ptr_t = details::task_state_ptr<details::task_result_state<T>>;
+
+		state_ptr_t m_state;
 
 		//private constructor
 		threaded_task(const threaded_task&) = delete;
@@ -45,73 +354,235 @@ namespace bhd
 
 		threaded_task() {};
 
-		template<class F, class... Args>
+		template<class F, class... Args, class = std::enable_if_t<!std::is_same_v<std::decay_t<F>, state_ptr_t> && !std::is_same_v<std::decay_t<F>, threaded_task>>>
 		threaded_task(F&& f, Args&&... args) {
 			set(std::forward<F>(f), std::forward<Args>(args)...);
 		}
 
+		//! Wrap an existing task state (used by the task combinators)
+		explicit threaded_task(state_ptr_t state) noexcept : m_state(std::move(state)) {}
+
+		//! Return the task state (used by the task combinators)
+		const state_ptr_t& state() const noexcept { return m_state; }
+
 		threaded_task(threaded_task&& task) noexcept
 		{
-			m_fct = std::move(task.m_fct);
-			m_future = std::move(task.m_future);
+			m_state = std::move(task.m_state);
 		}
 
 		void operator=(threaded_task&& task) noexcept
 		{
-			m_fct = std::move(task.m_fct);
-			m_future = std::move(task.m_future);
+			m_state = std::move(task.m_state);
 		}
 
 		template<class F, class... Args>
 		void set(F&& f, Args&&... args)
 		{
-			using result_t = std::invoke_result_t<F, Args...>;
-			using packaged_result_t = std::packaged_task<result_t()>;
+			m_state = details::make_task_state<T>(details::bind_task(std::forward<F>(f), std::forward<Args>(args)...));
+		}
+
+		//! Return true if a task is set
+		bool valid() const noexcept { return static_cast<bool>(m_state); }
+
+		//! Return true if the task is done (result or exception available)
+		bool is_ready() const noexcept { return m_state && m_state->is_done(); }
+
+		/// <summary>
+		/// Wait for the result (the calling thread runs the task if it is not started yet). The result is moved out:
+		/// call it once per task, as std::future::get. Rethrows the exception of the task.
+		/// </summary>
+		auto get()
+		{
+			assert(valid() && "No task set");
+			if (!m_state->try_run()) //Start the function in the current thread if the function is not yet called
+				details::wait_task(*m_state);
+			if constexpr (std::is_void_v<T>)
+				m_state->get();
+			else
+				return m_state->get();
+		}
+
+		/// <summary>
+		/// Chain a continuation: f is submitted to the pool once this task is done, without blocking any thread.
+		/// f receives the result of this task (nothing for a void task). If this task throws, f is not called
+		/// and the returned task rethrows the same exception.
+		/// The continuation consumes this task: the handle is no longer valid after the call.
+		/// A task neither queued nor started yet is submitted to the pool, else the continuation would never run.
+		/// Ex:
+		/// auto area = pool.enqueue(load).then([](cv::Mat m) { return m.total(); });
+		/// </summary>
+		/// <param name="pool">Pool running the continuation</param>
+		/// <param name="f">Continuation function</param>
+		/// <returns>Task of the continuation</returns>
+		template<class F>
+		auto then(thread_pool& pool, F&& f);
+
+		//! Chain a continuation running on the default thread pool
+		template<class F>
+		auto then(F&& f);
+	};
+
+	/// <summary>
+	/// Single handle on a batch of tasks queued together (see thread_pool::enqueue_bulk / enqueue_n).
+	/// </summary>
+	template<class T>
+	class task_group
+	{
+		friend class thread_pool;
+		std::vector<threaded_task<T>> m_tasks;
 
-			auto task = packaged_result_t(std::bind(std::forward<F>(f), std::forward<Args>(args)...));
+	public:
 
-			m_future = task.get_future();
+		task_group() = default;
+		task_group(task_group&&) noexcept = default;
+		task_group& operator=(task_group&&) noexcept = default;
 
-			using atomic_task_t = std::pair<std::atomic_bool, packaged_result_t>;
+		//! Number of tasks
+		std::size_t size() const noexcept { return m_tasks.size(); }
 
-			m_fct = [a_task = std::make_shared<atomic_task_t>(false, std::move(task))]() mutable
-			{
-				if (a_task->first.exchange(true) == false)
-					a_task->second();
-			};
+		//! Access to a task of the group (in the submission order)
+		threaded_task<T>& operator[](std::size_t i) { return m_tasks[i]; }
+
+		//! Return true if all the tasks are done
+		bool is_ready() const noexcept {
+			return std::all_of(m_tasks.begin(), m_tasks.end(), [](const threaded_task<T>& task) { return task.is_ready(); });
 		}
 
+		/// <summary>
+		/// Wait for all the tasks (the calling thread runs the ones not started yet) and collect the results
+		/// in the submission order. The first exception is rethrown once every task is done.
+		/// </summary>
 		auto get()
 		{
-			m_fct(); //Start the function in the current thread if the function is not yet called
+			std::exception_ptr exception;
 			if constexpr (std::is_void_v<T>)
-				m_future.get();
+			{
+				for (auto& task : m_tasks) {
+					try { task.get(); }
+					catch (...) { if (!exception) exception = std::current_exception(); }
+				}
+				if (exception)
+					std::rethrow_exception(exception);
+			}
 			else
-				return m_future.get();
+			{
+				std::vector<T> results;
+				results.reserve(m_tasks.size());
+				for (auto& task : m_tasks) {
+					try { results.push_back(task.get()); }
+					catch (...) { if (!exception) exception = std::current_exception(); }
+				}
+				if (exception)
+					std::rethrow_exception(exception);
+				return results;
+			}
+		}
+
+		//! Wait for all the tasks, ignoring their results
+		void wait()
+		{
+			for (auto& task : m_tasks)
+				if (!task.state()->try_run())
+					details::wait_task(*task.state());
 		}
 	};
 
+	/// <summary>
+	/// Work-stealing thread pool.
+	/// Every worker owns a task deque. A task enqueued from a worker goes into its own deque (LIFO),
+	/// a task enqueued from any other thread goes into a shared injection queue.
+	/// An idle worker pops its own deque first, then the injection queue, then steals (FIFO) from the other workers.
+	/// </summary>
 	class thread_pool
 	{
+		using task_t = details::work_stealing_queue::task_t;
+
 		// need to keep track of threads so we can join them
 		std::vector< std::thread > m_workers;
 
-		// the task queue
-		std::queue< std::function<void()> > m_tasks;
+		static constexpr std::size_t N_PRIORITIES = static_cast<std::size_t>(TASK_PRIORITY::N_COUNT);
+		using priority_queues = std::array<details::work_stealing_queue, N_PRIORITIES>;
+
+		// one task deque per worker and a queue for the tasks coming from outside the pool, for each priority level
+		std::vector< std::unique_ptr<priority_queues> > m_queues;
+		priority_queues m_injection;
+		std::array<std::atomic<std::size_t>, N_PRIORITIES> m_pending_levels = {};	//Number of queued tasks per level
 
-		// synchronization
-		std::mutex m_queue_mutex;
+		// synchronization (only used to park/wake idle workers)
+		std::mutex m_sleep_mutex;
 		std::condition_variable m_condition;
-		bool m_stop = false;
+		std::atomic<std::size_t> m_pending = 0;		//Number of queued tasks (all queues)
+		std::atomic<std::size_t> m_sleeping = 0;	//Number of parked workers
+		std::atomic_bool m_stop = false;
+
+		// bounded mode (backpressure on the producers)
+		std::size_t m_capacity = 0;			//0 for unbounded
+		OVERFLOW_POLICY m_overflow = OVERFLOW_POLICY::BLOCK;
+		std::atomic<std::size_t> m_queued = 0;		//Admitted tasks not popped yet (bounded mode only)
+		std::atomic<std::size_t> m_space_waiters = 0;
+		std::mutex m_space_mutex;
+		std::condition_variable m_space_condition;
 
 		//Number of workers (threads)
 		size_t m_pool_size = 0;
 
+		//Counters and task events, null when POOL_STATS::OFF
+		std::unique_ptr<details::pool_instrumentation> m_instrumentation;
+
+		// timers (schedule_after / schedule_every), served by a single thread started on first use
+		std::string m_name;
+		mutable std::mutex m_timer_mutex;
+		std::condition_variable m_timer_condition;
+		std::priority_queue<details::timer_entry> m_timers;
+		std::uint64_t m_timer_seq = 0;
+		bool m_timer_stop = false;
+		std::thread m_timer_thread;
+
+		//Worker identity of the current thread (pool == nullptr for a thread outside any pool)
+		struct worker_info {
+			thread_pool* m_pool = nullptr;
+			std::size_t m_index = 0;
+		};
+		static thread_local worker_info t_worker;
+
+		void push_task(task_t&& task, TASK_PRIORITY priority = TASK_PRIORITY::NORMAL, int worker = -1);
+		void push_bulk(std::vector<task_t>& tasks, TASK_PRIORITY priority, int worker = -1, bool bounded = true);
+		void push_unbounded(task_t&& task, TASK_PRIORITY priority, int worker);
+		details::work_stealing_queue& target_queue(std::size_t level, int worker);
+		void wake_workers(std::size_t count);
+		bool admit(std::size_t count, OVERFLOW_POLICY policy, const std::chrono::steady_clock::time_point* until);
+		bool try_reserve(std::size_t count);
+		void release_slots(std::size_t count);
+		bool drop_oldest();
+		bool push_admitted(task_t&& task, TASK_PRIORITY priority, int worker, OVERFLOW_POLICY policy, const std::chrono::steady_clock::time_point* until);
+		bool pop_task(std::size_t index, task_t& task);
+		void run_task(std::size_t index, task_t& task);
+		void worker_loop(std::size_t index);
+		void help_until_done(std::size_t index, const details::task_state_base& state);
+		void add_timer(std::shared_ptr<details::timer_job> job, std::chrono::steady_clock::time_point due);
+		void timer_loop();
+
+		friend void details::wait_task(const details::task_state_base& state);
+
 	public:
 
 		~thread_pool();
 		thread_pool(size_t);
 		thread_pool() : thread_pool(std::thread::hardware_concurrency()) {};
+		explicit thread_pool(const thread_pool_options& options);
+
+		class schedule_awaiter;
+
+		/// <summary>
+		/// Awaitable moving the calling coroutine onto a worker of this pool.
+		/// Ex:
+		/// bhd::task<cv::Mat> load(bhd::thread_pool& pool, std::string path) {
+		///		co_await pool.schedule();	//Continue on a worker
+		///		co_return cv::imread(path);
+		/// }
+		/// </summary>
+		/// <param name="priority">Priority of the resumption</param>
+		schedule_awaiter schedule(TASK_PRIORITY priority = TASK_PRIORITY::NORMAL);
 
 		static thread_pool& instance(size_t size = std::thread::hardware_concurrency())
 		{
@@ -119,18 +590,113 @@ namespace bhd
 			return singleton;
 		}
 
+		//! Return the number of workers
+		size_t size() const noexcept { return m_pool_size; }
+
+		//! Return the maximum number of queued tasks (0 for unbounded)
+		std::size_t capacity() const noexcept { return m_capacity; }
+
+		//! Return the number of queued tasks (not started yet)
+		std::size_t queued() const noexcept { return m_pending.load(); }
+
+		/// <summary>
+		/// Snapshot of the pool instrumentation: per-worker counters (tasks run and stolen, busy / idle / stealing time),
+		/// enqueue to start latency and duration histograms, queue depths.
+		/// Only the queue depths are filled if the pool was built with POOL_STATS::OFF.
+		/// </summary>
+		pool_stats stats() const;
+
+		//! Return the task events of each worker (empty without POOL_STATS::TRACE), see write_chrome_trace
+		std::vector<std::vector<trace_event>> trace() const;
+
+		//! Return the current depth of each worker deque and of the injection queue (last)
+		queue_sample sample_queues() const;
+
+		//! Return the worker index of the calling thread if it belongs to this pool, else -1
+		int worker_index() const noexcept {
+			return t_worker.m_pool == this ? static_cast<int>(t_worker.m_index) : -1;
+		}
+
+		/// <summary>
+		/// Queue a raw task state. Low level entry used by the task combinators (then, when_all, task_graph...).
+		/// The capacity of a bounded pool does not apply: a continuation is never refused.
+		/// </summary>
+		void submit(details::task_state_ptr<details::task_state_base> state, TASK_PRIORITY priority = TASK_PRIORITY::NORMAL)
+		{
+			push_unbounded(task_t(std::move(state)), priority, -1);
+		}
 
+		/// <summary>
+		/// Queue a task. On a full bounded pool, the overflow policy applies (block, drop the oldest task or throw queue_full).
+		/// </summary>
 		template<class T>
 		void enqueue(const threaded_task<T>& task)
 		{
-			// don't allow enqueue after stopping the pool
-			if (m_stop)
-				throw std::runtime_error("enqueue on stopped ThreadPool");
-			{
-				const std::lock_guard<std::mutex> lock(m_queue_mutex);
-				m_tasks.emplace(task.m_fct);
-			}
-			m_condition.notify_one();
+			enqueue(task, task_options{});
+		}
+
+		/// <summary>
+		/// Queue a task with a priority, a cancellation token and/or a deadline.
+		/// A task cancelled or past its deadline before it starts is dropped: its get() throws task_cancelled.
+		/// </summary>
+		template<class T>
+		void enqueue(const threaded_task<T>& task, const task_options& options)
+		{
+			assert(task.valid() && "No task set");
+			task.m_state->set_limits(options.m_token, options.m_deadline);
+			if (options.m_unbounded)
+				push_unbounded(task_t(task.m_state), options.m_priority, options.m_worker);
+			else if (!push_admitted(task_t(task.m_state), options.m_priority, options.m_worker, m_overflow, nullptr))
+				throw queue_full("thread_pool queue is full");
+		}
+
+		/// <summary>
+		/// Queue a task only if a bounded pool has a free slot: never blocks nor drops another task.
+		/// </summary>
+		/// <returns>false if the queue is full</returns>
+		template<class T>
+		bool try_enqueue(const threaded_task<T>& task, const task_options& options = {})
+		{
+			assert(task.valid() && "No task set");
+			task.m_state->set_limits(options.m_token, options.m_deadline);
+			return push_admitted(task_t(task.m_state), options.m_priority, options.m_worker, OVERFLOW_POLICY::REJECT, nullptr);
+		}
+
+		//! Create and queue a task if a bounded pool has a free slot (see try_enqueue(task)), std::nullopt if the queue is full
+		template<class F, class... Args>
+		auto try_enqueue(F&& f, Args&&... args) -> std::optional<threaded_task<std::invoke_result_t<F, Args...>>>
+		{
+			using result_t = std::invoke_result_t<F, Args...>;
+			threaded_task<result_t> new_task(std::forward<F>(f), std::forward<Args>(args)...);
+			if (!try_enqueue<result_t>(new_task))
+				return std::nullopt;
+			return new_task;
+		}
+
+		/// <summary>
+		/// Queue a task, waiting at most 'timeout' for a free slot of a bounded pool.
+		/// Ex:
+		/// if (!pool.enqueue_for(task, std::chrono::milliseconds(40))) skip_frame();
+		/// </summary>
+		/// <returns>false if the queue stayed full</returns>
+		template<class T, class Rep, class Period>
+		bool enqueue_for(const threaded_task<T>& task, const std::chrono::duration<Rep, Period>& timeout, const task_options& options = {})
+		{
+			assert(task.valid() && "No task set");
+			const auto until = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(timeout);
+			task.m_state->set_limits(options.m_token, options.m_deadline);
+			return push_admitted(task_t(task.m_state), options.m_priority, options.m_worker, OVERFLOW_POLICY::BLOCK, &until);
+		}
+
+		//! Create and queue a task, waiting at most 'timeout' for a free slot (see enqueue_for(task)), std::nullopt on timeout
+		template<class Rep, class Period, class F, class... Args>
+		auto enqueue_for(const std::chrono::duration<Rep, Period>& timeout, F&& f, Args&&... args) -> std::optional<threaded_task<std::invoke_result_t<F, Args...>>>
+		{
+			using result_t = std::invoke_result_t<F, Args...>;
+			threaded_task<result_t> new_task(std::forward<F>(f), std::forward<Args>(args)...);
+			if (!enqueue_for<result_t>(new_task, timeout))
+				return std::nullopt;
+			return new_task;
 		}
 
 
@@ -143,6 +709,402 @@ namespace bhd
 			return new_task;
 		}
 
+		/// <summary>
+		/// Queue a task at a given time. No thread is held meanwhile: a single timer thread per pool serves every timer.
+		/// get() called before the due time waits (it never runs the task early).
+		/// The capacity of a bounded pool does not apply.
+		/// </summary>
+		/// <param name="time">Due time</param>
+		template<class F, class... Args>
+		auto schedule_at(std::chrono::steady_clock::time_point time, F&& f, Args&&... args) -> threaded_task<std::invoke_result_t<F, Args...>>
+		{
+			using result_t = std::invoke_result_t<F, Args...>;
+			threaded_task<result_t> new_task(std::forward<F>(f), std::forward<Args>(args)...);
+			new_task.m_state->set_dependencies(1);	//Released by the timer
+			add_timer(std::make_shared<details::delayed_job>(new_task.m_state, TASK_PRIORITY::NORMAL), time);
+			return new_task;
+		}
+
+		/// <summary>
+		/// Queue a task after a delay (see schedule_at).
+		/// Ex:
+		/// auto autosave = pool.schedule_after(std::chrono::seconds(30), save_project, path);
+		/// </summary>
+		template<class Rep, class Period, class F, class... Args>
+		auto schedule_after(const std::chrono::duration<Rep, Period>& delay, F&& f, Args&&... args) -> threaded_task<std::invoke_result_t<F, Args...>>
+		{
+			const auto time = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(delay);
+			return schedule_at(time, std::forward<F>(f), std::forward<Args>(args)...);
+		}
+
+		/// <summary>
+		/// Run f every period on the pool workers, until the returned handle cancels it or the pool is destroyed.
+		/// The ticks are due at start + k * period whatever the duration of f (no drift); two ticks never overlap,
+		/// a tick due while the previous one is still running is skipped. An exception thrown by f stops the job.
+		/// Ex:
+		/// bhd::timer_handle sampler = pool.schedule_every(std::chrono::milliseconds(10), [&] { record(); });
+		/// ...
+		/// sampler.stop();
+		/// </summary>
+		/// <param name="period">Time between two ticks (> 0), the first tick is due after one period</param>
+		/// <param name="f">Callable without argument</param>
+		/// <param name="priority">Priority of the ticks</param>
+		template<class Rep, class Period, class F>
+		timer_handle schedule_every(const std::chrono::duration<Rep, Period>& period, F&& f, TASK_PRIORITY priority = TASK_PRIORITY::NORMAL)
+		{
+			const auto step = std::chrono::duration_cast<std::chrono::steady_clock::duration>(period);
+			assert(step.count() > 0 && "Null period");
+			auto job = std::make_shared<details::periodic_job<std::decay_t<F>>>(std::forward<F>(f), step, priority);
+			add_timer(job, std::chrono::steady_clock::now() + step);
+			return timer_handle(std::move(job));
+		}
+
+		//! Return the number of pending timers (one-shot and periodic)
+		std::size_t timers() const
+		{
+			const std::lock_guard<std::mutex> lock(m_timer_mutex);
+			return m_timers.size();
+		}
+
+		/// <summary>
+		/// Queue a batch of callables at once: a single queue lock and only as many wake-ups as tasks (or parked workers).
+		/// Ex:
+		/// std::vector<std::function<void()>> jobs = ...;
+		/// pool.enqueue_bulk(jobs.begin(), jobs.end()).wait();
+		/// </summary>
+		/// <param name="begin">First callable, called as f()</param>
+		/// <param name="end">End of the callable range</param>
+		/// <param name="options">Scheduling options shared by all the tasks</param>
+		/// <returns>Group handle on the tasks</returns>
+		template<class It>
+		auto enqueue_bulk(It begin, It end, const task_options& options = {})
+		{
+			using result_t = std::invoke_result_t<typename std::iterator_traits<It>::reference>;
+
+			task_group<result_t> group;
+			std::vector<task_t> batch;
+			for (; begin != end; ++begin)
+			{
+				threaded_task<result_t> task(*begin);
+				task.m_state->set_limits(options.m_token, options.m_deadline);
+				batch.emplace_back(task.m_state);
+				group.m_tasks.push_back(std::move(task));
+			}
+			push_bulk(batch, options.m_priority, options.m_worker, !options.m_unbounded);
+			return group;
+		}
+
+		/// <summary>
+		/// Queue 'count' tasks calling fn(i), i in [0, count), as a single batch (see enqueue_bulk).
+		/// The function is shared by all the tasks, not copied per task.
+		/// Ex:
+		/// auto tiles = imgproc::Subdivide(img, 256);
+		/// auto group = pool.enqueue_n(tiles.size(), [&](std::size_t i) { return process(tiles[i]); });
+		/// auto results = group.get();
+		/// </summary>
+		/// <param name="count">Number of tasks</param>
+		/// <param name="fn">Task function, called as fn(i)</param>
+		/// <param name="options">Scheduling options shared by all the tasks</param>
+		/// <returns>Group handle on the tasks</returns>
+		template<class F>
+		auto enqueue_n(std::size_t count, F&& fn, const task_options& options = {})
+		{
+			using result_t = std::invoke_result_t<std::decay_t<F>&, std::size_t>;
+
+			auto shared_fn = std::make_shared<std::decay_t<F>>(std::forward<F>(fn));
+			task_group<result_t> group;
+			group.m_tasks.reserve(count);
+			std::vector<task_t> batch;
+			batch.reserve(count);
+			for (std::size_t i = 0; i < count; i++)
+			{
+				threaded_task<result_t> task([shared_fn, i]() -> result_t { return (*shared_fn)(i); });
+				task.m_state->set_limits(options.m_token, options.m_deadline);
+				batch.emplace_back(task.m_state);
+				group.m_tasks.push_back(std::move(task));
+			}
+			push_bulk(batch, options.m_priority, options.m_worker, !options.m_unbounded);
+			return group;
+		}
+
+		//! Create and queue a task with scheduling options (see enqueue(task, options))
+		template<class F, class... Args>
+		auto enqueue(const task_options& options, F&& f, Args&&... args) -> threaded_task<std::invoke_result_t<F, Args...>>
+		{
+			using result_t = std::invoke_result_t<F, Args...>;
+			threaded_task<result_t> new_task(std::forward<F>(f), std::forward<Args>(args)...);
+			this->enqueue<result_t>(new_task, options);
+			return new_task;
+		}
+
+		/// <summary>
+		/// Number of chunks used to split a range when no grain size is given (a few chunks per thread for load balancing).
+		/// </summary>
+		std::size_t auto_chunk_count() const noexcept {
+			return 4 * (m_pool_size + 1);
+		}
+
+		/// <summary>
+		/// Run fn(i) for i in [0, nchunks) over the workers and the calling thread.
+		/// Chunks are handed out dynamically through a shared counter. The calling thread takes part,
+		/// then runs inline the helpers that no worker has picked up yet, so nested calls cannot deadlock.
+		/// The first exception thrown by fn stops the distribution and is rethrown in the calling thread.
+		/// </summary>
+		/// <param name="nchunks">Number of chunks</param>
+		/// <param name="fn">Chunk function, called as fn(std::size_t chunk_index)</param>
+		template<class F>
+		void parallel_chunks(std::size_t nchunks, F&& fn)
+		{
+			if (nchunks == 0)
+				return;
+
+			if (nchunks == 1 || m_pool_size == 0) {
+				for (std::size_t c = 0; c < nchunks; c++)
+					fn(c);
+				return;
+			}
+
+			struct shared_t
+			{
+				std::atomic<std::size_t> m_next = 0;
+				std::atomic_bool m_failed = false;
+				std::exception_ptr m_exception;
+				std::mutex m_mutex;
+			} shared;
+
+			auto run = [&shared, &fn, nchunks]
+			{
+				for (std::size_t c = shared.m_next.fetch_add(1); c < nchunks && !shared.m_failed; c = shared.m_next.fetch_add(1))
+				{
+					try {
+						fn(c);
+					}
+					catch (...) {
+						const std::lock_guard<std::mutex> lock(shared.m_mutex);
+						if (!shared.m_exception)
+							shared.m_exception = std::current_exception();
+						shared.m_failed = true;
+					}
+				}
+			};
+
+			const std::size_t nhelpers = std::min(nchunks - 1, m_pool_size);
+			//The helpers are part of a running call: the capacity of a bounded pool doesn't apply to them
+			task_options options;
+			options.m_unbounded = true;
+			auto helpers = enqueue_n(nhelpers, [&run](std::size_t) { run(); }, options);
+
+			run();
+
+			helpers.wait();
+
+			if (shared.m_exception)
+				std::rethrow_exception(shared.m_exception);
+		}
+
+		/// <summary>
+		/// Parallel loop over the range [begin, end).
+		/// The range is split in chunks of 'grain' indices (grain <= 0: automatic chunking).
+		/// fn is called either per chunk as fn(chunk_begin, chunk_end) or per index as fn(i).
+		/// Ex:
+		/// pool.parallel_for(0, img.rows, 0, [&](int y) { process_row(img, y); });
+		/// </summary>
+		/// <param name="begin">First index</param>
+		/// <param name="end">Last index (excluded)</param>
+		/// <param name="grain">Chunk size (&lt;= 0 for automatic)</param>
+		/// <param name="fn">Loop body</param>
+		template<class Index, class F>
+		void parallel_for(Index begin, Index end, Index grain, F&& fn)
+		{
+			static_assert(std::is_integral_v<Index>, "parallel_for needs an integral index");
+			if (end <= begin)
+				return;
+
+			const std::size_t count = static_cast<std::size_t>(end - begin);
+			const std::size_t chunk = grain > 0 ? static_cast<std::size_t>(grain) : std::max<std::size_t>(1, (count + auto_chunk_count() - 1) / auto_chunk_count());
+			const std::size_t nchunks = (count + chunk - 1) / chunk;
+
+			parallel_chunks(nchunks, [&](std::size_t c)
+			{
+				const Index chunk_begin = static_cast<Index>(begin + c * chunk);
+				const Index chunk_end = static_cast<Index>(std::min<std::size_t>(count, (c + 1) * chunk) + begin);
+				if constexpr (std::is_invocable_v<F&, Index, Index>)
+					fn(chunk_begin, chunk_end);
+				else
+					for (Index i = chunk_begin; i < chunk_end; ++i)
+						fn(i);
+			});
+		}
+
+		//! Parallel loop over the range [begin, end) with automatic chunking
+		template<class Index, class F>
+		void parallel_for(Index begin, Index end, F&& fn) {
+			parallel_for(begin, end, Index(0), std::forward<F>(fn));
+		}
+
+		/// <summary>
+		/// Parallel reduction over the range [begin, end).
+		/// Each chunk computes a partial value, either with map(chunk_begin, chunk_end) or by folding map(i) with reduce.
+		/// Partial values are then combined with reduce in the chunk order, so the result is deterministic for a given grain.
+		/// Ex:
+		/// auto sum = pool.parallel_reduce(0, n, 0, 0.0, [&](int i) { return v[i]; }, std::plus<>{});
+		/// </summary>
+		/// <param name="begin">First index</param>
+		/// <param name="end">Last index (excluded)</param>
+		/// <param name="grain">Chunk size (&lt;= 0 for automatic)</param>
+		/// <param name="identity">Identity value of the reduction</param>
+		/// <param name="map">Chunk value function</param>
+		/// <param name="reduce">Combination function (T, T) -> T</param>
+		/// <returns>Reduced value</returns>
+		template<class Index, class T, class Map, class Reduce>
+		T parallel_reduce(Index begin, Index end, Index grain, T identity, Map&& map, Reduce&& reduce)
+		{
+			static_assert(std::is_integral_v<Index>, "parallel_reduce needs an integral index");
+			if (end <= begin)
+				return identity;
+
+			const std::size_t count = static_cast<std::size_t>(end - begin);
+			const std::size_t chunk = grain > 0 ? static_cast<std::size_t>(grain) : std::max<std::size_t>(1, (count + auto_chunk_count() - 1) / auto_chunk_count());
+			const std::size_t nchunks = (count + chunk - 1) / chunk;
+
+			std::vector<std::optional<T>> partials(nchunks);
+			parallel_chunks(nchunks, [&](std::size_t c)
+			{
+				const Index chunk_begin = static_cast<Index>(begin + c * chunk);
+				const Index chunk_end = static_cast<Index>(std::min<std::size_t>(count, (c + 1) * chunk) + begin);
+				if constexpr (std::is_invocable_v<Map&, Index, Index>)
+					partials[c].emplace(map(chunk_begin, chunk_end));
+				else
+				{
+					T value = identity;
+					for (Index i = chunk_begin; i < chunk_end; ++i)
+						value = reduce(std::move(value), map(i));
+					partials[c].emplace(std::move(value));
+				}
+			});
+
+			T result = std::move(identity);
+			for (auto& partial : partials)
+				result = reduce(std::move(result), std::move(*partial));
+			return result;
+		}
+
+	};
+
+	namespace details
+	{
+		/// <summary>
+		/// Dependency edge between a task and one of its inputs.
+		/// When the input is done, the edge releases one dependency of the target task and,
+		/// for the last one, submits the target to the pool (or runs it inline if no pool is given).
+		/// </summary>
+		class task_edge final : public task_continuation
+		{
+			using pool_t = block_pool<block_size_class(sizeof(task_state_ptr<task_state_base>) + 2 * sizeof(void*))>;
+
+			task_state_ptr<task_state_base> m_target;
+			thread_pool* m_pool;
+
+			task_edge(task_state_ptr<task_state_base> target, thread_pool* pool) :
+				m_target(std::move(target)), m_pool(pool) {}
+
+			void destroy() noexcept {
+				this->~task_edge();
+				pool_t::deallocate(this);
+			}
+
+		public:
+
+			void invoke() noexcept override
+			{
+				if (m_target->release_dependency())
+				{
+					if (m_pool == nullptr)
+						m_target->try_run();
+					else
+					{
+						try {
+							m_pool->submit(m_target);
+						}
+						catch (...) {
+							m_target->try_run(); //Stopped pool: run it here rather than losing it
+						}
+					}
+				}
+				destroy();
+			}
+
+			void discard() noexcept override {
+				destroy();
+			}
+
+			/// <summary>
+			/// Make 'target' wait for 'input'. The target dependency count has to account for this edge.
+			/// </summary>
+			/// <param name="input">Input task</param>
+			/// <param name="target">Dependent task</param>
+			/// <param name="pool">Pool where the target is submitted, nullptr to run it inline on the thread completing the input</param>
+			static void attach(task_state_base& input, task_state_ptr<task_state_base> target, thread_pool* pool)
+			{
+				void* memory = pool_t::allocate();
+				input.add_continuation(::new (memory) task_edge(std::move(target), pool));
+			}
+		};
+	}
+
+	//! Awaiter of thread_pool::schedule: the coroutine is resumed by a pool task
+	class thread_pool::schedule_awaiter
+	{
+		thread_pool& m_pool;
+		TASK_PRIORITY m_priority;
+
+	public:
+
+		schedule_awaiter(thread_pool& pool, TASK_PRIORITY priority) noexcept : m_pool(pool), m_priority(priority) {}
+
+		bool await_ready() const noexcept { return false; }
+
+		void await_suspend(std::coroutine_handle<> handle) {
+			m_pool.submit(details::make_task_state<void>([handle] { handle.resume(); }), m_priority);
+		}
+
+		void await_resume() const noexcept {}
 	};
 
-}
\ No newline at end of file
+	inline thread_pool::schedule_awaiter thread_pool::schedule(TASK_PRIORITY priority) {
+		return { *this, priority };
+	}
+
+	template<class T>
+	template<class F>
+	auto threaded_task<T>::then(thread_pool& pool, F&& f)
+	{
+		assert(valid() && "No task set");
+
+		using result_t = typename std::conditional_t<std::is_void_v<T>, std::invoke_result<std::decay_t<F>&>, std::invoke_result<std::decay_t<F>&, T>>::type;
+
+		auto input = std::move(m_state);
+		threaded_task<result_t> next;
+		next.m_state = details::make_task_state<result_t>([input, f = std::forward<F>(f)]() mutable -> result_t
+		{
+			if constexpr (std::is_void_v<T>) {
+				input->get();
+				return f();
+			}
+			else
+				return f(input->get());
+		});
+		next.m_state->set_dependencies(1);
+		details::task_edge::attach(*input, next.m_state, &pool);
+		if (input->mark_scheduled())
+			pool.submit(std::move(input));
+		return next;
+	}
+
+	template<class T>
+	template<class F>
+	auto threaded_task<T>::then(F&& f) {
+		return then(thread_pool::instance(), std::forward<F>(f));
+	}
+
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include "BHM_ThreadPool.h"
+#include "BHM_CpuTopology.h"
+
+namespace bhd
+{
+	/// <summary>
+	/// Set of thread pools, one per CPU domain (NUMA node or L3 cache).
+	/// The workers of a sub-pool stay on the CPUs of their domain, so a task and the data it touches
+	/// (allocated by a previous task of the same domain) share the same memory node / last level cache.
+	/// Work is never stolen across domains.
+	/// Ex:
+	/// bhd::topology_pool pools(bhd::CPU_DOMAIN::NUMA_NODE);
+	/// for (std::size_t i = 0; i < tiles.size(); i++)
+	///		tasks.push_back(pools.enqueue(pools.domain_of(i, tiles.size()), process, std::ref(tiles[i])));
+	/// </summary>
+	class topology_pool
+	{
+		std::vector<std::vector<int>> m_domains;
+		std::vector<std::unique_ptr<thread_pool>> m_pools;
+
+	public:
+
+		/// <summary>
+		/// Build one sub-pool per domain, with one worker per CPU of the domain.
+		/// </summary>
+		/// <param name="level">Domain level</param>
+		/// <param name="pin_each_worker">true: each worker on its own CPU, false: workers free inside their domain</param>
+		/// <param name="name">Prefix of the worker names ("name-d[domain]-[index]")</param>
+		explicit topology_pool(CPU_DOMAIN level = CPU_DOMAIN::NUMA_NODE, bool pin_each_worker = false, const std::string& name = "bhd")
+			: m_domains(cpu_domains(level))
+		{
+			m_pools.reserve(m_domains.size());
+			for (std::size_t d = 0; d < m_domains.size(); d++)
+			{
+				thread_pool_options options;
+				options.m_threads = m_domains[d].size();
+				options.m_cpus = m_domains[d];
+				options.m_one_cpu_per_worker = pin_each_worker;
+				options.m_name = name + "-d" + std::to_string(d);
+				m_pools.push_back(std::make_unique<thread_pool>(options));
+			}
+		}
+
+		//! Number of domains (sub-pools)
+		std::size_t size() const noexcept { return m_pools.size(); }
+
+		//! Sub-pool of a domain
+		thread_pool& pool(std::size_t domain) { return *m_pools.at(domain); }
+
+		//! CPUs of a domain
+		const std::vector<int>& cpus(std::size_t domain) const { return m_domains.at(domain); }
+
+		//! Domain of the calling thread if it is a worker of one of the sub-pools, else -1
+		int current_domain() const noexcept
+		{
+			for (std::size_t d = 0; d < m_pools.size(); d++)
+				if (m_pools[d]->worker_index() >= 0)
+					return static_cast<int>(d);
+			return -1;
+		}
+
+		//! Domain of the item i of n, splitting the items in contiguous blocks (locality hint for tiled data)
+		std::size_t domain_of(std::size_t i, std::size_t n) const noexcept {
+			return n == 0 ? 0 : (i * m_pools.size()) / n;
+		}
+
+		/// <summary>
+		/// Queue a task on the sub-pool of a domain.
+		/// </summary>
+		/// <param name="domain">Domain index (modulo the number of domains)</param>
+		template<class F, class... Args>
+		auto enqueue(std::size_t domain, F&& f, Args&&... args)
+		{
+			return m_pools[domain % m_pools.size()]->enqueue(std::forward<F>(f), std::forward<Args>(args)...);
+		}
+
+		/// <summary>
+		/// Queue a task on the domain of the calling worker (domain 0 from any other thread).
+		/// </summary>
+		template<class F, class... Args>
+		auto enqueue_local(F&& f, Args&&... args)
+		{
+			const int domain = current_domain();
+			return enqueue(domain < 0 ? 0 : static_cast<std::size_t>(domain), std::forward<F>(f), std::forward<Args>(args)...);
+		}
+	};
+}
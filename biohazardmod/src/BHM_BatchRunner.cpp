@@ -0,0 +1,370 @@
+#include "BHM_BatchRunner.h"
+#include "BHM_Utils.h"
+
+#include <latch>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <semaphore>
+
+namespace bhd
+{
+	namespace
+	{
+		using clock = std::chrono::steady_clock;
+
+		double elapsed_ms(clock::time_point start, clock::time_point end = clock::now()) noexcept {
+			return std::chrono::duration<double, std::milli>(end - start).count();
+		}
+
+		std::string error_message(std::exception_ptr error)
+		{
+			try { std::rethrow_exception(error); }
+			catch (std::exception& e) { return e.what(); }
+			catch (...) { return "unknown exception"; }
+		}
+
+		//! Percentile of a sample set (sorted in place)
+		double percentile(std::vector<double>& values, double p)
+		{
+			if (values.empty())
+				return 0.0;
+			std::sort(values.begin(), values.end());
+			const std::size_t i = std::min(values.size() - 1, static_cast<std::size_t>(p * static_cast<double>(values.size())));
+			return values[i];
+		}
+
+		//! Options of a stage task. The run bounds its images in flight (m_max_in_flight): a bounded pool neither blocks nor drops its stages
+		task_options stage_options(TASK_PRIORITY priority) noexcept
+		{
+			task_options options;
+			options.m_priority = priority;
+			options.m_unbounded = true;
+			return options;
+		}
+
+		//! CSV field, quoted if needed
+		std::string csv_field(const std::string& value)
+		{
+			if (value.find_first_of(",\"\n") == std::string::npos)
+				return value;
+			std::string quoted = "\"";
+			for (char c : value)
+			{
+				if (c == '"')
+					quoted += '"';
+				quoted += c;
+			}
+			return quoted + "\"";
+		}
+	}
+
+	const char* to_string(BATCH_STAGE stage) noexcept
+	{
+		switch (stage)
+		{
+		case BATCH_STAGE::DECODE:	return "decode";
+		case BATCH_STAGE::PROCESS:	return "process";
+		case BATCH_STAGE::ENCODE:	return "encode";
+		default:					return "none";
+		}
+	}
+
+	std::size_t batch_report::succeeded() const noexcept
+	{
+		return static_cast<std::size_t>(std::count_if(m_items.begin(), m_items.end(), [](const batch_item& item) { return item.ok(); }));
+	}
+
+	std::size_t batch_report::failed() const noexcept
+	{
+		return static_cast<std::size_t>(std::count_if(m_items.begin(), m_items.end(), [](const batch_item& item) { return !item.m_error.empty(); }));
+	}
+
+	std::size_t batch_report::skipped() const noexcept
+	{
+		return static_cast<std::size_t>(std::count_if(m_items.begin(), m_items.end(), [](const batch_item& item) { return item.m_skipped; }));
+	}
+
+	double batch_report::throughput() const noexcept
+	{
+		return m_wall_ms > 0.0 ? 1000.0 * static_cast<double>(succeeded()) / m_wall_ms : 0.0;
+	}
+
+	std::string batch_report::to_string() const
+	{
+		std::ostringstream out;
+		out << std::fixed << std::setprecision(2);
+		out << "Batch: " << m_items.size() << " images, " << succeeded() << " succeeded, " << failed() << " failed, " << skipped() << " skipped"
+			<< " | " << m_workers << " workers, " << m_wall_ms << " ms, " << throughput() << " images/s\n";
+
+		std::vector<double> decode, process, encode, total;
+		for (const auto& item : m_items)
+		{
+			if (!item.ok())
+				continue;
+			decode.push_back(item.m_decode_ms);
+			process.push_back(item.m_process_ms);
+			encode.push_back(item.m_encode_ms);
+			total.push_back(item.m_total_ms);
+		}
+		const std::pair<const char*, std::vector<double>*> stages[] = { { "decode", &decode }, { "process", &process }, { "encode", &encode }, { "total", &total } };
+		for (const auto& [name, values] : stages)
+		{
+			out << "  " << std::left << std::setw(8) << name << std::right
+				<< " p50 " << std::setw(9) << percentile(*values, 0.5) << " ms"
+				<< "  p95 " << std::setw(9) << percentile(*values, 0.95) << " ms"
+				<< "  max " << std::setw(9) << percentile(*values, 1.0) << " ms\n";
+		}
+
+		for (const auto& item : m_items)
+		{
+			if (!item.m_error.empty())
+				out << "  FAILED [" << bhd::to_string(item.m_stage) << "] " << item.m_input.generic_string() << ": " << item.m_error << "\n";
+		}
+		return out.str();
+	}
+
+	void batch_report::write_csv(const std::filesystem::path& path) const
+	{
+		std::ofstream file(path);
+		file << "input,output,status,stage,decode_ms,process_ms,encode_ms,total_ms,error\n" << std::fixed << std::setprecision(3);
+		for (const auto& item : m_items)
+		{
+			file << csv_field(item.m_input.generic_string()) << "," << csv_field(item.m_output.generic_string()) << ","
+				<< (item.ok() ? "ok" : (item.m_skipped ? "skipped" : "failed")) << "," << bhd::to_string(item.m_stage) << ","
+				<< item.m_decode_ms << "," << item.m_process_ms << "," << item.m_encode_ms << "," << item.m_total_ms << ","
+				<< csv_field(item.m_error) << "\n";
+		}
+	}
+
+	//Shared by the tasks of a run, lives on the stack of run()
+	struct batch_runner::run_state
+	{
+		batch_report& m_report;
+		std::vector<clock::time_point> m_starts;
+		std::counting_semaphore<> m_slots;		//Images in flight
+		std::latch m_done;
+		std::atomic<bool> m_stop = false;
+		std::atomic<std::size_t> m_finished = 0;
+		std::mutex m_progress_mutex;
+
+		run_state(batch_report& report, std::size_t in_flight) :
+			m_report(report),
+			m_starts(report.m_items.size()),
+			m_slots(static_cast<std::ptrdiff_t>(in_flight)),
+			m_done(static_cast<std::ptrdiff_t>(report.m_items.size()))
+		{
+		}
+	};
+
+	batch_runner::batch_runner(module_factory factory, process_function process, batch_options options, thread_pool& pool) :
+		m_factory(std::move(factory)),
+		m_process(std::move(process)),
+		m_options(std::move(options)),
+		m_pool(pool),
+		m_prototype(m_factory())
+	{
+		assert(m_process && "No process function");
+		if (!m_prototype)
+			throw std::invalid_argument("batch_runner: the module factory returned no module");
+	}
+
+	batch_report batch_runner::run(const std::filesystem::path& directory)
+	{
+		auto files = GetImgFromDir(directory);
+		std::sort(files.begin(), files.end());
+		return run(std::move(files));
+	}
+
+	batch_report batch_runner::run(std::vector<std::filesystem::path> files)
+	{
+		assert(m_pool.worker_index() < 0 && "A batch run blocks its thread: do not start it from a worker of the pool");
+
+		batch_report report;
+		report.m_workers = m_pool.size();
+		report.m_items.resize(files.size());
+		for (std::size_t i = 0; i < files.size(); i++)
+			report.m_items[i].m_input = std::move(files[i]);
+		if (report.m_items.empty())
+			return report;
+
+		//One module per worker, configured once from the prototype: no module is shared between two tasks
+		if (m_modules.size() < m_pool.size())
+			m_modules.resize(m_pool.size());
+		m_free.clear();
+		for (auto& module : m_modules)
+		{
+			if (!module)
+				module = m_factory();
+			m_prototype->CopyTo(*module);
+			m_free.push_back(module.get());
+		}
+
+		if (!m_options.m_output_directory.empty())
+			std::filesystem::create_directories(m_options.m_output_directory);
+
+		const std::size_t in_flight = std::max<std::size_t>(1, m_options.m_max_in_flight > 0 ? m_options.m_max_in_flight : 2 * m_pool.size());
+		run_state state(report, in_flight);
+
+		const auto start = clock::now();
+		for (std::size_t i = 0; i < report.m_items.size(); i++)
+		{
+			state.m_slots.acquire();
+			if (state.m_stop)
+			{
+				for (std::size_t j = i; j < report.m_items.size(); j++)
+					report.m_items[j].m_skipped = true;
+				state.m_done.count_down(static_cast<std::ptrdiff_t>(report.m_items.size() - i));
+				break;
+			}
+
+			try
+			{
+				m_pool.enqueue(stage_options(TASK_PRIORITY::LOW), [this, &state, i] { decode(state, i); });
+			}
+			catch (...)
+			{
+				fail(state, i, BATCH_STAGE::DECODE, std::current_exception());
+			}
+		}
+
+		state.m_done.wait();
+		report.m_wall_ms = elapsed_ms(start);
+		return report;
+	}
+
+	void batch_runner::decode(run_state& state, std::size_t index) noexcept
+	{
+		auto& item = state.m_report.m_items[index];
+		const auto start = clock::now();
+		state.m_starts[index] = start;
+		try
+		{
+			cv::Mat image = cv::imread(item.m_input.string(), m_options.m_imread_flags);
+			if (image.empty())
+				throw std::runtime_error("cv::imread failed");
+			item.m_decode_ms = elapsed_ms(start);
+
+			//Queued on this worker deque: the decoded image is likely processed by the same core
+			m_pool.enqueue(stage_options(TASK_PRIORITY::NORMAL), [this, &state, index, image = std::move(image)] { process(state, index, image); });
+		}
+		catch (...)
+		{
+			fail(state, index, BATCH_STAGE::DECODE, std::current_exception());
+		}
+	}
+
+	void batch_runner::process(run_state& state, std::size_t index, const cv::Mat& image) noexcept
+	{
+		auto& item = state.m_report.m_items[index];
+		const auto start = clock::now();
+		try
+		{
+			//Checked out rather than taken by worker index: a worker helping inside m_process may run another process task
+			IModule& module = acquire_module();
+			cv::Mat result;
+			try
+			{
+				m_process(module, image, result);
+			}
+			catch (...)
+			{
+				release_module(module);
+				throw;
+			}
+			release_module(module);
+			item.m_process_ms = elapsed_ms(start);
+
+			if (m_options.m_output_directory.empty())
+				finish(state, index);
+			else
+				m_pool.enqueue(stage_options(TASK_PRIORITY::HIGH), [this, &state, index, result = std::move(result)] { encode(state, index, result); });
+		}
+		catch (...)
+		{
+			fail(state, index, BATCH_STAGE::PROCESS, std::current_exception());
+		}
+	}
+
+	IModule& batch_runner::acquire_module()
+	{
+		const std::lock_guard<std::mutex> lock(m_modules_mutex);
+		if (m_free.empty())
+		{
+			//All in use (nested process tasks): one more instance, kept for the next runs
+			auto module = m_factory();
+			if (!module)
+				throw std::runtime_error("batch_runner: the module factory returned no module");
+			m_prototype->CopyTo(*module);
+			m_modules.push_back(std::move(module));
+			return *m_modules.back();
+		}
+		IModule* module = m_free.back();
+		m_free.pop_back();
+		return *module;
+	}
+
+	void batch_runner::release_module(IModule& module) noexcept
+	{
+		const std::lock_guard<std::mutex> lock(m_modules_mutex);
+		m_free.push_back(&module);
+	}
+
+	void batch_runner::encode(run_state& state, std::size_t index, const cv::Mat& image) noexcept
+	{
+		auto& item = state.m_report.m_items[index];
+		const auto start = clock::now();
+		try
+		{
+			auto output = m_options.m_output_directory / item.m_input.filename();
+			if (!m_options.m_output_extension.empty())
+				output.replace_extension(m_options.m_output_extension);
+
+			if (image.empty())
+				throw std::runtime_error("empty result");
+			if (!cv::imwrite(output.string(), image, m_options.m_imwrite_params))
+				throw std::runtime_error("cv::imwrite failed");
+
+			item.m_output = std::move(output);
+			item.m_encode_ms = elapsed_ms(start);
+			finish(state, index);
+		}
+		catch (...)
+		{
+			fail(state, index, BATCH_STAGE::ENCODE, std::current_exception());
+		}
+	}
+
+	void batch_runner::fail(run_state& state, std::size_t index, BATCH_STAGE stage, std::exception_ptr error) noexcept
+	{
+		auto& item = state.m_report.m_items[index];
+		item.m_stage = stage;
+		item.m_error = error_message(error);
+		if (item.m_error.empty())
+			item.m_error = "unknown error";
+		if (m_options.m_stop_on_error)
+			state.m_stop = true;
+		finish(state, index);
+	}
+
+	void batch_runner::finish(run_state& state, std::size_t index) noexcept
+	{
+		auto& item = state.m_report.m_items[index];
+		if (state.m_starts[index] != clock::time_point{})
+			item.m_total_ms = elapsed_ms(state.m_starts[index]);
+
+		const std::size_t done = ++state.m_finished;
+		if (m_progress)
+		{
+			const std::lock_guard<std::mutex> lock(state.m_progress_mutex);
+			try { m_progress(item, done, state.m_report.m_items.size()); }
+			catch (...) {}
+		}
+
+		state.m_slots.release();
+		state.m_done.count_down();	//Last access to the state: run() may return right after
+	}
+}
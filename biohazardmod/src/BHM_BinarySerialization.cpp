@@ -0,0 +1,149 @@
+#include "BHM_BinarySerialization.h"
+#include "BHM_Hash.h"
+
+#include <cmath>
+#include <cassert>
+#include <algorithm>
+
+namespace bhd
+{
+	namespace binary
+	{
+		namespace
+		{
+			template<class T>
+			T load(const std::uint8_t* data)
+			{
+				T value;
+				std::memcpy(&value, data, sizeof(T));
+				return value;
+			}
+		}
+
+		const char* to_string(ELEMENT element) noexcept
+		{
+			switch (element)
+			{
+			case ELEMENT::TEXT:		return "text";
+			case ELEMENT::BOOL:		return "bool";
+			case ELEMENT::INT8:		return "int8";
+			case ELEMENT::UINT8:	return "uint8";
+			case ELEMENT::INT16:	return "int16";
+			case ELEMENT::UINT16:	return "uint16";
+			case ELEMENT::INT32:	return "int32";
+			case ELEMENT::UINT32:	return "uint32";
+			case ELEMENT::INT64:	return "int64";
+			case ELEMENT::UINT64:	return "uint64";
+			case ELEMENT::FLOAT32:	return "float32";
+			case ELEMENT::FLOAT64:	return "float64";
+			case ELEMENT::BYTES:	return "bytes";
+			default:				return "unknown";
+			}
+		}
+
+		std::string_view value_view::text() const
+		{
+			if (m_element != ELEMENT::TEXT)
+				mismatch(ELEMENT::TEXT, false);
+			return { reinterpret_cast<const char*>(m_data), m_bytes };
+		}
+
+		double value_view::to_double() const
+		{
+			switch (m_element)
+			{
+			case ELEMENT::FLOAT32:	return load<float>(m_data);
+			case ELEMENT::FLOAT64:	return load<double>(m_data);
+			case ELEMENT::UINT64:	return static_cast<double>(load<std::uint64_t>(m_data));
+			default:				return static_cast<double>(to_int64());
+			}
+		}
+
+		std::int64_t value_view::to_int64() const
+		{
+			if (m_array || !is_numeric())
+				mismatch(ELEMENT::INT64, false);
+
+			switch (m_element)
+			{
+			case ELEMENT::BOOL:		return load<std::uint8_t>(m_data) != 0 ? 1 : 0;
+			case ELEMENT::INT8:		return load<std::int8_t>(m_data);
+			case ELEMENT::UINT8:	return load<std::uint8_t>(m_data);
+			case ELEMENT::INT16:	return load<std::int16_t>(m_data);
+			case ELEMENT::UINT16:	return load<std::uint16_t>(m_data);
+			case ELEMENT::INT32:	return load<std::int32_t>(m_data);
+			case ELEMENT::UINT32:	return load<std::uint32_t>(m_data);
+			case ELEMENT::INT64:	return load<std::int64_t>(m_data);
+			case ELEMENT::UINT64:	return static_cast<std::int64_t>(load<std::uint64_t>(m_data));
+			case ELEMENT::FLOAT32:	return static_cast<std::int64_t>(std::llround(load<float>(m_data)));
+			default:				return static_cast<std::int64_t>(std::llround(load<double>(m_data)));
+			}
+		}
+
+		void value_view::mismatch(ELEMENT expected, bool array) const
+		{
+			throw std::runtime_error(std::string("binary: '") + std::string(m_path) + "' is " + (m_array ? "an array of " : "a ") + to_string(m_element) +
+				", " + (array ? "an array of " : "a ") + to_string(expected) + " is expected");
+		}
+
+		writer::writer(std::string_view key, std::vector<std::uint8_t> buffer) :
+			m_buffer(std::move(buffer))
+		{
+			m_buffer.clear();
+			file_header header;
+			header.m_key_size = static_cast<std::uint32_t>(key.size());
+			append(&header, sizeof(header));
+			append(key.data(), key.size());
+			pad();
+		}
+
+		void writer::append(const void* data, std::size_t size)
+		{
+			if (size == 0)
+				return;
+			const std::size_t offset = m_buffer.size();
+			m_buffer.resize(offset + size);
+			std::memcpy(m_buffer.data() + offset, data, size);
+		}
+
+		void writer::pad()
+		{
+			m_buffer.resize(align(m_buffer.size()), 0);
+		}
+
+		void writer::write(std::string_view path, ELEMENT element, bool array, const void* data, std::size_t bytes, std::size_t count)
+		{
+			assert(m_buffer.size() % ALIGNMENT == 0);
+			m_index.push_back({ hash_string(path), m_buffer.size() });
+
+			entry_header header;
+			header.m_path_size = static_cast<std::uint32_t>(path.size());
+			header.m_element = element;
+			header.m_array = array ? 1 : 0;
+			header.m_count = count;
+			header.m_bytes = bytes;
+
+			append(&header, sizeof(header));
+			append(path.data(), path.size());
+			pad();
+			append(data, bytes);
+			pad();
+		}
+
+		std::vector<std::uint8_t> writer::finish()
+		{
+			std::stable_sort(m_index.begin(), m_index.end(), [](const index_entry& a, const index_entry& b) { return a.m_hash < b.m_hash; });
+
+			file_header header;
+			std::memcpy(&header, m_buffer.data(), sizeof(header));
+			header.m_entries = static_cast<std::uint32_t>(m_index.size());
+			header.m_index_offset = m_buffer.size();
+			append(m_index.data(), m_index.size() * sizeof(index_entry));
+			header.m_size = m_buffer.size();
+			std::memcpy(m_buffer.data(), &header, sizeof(header));
+
+			m_index.clear();
+			return std::move(m_buffer);
+		}
+	}
+}
@@ -0,0 +1,288 @@
+#include "BHM_ConfigWatcher.h"
+
+#include <cerrno>
+#include <sstream>
+#include <utility>
+#include <algorithm>
+
+#if defined(__linux__)
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#endif
+
+namespace bhd
+{
+	namespace
+	{
+		using file_stamp = std::optional<std::pair<std::filesystem::file_time_type, std::uintmax_t>>;
+
+		//Modification time and size of a file, std::nullopt if it doesn't exist
+		file_stamp stamp(const std::filesystem::path& file_path)
+		{
+			std::error_code error;
+			const auto time = std::filesystem::last_write_time(file_path, error);
+			if (error)
+				return std::nullopt;
+			const auto size = std::filesystem::file_size(file_path, error);
+			if (error)
+				return std::nullopt;
+			return std::make_pair(time, size);
+		}
+
+		double elapsed_ms(config_watcher::clock::time_point start, config_watcher::clock::time_point end = config_watcher::clock::now())
+		{
+			return std::chrono::duration<double, std::milli>(end - start).count();
+		}
+
+		//Time without new event before reading a notified file: editors often write it in several steps
+		constexpr int SETTLE_MS = 50;
+	}
+
+	std::string config_reload::to_string() const
+	{
+		std::ostringstream out;
+		out << "Reload of " << m_file.generic_string();
+		if (!ok())
+			out << " failed: " << m_error;
+		else
+		{
+			out << ": " << m_changed.size() << " changed";
+			for (std::size_t i = 0; i < m_changed.size(); i++)
+				out << (i == 0 ? " (" : ", ") << m_changed[i] << (i + 1 == m_changed.size() ? ")" : "");
+		}
+		out << ", parse " << m_parse_ms << " ms, apply " << m_apply_ms << " ms, latency " << m_latency_ms << " ms";
+		if (m_imports > 1)
+			out << ", " << m_imports << " imports";
+		return out.str();
+	}
+
+	config_watcher::config_watcher(IModule& module, std::filesystem::path file_path, clock::duration period) :
+		m_module(module),
+		m_file(std::move(file_path)),
+		m_period(period),
+		m_staging(module.Clone())
+	{
+		m_module.VisitConfigurables([this](const std::string& path, IConfigurable& config) {
+			m_targets.push_back(&config);
+			m_paths.push_back(path);
+		});
+		std::as_const(*m_staging).VisitConfigurables([this](const std::string&, const IConfigurable& config) { m_sources.push_back(&config); });
+
+#if defined(__linux__)
+		//Watch the directory: the editors often replace the file (rename) rather than writing it
+		auto directory = m_file.parent_path();
+		if (directory.empty())
+			directory = ".";
+		m_notify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		m_wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (m_notify_fd < 0 || m_wake_fd < 0 || inotify_add_watch(m_notify_fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+		{
+			//Fallback on polling
+			if (m_notify_fd >= 0)
+				close(m_notify_fd);
+			if (m_wake_fd >= 0)
+				close(m_wake_fd);
+			m_notify_fd = m_wake_fd = -1;
+		}
+#endif
+		m_thread = std::thread([this] { run(); });
+	}
+
+	config_watcher::~config_watcher()
+	{
+		{
+			const std::lock_guard<std::mutex> lock(m_mutex);
+			m_stop = true;
+		}
+		wake();
+		m_thread.join();
+#if defined(__linux__)
+		if (m_notify_fd >= 0)
+			close(m_notify_fd);
+		if (m_wake_fd >= 0)
+			close(m_wake_fd);
+#endif
+	}
+
+	void config_watcher::run()
+	{
+		if (notified())
+		{
+			while (wait_notification())
+				reload(clock::now());
+			return;
+		}
+
+		auto last = stamp(m_file);
+		std::unique_lock<std::mutex> lock(m_mutex);
+		for (;;)
+		{
+			if (m_condition.wait_for(lock, m_period, [this] { return m_stop || m_reimport; }) && m_stop)
+				break;
+			if (auto current = stamp(m_file); m_reimport || (current && current != last))
+			{
+				last = current;
+				lock.unlock();
+				reload(clock::now());
+				lock.lock();
+			}
+		}
+	}
+
+	bool config_watcher::wait_notification()
+	{
+#if defined(__linux__)
+		const auto filename = m_file.filename().native();
+		bool changed = false;
+		for (;;)
+		{
+			pollfd fds[2] = { { m_notify_fd, POLLIN, 0 }, { m_wake_fd, POLLIN, 0 } };
+			const int ready = poll(fds, 2, changed ? SETTLE_MS : -1);
+			if (ready < 0 && errno == EINTR)
+				continue;
+			if (ready < 0)
+				return false;
+			if ((fds[1].revents & POLLIN) != 0)
+			{
+				std::uint64_t count;
+				[[maybe_unused]] auto drained = read(m_wake_fd, &count, sizeof(count));
+				const std::lock_guard<std::mutex> lock(m_mutex);
+				if (m_stop)
+					return false;
+				if (m_reimport)
+					return true;
+			}
+			if (ready == 0)
+				return true;		//Settled
+
+			alignas(inotify_event) char buffer[4096];
+			ssize_t size;
+			while ((size = read(m_notify_fd, buffer, sizeof(buffer))) > 0)
+			{
+				for (ssize_t offset = 0; offset < size; )
+				{
+					const auto* event = reinterpret_cast<const inotify_event*>(buffer + offset);
+					if (event->len > 0 && filename == event->name)
+						changed = true;
+					offset += static_cast<ssize_t>(sizeof(inotify_event) + event->len);
+				}
+			}
+		}
+#else
+		return false;
+#endif
+	}
+
+	void config_watcher::reload(clock::time_point detected)
+	{
+		pending_reload reload;
+		reload.m_detected = detected;
+		reload.m_report.m_file = m_file;
+		reload.m_report.m_imports = 1;
+
+		{
+			const std::lock_guard<std::mutex> lock(m_mutex);
+			m_reimport = false;
+		}
+
+		const auto start = clock::now();
+		{
+			const std::lock_guard<std::mutex> lock(m_staging_mutex);
+			const auto generation = IConfigurable::CurrentGeneration();
+			reload.m_report.m_error = m_staging->ImportFile(m_file);
+			if (reload.m_report.ok())
+			{
+				for (std::size_t i = 0; i < m_sources.size(); i++)
+				{
+					if (m_sources[i]->Generation() > generation)
+						reload.m_values.emplace_back(i, m_sources[i]->SnapshotValue());
+				}
+			}
+			else
+				reload.m_resync = true;		//The values read before the error are dropped
+		}
+		reload.m_report.m_parse_ms = elapsed_ms(start);
+
+		const std::lock_guard<std::mutex> lock(m_mutex);
+		if (m_pending)
+		{
+			//Not applied yet: merge, the newest values win
+			for (auto& value : m_pending->m_values)
+			{
+				if (std::none_of(reload.m_values.begin(), reload.m_values.end(), [&value](const auto& v) { return v.first == value.first; }))
+					reload.m_values.push_back(std::move(value));
+			}
+			reload.m_detected = m_pending->m_detected;
+			reload.m_resync = reload.m_resync || m_pending->m_resync;
+			reload.m_report.m_imports += m_pending->m_report.m_imports;
+			reload.m_report.m_parse_ms += m_pending->m_report.m_parse_ms;
+		}
+		m_pending = std::move(reload);
+		m_has_pending.store(true, std::memory_order_release);
+	}
+
+	std::optional<config_reload> config_watcher::apply()
+	{
+		if (!m_has_pending.load(std::memory_order_acquire))
+			return std::nullopt;
+
+		std::optional<pending_reload> reload;
+		{
+			const std::lock_guard<std::mutex> lock(m_mutex);
+			reload.swap(m_pending);
+			m_has_pending.store(false, std::memory_order_relaxed);
+		}
+		if (!reload)
+			return std::nullopt;
+
+		auto& report = reload->m_report;
+		auto& values = reload->m_values;
+		std::sort(values.begin(), values.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+
+		const auto start = clock::now();
+		for (const auto& [index, value] : values)
+		{
+			auto* target = m_targets[index];
+			const auto version = target->Version();
+			target->RestoreValue(value.get());
+			if (target->Version() != version)
+				report.m_changed.push_back(m_paths[index]);
+		}
+		if (reload->m_resync)
+		{
+			//A failed import left a part of the file in the staging: start again from the module values
+			{
+				const std::lock_guard<std::mutex> lock(m_staging_mutex);
+				m_module.CopyTo(*m_staging);
+			}
+			if (report.ok())
+			{
+				//The imports after the failure were compared to the half imported staging
+				{
+					const std::lock_guard<std::mutex> lock(m_mutex);
+					m_reimport = true;
+				}
+				wake();
+			}
+		}
+		const auto end = clock::now();
+
+		report.m_apply_ms = elapsed_ms(start, end);
+		report.m_latency_ms = elapsed_ms(reload->m_detected, end);
+		return std::move(report);
+	}
+
+	void config_watcher::wake()
+	{
+		m_condition.notify_all();
+#if defined(__linux__)
+		if (m_wake_fd >= 0)
+		{
+			const std::uint64_t one = 1;
+			[[maybe_unused]] auto written = write(m_wake_fd, &one, sizeof(one));
+		}
+#endif
+	}
+}
@@ -0,0 +1,186 @@
+#include "BHM_CpuTopology.h"
+
+#include <set>
+#include <cctype>
+#include <thread>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <filesystem>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace bhd
+{
+	namespace
+	{
+		//Every logical CPU in a single group
+		std::vector<std::vector<int>> single_domain()
+		{
+			std::vector<int> cpus(std::max(1u, std::thread::hardware_concurrency()));
+			for (std::size_t i = 0; i < cpus.size(); i++)
+				cpus[i] = static_cast<int>(i);
+			return { cpus };
+		}
+
+#if defined(__linux__)
+		//Parse a sysfs cpu list ("0-3,8-11")
+		std::vector<int> parse_cpu_list(const std::filesystem::path& path)
+		{
+			std::vector<int> cpus;
+			std::ifstream file(path);
+			std::string item;
+			while (std::getline(file, item, ','))
+			{
+				int first = 0, last = 0;
+				char dash = 0;
+				std::istringstream range(item);
+				if (!(range >> first))
+					continue;
+				if (!(range >> dash >> last))
+					last = first;
+				for (int cpu = first; cpu <= last; cpu++)
+					cpus.push_back(cpu);
+			}
+			return cpus;
+		}
+
+		std::vector<std::vector<int>> numa_domains()
+		{
+			std::vector<std::vector<int>> domains;
+			std::error_code ec;
+			for (const auto& entry : std::filesystem::directory_iterator("/sys/devices/system/node", ec))
+			{
+				const std::string name = entry.path().filename().string();
+				if (name.rfind("node", 0) != 0 || name.size() == 4 || !std::isdigit(static_cast<unsigned char>(name[4])))
+					continue;
+				auto cpus = parse_cpu_list(entry.path() / "cpulist");
+				if (!cpus.empty())
+					domains.push_back(std::move(cpus));
+			}
+			return domains;
+		}
+
+		std::vector<std::vector<int>> l3_domains()
+		{
+			//Online CPUs: the numbering may have gaps (offline or hot-plugged CPUs)
+			auto online = parse_cpu_list("/sys/devices/system/cpu/online");
+			if (online.empty())
+				online = parse_cpu_list("/sys/devices/system/cpu/possible");
+
+			std::set<std::vector<int>> domains;
+			for (int cpu : online)
+			{
+				const std::filesystem::path cache = "/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/cache";
+				std::error_code ec;
+				if (!std::filesystem::exists(cache, ec))
+					continue;
+				for (const auto& entry : std::filesystem::directory_iterator(cache, ec))
+				{
+					int level = 0;
+					std::ifstream(entry.path() / "level") >> level;
+					if (level != 3)
+						continue;
+					auto cpus = parse_cpu_list(entry.path() / "shared_cpu_list");
+					if (!cpus.empty())
+						domains.insert(std::move(cpus));
+				}
+			}
+			return { domains.begin(), domains.end() };
+		}
+#elif defined(_WIN32)
+		std::vector<std::vector<int>> windows_domains(LOGICAL_PROCESSOR_RELATIONSHIP relation)
+		{
+			DWORD length = 0;
+			GetLogicalProcessorInformationEx(relation, nullptr, &length);
+			if (GetLastError() != ERROR_INSUFFICIENT_BUFFER)
+				return {};
+			std::vector<char> buffer(length);
+			auto* info = reinterpret_cast<SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX*>(buffer.data());
+			if (!GetLogicalProcessorInformationEx(relation, info, &length))
+				return {};
+
+			std::set<std::vector<int>> domains;
+			for (DWORD offset = 0; offset < length; )
+			{
+				auto* item = reinterpret_cast<SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX*>(buffer.data() + offset);
+				const GROUP_AFFINITY* mask = nullptr;
+				if (item->Relationship == RelationNumaNode)
+					mask = &item->NumaNode.GroupMask;
+				else if (item->Relationship == RelationCache && item->Cache.Level == 3)
+					mask = &item->Cache.GroupMask;
+
+				if (mask != nullptr)
+				{
+					std::vector<int> cpus;
+					for (int bit = 0; bit < 64; bit++)
+						if (mask->Mask & (KAFFINITY(1) << bit))
+							cpus.push_back(mask->Group * 64 + bit);
+					if (!cpus.empty())
+						domains.insert(std::move(cpus));
+				}
+				offset += item->Size;
+			}
+			return { domains.begin(), domains.end() };
+		}
+#endif
+	}
+
+	std::vector<std::vector<int>> cpu_domains(CPU_DOMAIN level)
+	{
+		std::vector<std::vector<int>> domains;
+#if defined(__linux__)
+		domains = level == CPU_DOMAIN::NUMA_NODE ? numa_domains() : l3_domains();
+#elif defined(_WIN32)
+		domains = windows_domains(level == CPU_DOMAIN::NUMA_NODE ? RelationNumaNode : RelationCache);
+#else
+		(void)level;
+#endif
+		if (domains.empty())
+			return single_domain();
+		return domains;
+	}
+
+	bool set_current_thread_affinity(const std::vector<int>& cpus)
+	{
+		if (cpus.empty())
+			return false;
+#if defined(__linux__)
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		for (int cpu : cpus)
+			if (cpu >= 0 && cpu < CPU_SETSIZE)
+				CPU_SET(cpu, &set);
+		return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#elif defined(_WIN32)
+		GROUP_AFFINITY affinity = {};
+		affinity.Group = static_cast<WORD>(cpus.front() / 64);
+		for (int cpu : cpus)
+			if (cpu / 64 == affinity.Group)
+				affinity.Mask |= KAFFINITY(1) << (cpu % 64);
+		return SetThreadGroupAffinity(GetCurrentThread(), &affinity, nullptr) != 0;
+#else
+		return false;
+#endif
+	}
+
+	void set_current_thread_name(const std::string& name)
+	{
+#if defined(__linux__)
+		pthread_setname_np(pthread_self(), name.substr(0, 15).c_str());
+#elif defined(_WIN32)
+		std::wstring wname(name.begin(), name.end());
+		SetThreadDescription(GetCurrentThread(), wname.c_str());
+#else
+		(void)name;
+#endif
+	}
+}
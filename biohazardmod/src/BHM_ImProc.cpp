@@ -1,14 +1,18 @@
 #include "BHM_ImProc.h"
 #include "BHM_ExceptionTracking.h"
+#include "BHM_ParallelFor.h"
+#include "BHM_ScratchMat.h"
 
 namespace bhd::imgproc
 {
 	void Hysteresis(const cv::Mat& base, const cv::Mat& marker, cv::Mat& dst, int connectivity)
 	{
 		BEGIN_EXCEPTION_TRACKER;
+		const scratch_scope scratch;
 		std::vector<std::vector<cv::Point>> vContours;
 		cv::findContours(marker, vContours, cv::RETR_CCOMP, cv::CHAIN_APPROX_NONE);
-		cv::Mat fillBase = base.clone();
+		cv::Mat fillBase = scratch_mat();
+		base.copyTo(fillBase);
 		for (auto& contour : vContours) {
 			cv::floodFill(fillBase, contour[0], cv::Scalar::all(0), nullptr, {}, {}, connectivity);
 		}
@@ -160,6 +164,84 @@ namespace bhd::imgproc
 		return oOutMat;
 	}
 
+	template <typename T1, typename T2>
+	cv::Mat DrawArrowedLines(const cv::Mat oInMat, const std::vector<cv::Point_<T1>> & vPts1, const std::vector<cv::Point_<T2>> & vPts2, float dScale, cv::Scalar oColor, int iThickness, int iNThreads)
+	{
+		cv::Mat oOutMat;
+		BEGIN_EXCEPTION_TRACKER;
+
+		assert(vPts1.size() == vPts2.size());
+		oOutMat = ConvertToRGB(oInMat);
+
+		const std::size_t n = std::min(vPts1.size(), vPts2.size());
+
+		//Arrows and colors are computed once (serially, so the rng sequence doesn't depend on the threads)
+		std::vector<std::pair<cv::Point, cv::Point>> vArrows(n);
+		std::vector<double> vNorms(n);
+		double dMaxNorm = 0.0;
+		for (std::size_t i = 0; i < n; i++)
+		{
+			cv::Point2d p1 = vPts1[i];
+			cv::Point2d d = cv::Point2d(vPts2[i]) - p1;
+			cv::Point2d p2 = p1 + d * dScale;
+			vArrows[i] = { cv::Point(cvRound(p1.x), cvRound(p1.y)), cv::Point(cvRound(p2.x), cvRound(p2.y)) };
+			vNorms[i] = cv::norm(d);
+			dMaxNorm = std::max(dMaxNorm, vNorms[i]);
+		}
+
+		std::vector<cv::Scalar> vColors(n, oColor);
+		if (oColor[0] == -1)
+		{
+			cv::RNG rng(12345);
+			for (auto& color : vColors)
+				color = cv::Scalar(rng.uniform(oColor[1], oColor[2]), rng.uniform(oColor[1], oColor[2]), rng.uniform(oColor[1], oColor[2]));
+		}
+		else if (oColor[0] == -2)
+		{
+			double dNormalization = oColor[1] > 0 ? oColor[1] : dMaxNorm;
+			for (std::size_t i = 0; i < n; i++)
+				vColors[i] = GetColorLUT(dNormalization > 0 ? std::min(vNorms[i] / dNormalization, 1.0) : 0.0);
+		}
+
+		//Horizontal bands, each one draws the arrows crossing it (clipped to itself)
+		auto& pool = thread_pool::instance();
+		int iBandHeight = details::auto_tile_size(pool, oOutMat.size()).height;
+		if (iNThreads > 0)
+		{
+			int nbands = std::max(1, std::min(iNThreads, oOutMat.rows));
+			iBandHeight = std::max(1, (oOutMat.rows + nbands - 1) / nbands);
+		}
+		const int nbands = (oOutMat.rows + iBandHeight - 1) / iBandHeight;
+
+		//Arrows binned by the bands of their bounding box (tip and line width included), in drawing order
+		std::vector<std::vector<std::size_t>> vBands(nbands);
+		for (std::size_t i = 0; i < n; i++)
+		{
+			const auto& [p1, p2] = vArrows[i];
+			const int iMargin = cvCeil(0.1 * cv::norm(p2 - p1)) + iThickness / 2 + 2;	//cv::arrowedLine tip: 0.1 x length
+			const int y0 = std::max(std::min(p1.y, p2.y) - iMargin, 0);
+			const int y1 = std::min(std::max(p1.y, p2.y) + iMargin, oOutMat.rows - 1);
+			for (int b = y0 / iBandHeight; y0 <= y1 && b <= y1 / iBandHeight; b++)
+				vBands[b].push_back(i);
+		}
+
+		parallel_for_2d(pool, oOutMat.size(), { oOutMat.cols, iBandHeight }, [&](const cv::Rect& band)
+		{
+			cv::Mat oBand = oOutMat(band);
+			const cv::Point oOffset = band.tl();
+			for (std::size_t i : vBands[band.y / iBandHeight])
+				cv::arrowedLine(oBand, vArrows[i].first - oOffset, vArrows[i].second - oOffset, vColors[i], iThickness);
+		});
+
+		END_EXCEPTION_TRACKER_WITH_THROW();
+		return oOutMat;
+	}
+
+	template cv::Mat DrawArrowedLines(const cv::Mat, const std::vector<cv::Point_<int>>&, const std::vector<cv::Point_<int>>&, float, cv::Scalar, int, int);
+	template cv::Mat DrawArrowedLines(const cv::Mat, const std::vector<cv::Point_<float>>&, const std::vector<cv::Point_<float>>&, float, cv::Scalar, int, int);
+	template cv::Mat DrawArrowedLines(const cv::Mat, const std::vector<cv::Point_<int>>&, const std::vector<cv::Point_<float>>&, float, cv::Scalar, int, int);
+	template cv::Mat DrawArrowedLines(const cv::Mat, const std::vector<cv::Point_<float>>&, const std::vector<cv::Point_<int>>&, float, cv::Scalar, int, int);
+
 	double GetMaxValueFromBufferCV(int iDepthCV)
 	{
 
@@ -429,20 +511,27 @@ namespace bhd::imgproc
 		if (type == -1)
 			type = out.empty() ? CV_32FC1 : out.type();
 
-		cv::Mat image32f;
+		//Temporaries in the scratch arena of the thread: no allocation once warm
+		const scratch_scope scratch;
+
+		cv::Mat image32f = scratch_mat();
 		if (in.type() != CV_32F)
 			in.convertTo(image32f, CV_32F);
 		else
 			image32f = in;
 
-		cv::Mat mu;
+		cv::Mat mu = scratch_mat();
 		cv::blur(image32f, mu, ksize);
 
-		cv::Mat mu2;
-		cv::blur(image32f.mul(image32f), mu2, ksize);
+		cv::Mat square = scratch_mat();
+		cv::multiply(image32f, image32f, square);
+		cv::Mat mu2 = scratch_mat();
+		cv::blur(square, mu2, ksize);
 
-		cv::Mat sigma = mu2 - mu.mul(mu);
-		sigma.setTo(0, sigma <= 0);
+		cv::Mat sigma = scratch_mat();
+		cv::multiply(mu, mu, sigma);
+		cv::subtract(mu2, sigma, sigma);
+		cv::max(sigma, 0.0, sigma);
 
 		if (bUseSqrt)
 			cv::sqrt(sigma, sigma);
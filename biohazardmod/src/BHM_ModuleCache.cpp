@@ -0,0 +1,192 @@
+#include "BHM_ModuleCache.h"
+
+#include <sstream>
+#include <iomanip>
+#include <typeinfo>
+
+namespace bhd
+{
+	std::uint64_t mat_hash(const cv::Mat& mat)
+	{
+		std::uint64_t hash = hash_value(mat.type());
+		for (int i = 0; i < mat.dims; i++)
+			hash = hash_combine(hash, hash_value(mat.size[i]));
+		if (mat.empty())
+			return hash;
+
+		if (mat.isContinuous())
+			return hash_bytes(mat.data, mat.total() * mat.elemSize(), hash);
+
+		if (mat.dims == 2)
+		{
+			const std::size_t row_bytes = static_cast<std::size_t>(mat.cols) * mat.elemSize();
+			for (int r = 0; r < mat.rows; r++)
+				hash = hash_bytes(mat.ptr(r), row_bytes, hash);
+			return hash;
+		}
+
+		const cv::Mat continuous = mat.clone();
+		return hash_bytes(continuous.data, continuous.total() * continuous.elemSize(), hash);
+	}
+
+	std::string module_cache_stats::to_string() const
+	{
+		std::ostringstream out;
+		out << std::fixed << std::setprecision(1);
+		out << "Module cache: " << m_hits << " hits, " << m_misses << " misses (" << 100.0 * hit_rate() << "%), "
+			<< m_entries << " entries, " << static_cast<double>(m_bytes) / (1 << 20) << " / " << static_cast<double>(m_budget) / (1 << 20) << " MB, "
+			<< m_evictions << " evictions, " << m_rejected << " rejected | saved " << m_saved_ms << " ms, hashing " << m_hash_ms << " ms";
+		return out.str();
+	}
+
+	std::uint64_t module_cache::module_id(const IModule& module)
+	{
+		return hash_string(typeid(module).name(), hash_string(module.GetKey()));
+	}
+
+	std::uint64_t module_cache::result_hash(const key& k) noexcept
+	{
+		//Deterministic module: the output is fully defined by the key
+		return hash_combine(key_hasher{}(k), hashing::PRIME_3);
+	}
+
+	module_cache::key module_cache::make_key(const IModule& module, const cv::Mat& input) const
+	{
+		key k{ module_id(module), module.StateHash(), 0 };
+
+		{
+			const std::lock_guard<std::mutex> lock(m_mutex);
+			if (auto it = m_buffers.find(input.data); input.data != nullptr && it != m_buffers.end())
+			{
+				const auto& buffer = it->second;
+				if (buffer.m_rows == input.rows && buffer.m_cols == input.cols && buffer.m_type == input.type())
+				{
+					k.m_input = buffer.m_hash;
+					return k;
+				}
+			}
+		}
+
+		const auto start = std::chrono::steady_clock::now();
+		k.m_input = mat_hash(input);
+		const double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+		const std::lock_guard<std::mutex> lock(m_mutex);
+		m_stats.m_hash_ms += elapsed;
+		return k;
+	}
+
+	bool module_cache::find(const key& k, cv::Mat& result)
+	{
+		const std::lock_guard<std::mutex> lock(m_mutex);
+		auto it = m_index.find(k);
+		if (it == m_index.end())
+		{
+			m_stats.m_misses++;
+			return false;
+		}
+
+		m_lru.splice(m_lru.begin(), m_lru, it->second);
+		m_stats.m_hits++;
+		m_stats.m_saved_ms += it->second->m_cost_ms;
+		result = it->second->m_result;
+		return true;
+	}
+
+	void module_cache::insert(const key& k, const cv::Mat& result, std::chrono::nanoseconds cost)
+	{
+		const std::size_t bytes = result.u != nullptr ? result.u->size : result.total() * result.elemSize();
+
+		const std::lock_guard<std::mutex> lock(m_mutex);
+		if (auto it = m_index.find(k); it != m_index.end())
+			remove(it->second);
+
+		if (bytes > m_budget)
+		{
+			m_stats.m_rejected++;
+			return;
+		}
+
+		//Recognized by its address only if the result buffer is its own allocation, referenced by the caller alone:
+		//a buffer shared with the input (in place, ROI), kept by the module or wrapping user memory may be refilled later
+		const bool owned = result.data != nullptr && result.u != nullptr && result.u->refcount == 1;
+
+		evict(m_budget - bytes);
+		m_lru.push_front({ k, result, bytes, std::chrono::duration<double, std::milli>(cost).count() });
+		m_index.emplace(k, m_lru.begin());
+		if (owned)
+			m_buffers[result.data] = { result_hash(k), result.rows, result.cols, result.type() };
+		m_stats.m_bytes += bytes;
+		m_stats.m_insertions++;
+	}
+
+	void module_cache::remove(std::list<entry>::iterator it)
+	{
+		if (auto buffer = m_buffers.find(it->m_result.data); buffer != m_buffers.end() && buffer->second.m_hash == result_hash(it->m_key))
+			m_buffers.erase(buffer);
+		m_stats.m_bytes -= it->m_bytes;
+		m_index.erase(it->m_key);
+		m_lru.erase(it);
+	}
+
+	void module_cache::evict(std::size_t budget)
+	{
+		while (!m_lru.empty() && m_stats.m_bytes > budget)
+		{
+			remove(std::prev(m_lru.end()));
+			m_stats.m_evictions++;
+		}
+	}
+
+	void module_cache::erase(const IModule& module)
+	{
+		const std::uint64_t id = module_id(module);
+		const std::lock_guard<std::mutex> lock(m_mutex);
+		for (auto it = m_lru.begin(); it != m_lru.end();)
+		{
+			auto next = std::next(it);
+			if (it->m_key.m_module == id)
+				remove(it);
+			it = next;
+		}
+	}
+
+	void module_cache::clear()
+	{
+		const std::lock_guard<std::mutex> lock(m_mutex);
+		m_lru.clear();
+		m_index.clear();
+		m_buffers.clear();
+		m_stats.m_bytes = 0;
+	}
+
+	void module_cache::set_budget(std::size_t budget)
+	{
+		const std::lock_guard<std::mutex> lock(m_mutex);
+		m_budget = budget;
+		evict(budget);
+	}
+
+	std::size_t module_cache::budget() const
+	{
+		const std::lock_guard<std::mutex> lock(m_mutex);
+		return m_budget;
+	}
+
+	module_cache_stats module_cache::stats() const
+	{
+		const std::lock_guard<std::mutex> lock(m_mutex);
+		module_cache_stats stats = m_stats;
+		stats.m_entries = m_lru.size();
+		stats.m_budget = m_budget;
+		return stats;
+	}
+
+	void module_cache::reset_stats()
+	{
+		const std::lock_guard<std::mutex> lock(m_mutex);
+		const std::size_t bytes = m_stats.m_bytes;
+		m_stats = {};
+		m_stats.m_bytes = bytes;
+	}
+}
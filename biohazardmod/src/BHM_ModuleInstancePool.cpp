@@ -0,0 +1,104 @@
+#include "BHM_ModuleInstancePool.h"
+
+#include <sstream>
+#include <typeindex>
+#include <unordered_map>
+
+namespace bhd
+{
+	namespace
+	{
+		struct instance_entry
+		{
+			std::unique_ptr<IModule> m_instance;
+			std::uint64_t m_master = 0;				//Master of the last sync (IModule::InstanceId: an address may be reused by an other master)
+			std::uint64_t m_generation = 0;			//Generation of the last sync
+		};
+
+		struct thread_slot
+		{
+			std::weak_ptr<int> m_owner;
+			std::uint64_t m_epoch = 0;
+			std::unordered_map<std::type_index, instance_entry> m_instances;
+		};
+
+		//Instances of the calling thread, by pool id
+		thread_local std::unordered_map<std::uint64_t, thread_slot> t_slots;
+
+		std::atomic<std::uint64_t> s_next_id = 0;
+	}
+
+	std::string module_instance_pool_stats::to_string() const
+	{
+		std::ostringstream out;
+		out << "Module instances: " << m_calls << " calls, " << m_instances << " instances, " << m_syncs << " syncs";
+		return out.str();
+	}
+
+	module_instance_pool::module_instance_pool() :
+		m_alive(std::make_shared<int>(0)),
+		m_id(s_next_id.fetch_add(1, std::memory_order_relaxed))
+	{	}
+
+	template<class FSync>
+	IModule& module_instance_pool::local(const IModule& master, std::uint64_t generation, FSync&& sync)
+	{
+		m_calls.fetch_add(1, std::memory_order_relaxed);
+
+		auto [it, inserted] = t_slots.try_emplace(m_id);
+		auto& slot = it->second;
+		if (inserted)
+		{
+			slot.m_owner = m_alive;
+			//New pool for this thread: release the instances of the destroyed pools
+			std::erase_if(t_slots, [](const auto& s) { return s.second.m_owner.expired(); });
+		}
+
+		if (const auto epoch = m_epoch.load(std::memory_order_acquire); slot.m_epoch != epoch)
+		{
+			slot.m_instances.clear();
+			slot.m_epoch = epoch;
+		}
+
+		auto& entry = slot.m_instances[master.TypeIndex()];
+		if (!entry.m_instance)
+		{
+			entry.m_instance = master.CloneInstance();
+			m_instances.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		if (entry.m_master != master.InstanceId() || generation > entry.m_generation)
+		{
+			if (entry.m_master != master.InstanceId())
+			{
+				//An other master of the same type: take its identity, the sync copies only between same keys
+				entry.m_instance->m_sKey = master.m_sKey;
+				entry.m_instance->m_sAlias = master.m_sAlias;
+			}
+			sync(*entry.m_instance);
+			entry.m_master = master.InstanceId();
+			entry.m_generation = generation;
+			m_syncs.fetch_add(1, std::memory_order_relaxed);
+		}
+		return *entry.m_instance;
+	}
+
+	IModule& module_instance_pool::local(const IModule& master)
+	{
+		return local(master, master.Generation(), [&master](IModule& instance) { master.CopyTo(instance); });
+	}
+
+	IModule& module_instance_pool::local(const IModule& master, const parameter_snapshot& parameters)
+	{
+		return local(master, parameters.generation(), [&parameters](IModule& instance) { parameters.apply(instance); });
+	}
+
+	module_instance_pool_stats module_instance_pool::stats() const
+	{
+		module_instance_pool_stats stats;
+		stats.m_calls = m_calls.load(std::memory_order_relaxed);
+		stats.m_instances = m_instances.load(std::memory_order_relaxed);
+		stats.m_syncs = m_syncs.load(std::memory_order_relaxed);
+		return stats;
+	}
+}
@@ -0,0 +1,223 @@
+#include "BHM_ModuleSnapshot.h"
+#include "BHM_Hash.h"
+
+#include <fstream>
+#include <algorithm>
+
+namespace bhd
+{
+	namespace
+	{
+		template<class T>
+		T load_at(std::span<const std::uint8_t> bytes, std::size_t offset)
+		{
+			T value;
+			std::memcpy(&value, bytes.data() + offset, sizeof(T));
+			return value;
+		}
+
+		[[noreturn]] void invalid(const std::string& message)
+		{
+			throw std::runtime_error("module_snapshot: " + message);
+		}
+	}
+
+	module_snapshot::module_snapshot(const IModule& module, std::vector<std::uint8_t> buffer)
+	{
+		binary::writer out(module.GetAlias(), std::move(buffer));
+		module.VisitConfigurables([&out](const std::string& path, const IConfigurable& config) {
+			config.WriteBinary(out, path);
+		});
+		m_buffer = out.finish();
+		m_header = load_at<binary::file_header>(m_buffer, 0);
+	}
+
+	module_snapshot::module_snapshot(std::vector<std::uint8_t> bytes) :
+		m_buffer(std::move(bytes))
+	{
+		validate();
+	}
+
+	module_snapshot module_snapshot::view(std::span<const std::uint8_t> bytes)
+	{
+		if (reinterpret_cast<std::uintptr_t>(bytes.data()) % binary::ALIGNMENT != 0)
+			invalid("the bytes must be aligned on " + std::to_string(binary::ALIGNMENT) + " bytes");
+		module_snapshot snapshot;
+		snapshot.m_view = bytes;
+		snapshot.validate();
+		return snapshot;
+	}
+
+	module_snapshot module_snapshot::load(const std::filesystem::path& file_path)
+	{
+		std::ifstream file(file_path, std::ios::binary | std::ios::ate);
+		if (!file)
+			invalid("can't open " + file_path.generic_string());
+		std::vector<std::uint8_t> bytes(static_cast<std::size_t>(file.tellg()));
+		file.seekg(0);
+		if (!file.read(reinterpret_cast<char*>(bytes.data()), static_cast<std::streamsize>(bytes.size())))
+			invalid("can't read " + file_path.generic_string());
+		return module_snapshot(std::move(bytes));
+	}
+
+	void module_snapshot::save(const std::filesystem::path& file_path) const
+	{
+		std::ofstream file(file_path, std::ios::binary | std::ios::trunc);
+		const auto data = bytes();
+		if (!file || !file.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size())))
+			invalid("can't write " + file_path.generic_string());
+	}
+
+	std::vector<std::uint8_t> module_snapshot::release() noexcept
+	{
+		m_view = {};
+		m_header = {};
+		return std::move(m_buffer);
+	}
+
+	std::string_view module_snapshot::key() const noexcept
+	{
+		if (empty())
+			return {};
+		return { reinterpret_cast<const char*>(bytes().data() + sizeof(binary::file_header)), m_header.m_key_size };
+	}
+
+	void module_snapshot::validate()
+	{
+		const auto data = bytes();
+		if (data.size() < sizeof(binary::file_header))
+			invalid("truncated header");
+
+		m_header = load_at<binary::file_header>(data, 0);
+		if (m_header.m_magic != binary::MAGIC)
+			invalid("not a module snapshot");
+		if (m_header.m_version == 0 || m_header.m_version > binary::VERSION)
+			invalid("unsupported version " + std::to_string(m_header.m_version));
+		if (m_header.m_size != data.size())
+			invalid("size mismatch");
+		if (entries_offset() > m_header.m_index_offset || m_header.m_index_offset % binary::ALIGNMENT != 0 ||
+			m_header.m_index_offset + std::uint64_t(m_header.m_entries) * sizeof(binary::index_entry) != m_header.m_size)
+			invalid("corrupted index");
+
+		//Check every entry once: entry() and find() don't need bound checks afterwards
+		std::vector<std::pair<std::uint64_t, std::uint64_t>> starts;		//Offset and path hash of the entries, by increasing offset
+		starts.reserve(m_header.m_entries);
+		std::size_t offset = entries_offset();
+		for (std::uint32_t i = 0; i < m_header.m_entries; i++)
+		{
+			if (offset + sizeof(binary::entry_header) > m_header.m_index_offset)
+				invalid("truncated entry");
+			const auto header = load_at<binary::entry_header>(data, offset);
+			if (header.m_element >= binary::ELEMENT::N_COUNT || header.m_path_size > m_header.m_size || header.m_bytes > m_header.m_size)
+				invalid("corrupted entry");
+			const std::uint64_t end = offset + sizeof(binary::entry_header) + binary::align(header.m_path_size) + binary::align(header.m_bytes);
+			if (end > m_header.m_index_offset)
+				invalid("corrupted entry");
+			const std::string_view path(reinterpret_cast<const char*>(data.data() + offset + sizeof(binary::entry_header)), header.m_path_size);
+			starts.emplace_back(offset, hash_string(path));
+			offset = static_cast<std::size_t>(end);
+		}
+		if (offset != m_header.m_index_offset)
+			invalid("corrupted entries");
+
+		//An index entry points to the start of a checked entry with the same path hash, and the index is sorted by hash (see find)
+		std::uint64_t previous = 0;
+		for (std::uint32_t i = 0; i < m_header.m_entries; i++)
+		{
+			const auto index = load_at<binary::index_entry>(data, m_header.m_index_offset + i * sizeof(binary::index_entry));
+			const auto start = std::lower_bound(starts.begin(), starts.end(), index.m_offset, [](const auto& entry, std::uint64_t offset) { return entry.first < offset; });
+			if (start == starts.end() || start->first != index.m_offset || start->second != index.m_hash || index.m_hash < previous)
+				invalid("corrupted index entry");
+			previous = index.m_hash;
+		}
+	}
+
+	binary::value_view module_snapshot::entry(std::size_t& offset) const
+	{
+		const auto data = bytes();
+		const auto header = load_at<binary::entry_header>(data, offset);
+		offset += sizeof(binary::entry_header);
+
+		binary::value_view value;
+		value.m_path = std::string_view(reinterpret_cast<const char*>(data.data() + offset), header.m_path_size);
+		offset += binary::align(header.m_path_size);
+
+		value.m_element = header.m_element;
+		value.m_array = header.m_array != 0;
+		value.m_data = data.data() + offset;
+		value.m_bytes = static_cast<std::size_t>(header.m_bytes);
+		value.m_count = static_cast<std::size_t>(header.m_count);
+		offset += binary::align(value.m_bytes);
+		return value;
+	}
+
+	std::optional<binary::value_view> module_snapshot::find(std::string_view path) const
+	{
+		const auto data = bytes();
+		const std::uint64_t hash = hash_string(path);
+		auto index_at = [&](std::size_t i) { return load_at<binary::index_entry>(data, m_header.m_index_offset + i * sizeof(binary::index_entry)); };
+
+		//Lower bound of the hash in the sorted index
+		std::size_t first = 0, count = m_header.m_entries;
+		while (count > 0)
+		{
+			const std::size_t step = count / 2;
+			if (index_at(first + step).m_hash < hash)
+			{
+				first += step + 1;
+				count -= step + 1;
+			}
+			else
+				count = step;
+		}
+
+		for (std::size_t i = first; i < m_header.m_entries; i++)
+		{
+			const auto index = index_at(i);
+			if (index.m_hash != hash)
+				break;
+			std::size_t offset = static_cast<std::size_t>(index.m_offset);
+			if (auto value = entry(offset); value.m_path == path)
+				return value;
+		}
+		return std::nullopt;
+	}
+
+	std::size_t module_snapshot::apply(IModule& module) const
+	{
+		if (key() != module.GetAlias())
+			throw std::invalid_argument("module_snapshot: snapshot of '" + std::string(key()) + "' applied to '" + module.GetAlias() + "'");
+
+		std::size_t count = 0;
+		module.VisitConfigurables([&](const std::string& path, IConfigurable& config) {
+			if (auto value = find(path))
+			{
+				config.ReadBinary(*value);
+				count++;
+			}
+		});
+		return count;
+	}
+
+	std::string IModule::ExportBinary(const std::filesystem::path& file_path) const noexcept
+	{
+		try
+		{
+			module_snapshot(*this).save(file_path);
+		}
+		catch (std::exception& e) { return e.what(); }
+		catch (...) { return "unknown exception"; }
+		return {};
+	}
+
+	std::string IModule::ImportBinary(const std::filesystem::path& file_path) noexcept
+	{
+		try
+		{
+			module_snapshot::load(file_path).apply(*this);
+		}
+		catch (std::exception& e) { return e.what(); }
+		catch (...) { return "unknown exception"; }
+		return {};
+	}
+}
@@ -0,0 +1,55 @@
+#include "BHM_OpenCVBackend.h"
+
+namespace bhd
+{
+#if BHD_HAS_OPENCV_PARALLEL_BACKEND
+	void opencv_parallel_backend::parallel_for(int tasks, FN_parallel_for_body_cb_t body_callback, void* callback_data)
+	{
+		if (tasks <= 0)
+			return;
+
+		//OpenCV gives one task per stripe (often one per row): group them in a few ranges per thread
+		const int limit = m_threads.load();
+		const std::size_t max_chunks = limit > 0 ? static_cast<std::size_t>(limit) : m_pool.auto_chunk_count();
+		const std::size_t ntasks = static_cast<std::size_t>(tasks);
+		const std::size_t nchunks = std::min(ntasks, max_chunks);
+
+		m_pool.parallel_chunks(nchunks, [&](std::size_t c) {
+			const int begin = static_cast<int>(c * ntasks / nchunks);
+			const int end = static_cast<int>((c + 1) * ntasks / nchunks);
+			body_callback(begin, end, callback_data);
+		});
+	}
+
+	int opencv_parallel_backend::getThreadNum() const
+	{
+		//0 for the thread calling the loop, then the workers
+		return m_pool.worker_index() + 1;
+	}
+
+	int opencv_parallel_backend::getNumThreads() const
+	{
+		const int limit = m_threads.load();
+		return limit > 0 ? limit : static_cast<int>(m_pool.size()) + 1;
+	}
+
+	int opencv_parallel_backend::setNumThreads(int nThreads)
+	{
+		//The pool size is fixed: a smaller value only limits the number of threads taking part in a loop
+		m_threads = nThreads > 0 ? std::min(nThreads, static_cast<int>(m_pool.size()) + 1) : 0;
+		return getNumThreads();
+	}
+#endif
+
+	bool set_opencv_parallel_backend(thread_pool& pool)
+	{
+#if BHD_HAS_OPENCV_PARALLEL_BACKEND
+		//The pool size is kept (no propagation of the previous cv::setNumThreads value)
+		cv::parallel::setParallelForBackend(std::make_shared<opencv_parallel_backend>(pool), false);
+		return true;
+#else
+		(void)pool;
+		return false;
+#endif
+	}
+}
@@ -0,0 +1,60 @@
+#include "BHM_ParameterSnapshot.h"
+
+#include <cassert>
+
+namespace bhd
+{
+	void parameter_snapshot::apply(IModule& module) const
+	{
+		std::size_t i = 0;
+		module.VisitConfigurables([&](const std::string& path, IConfigurable& config) {
+			if (i >= m_values.size() || m_layout->m_paths[i] != path || m_layout->m_configurables[i]->TypeIndex() != config.TypeIndex())
+				throw std::invalid_argument("parameter_snapshot: the module " + module.GetKey() + " doesn't match the snapshot at " + path);
+			config.RestoreValue(m_values[i++].get());
+		});
+		assert(i == m_values.size());
+	}
+
+	parameter_publisher::parameter_publisher(IModule& module) :
+		m_module(module)
+	{
+		auto layout = std::make_shared<details::parameter_layout>();
+		module.VisitConfigurables([&layout](const std::string& path, IConfigurable& config) {
+			layout->m_index.emplace(&config, layout->m_configurables.size());
+			layout->m_path_index.emplace(path, layout->m_configurables.size());
+			layout->m_configurables.push_back(&config);
+			layout->m_paths.push_back(path);
+		});
+		m_layout = std::move(layout);
+		publish(true);
+	}
+
+	bool parameter_publisher::publish(bool force)
+	{
+		const auto current = m_current.load(std::memory_order_relaxed);	//Only written by this thread
+		const std::uint64_t last = current ? current->m_generation : 0;
+		if (!force && current && !m_module.ChangedSince(last))
+			return false;
+
+		auto snapshot = std::make_shared<parameter_snapshot>();
+		snapshot->m_layout = m_layout;
+		snapshot->m_generation = IConfigurable::CurrentGeneration();
+		if (current)
+			snapshot->m_values = current->m_values;
+		else
+			snapshot->m_values.resize(m_layout->m_configurables.size());
+
+		for (std::size_t i = 0; i < m_layout->m_configurables.size(); i++)
+		{
+			const auto* config = m_layout->m_configurables[i];
+			if (force || !snapshot->m_values[i] || config->Generation() > last)
+			{
+				snapshot->m_values[i] = config->SnapshotValue();
+				m_copies++;
+			}
+		}
+
+		m_current.store(std::move(snapshot), std::memory_order_release);
+		return true;
+	}
+}
@@ -0,0 +1,332 @@
+#include "BHM_ParameterSweep.h"
+
+#include <cmath>
+#include <mutex>
+#include <cassert>
+#include <random>
+#include <chrono>
+#include <numeric>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <stdexcept>
+
+namespace bhd
+{
+	namespace
+	{
+		using clock = std::chrono::steady_clock;
+
+		INumericConfigurable* find_numeric(IModule& module, const std::string& path)
+		{
+			auto* numeric = dynamic_cast<INumericConfigurable*>(module.FindConfigurable(path));
+			if (numeric == nullptr)
+				throw std::invalid_argument("parameter_sweep: '" + path + "' is not a numeric configurable of module " + module.GetKey());
+			return numeric;
+		}
+
+		//! Value of a parameter at a position in [0, 1] of its range
+		double value_at(const sweep_parameter& parameter, double t)
+		{
+			const double value = parameter.m_min + t * (parameter.m_max - parameter.m_min);
+			return parameter.m_integral ? std::round(value) : value;
+		}
+
+		std::string error_message(std::exception_ptr error)
+		{
+			try { std::rethrow_exception(error); }
+			catch (std::exception& e) { return e.what(); }
+			catch (...) { return "unknown exception"; }
+		}
+	}
+
+	const sweep_point* sweep_report::best() const noexcept
+	{
+		return !m_points.empty() && m_points.front().ok() ? &m_points.front() : nullptr;
+	}
+
+	std::string sweep_report::to_string(std::size_t top) const
+	{
+		std::ostringstream out;
+		const auto failed = std::count_if(m_points.begin(), m_points.end(), [](const sweep_point& p) { return !p.ok(); });
+		out << "Sweep: " << m_points.size() << " points, " << failed << " failed | " << m_workers << " workers, "
+			<< std::fixed << std::setprecision(1) << m_wall_ms << " ms\n";
+
+		out << "  " << std::setw(5) << "rank";
+		for (const auto& parameter : m_parameters)
+			out << " " << std::setw(std::max<int>(12, static_cast<int>(parameter.m_path.size()))) << parameter.m_path;
+		out << " " << std::setw(12) << "score" << " " << std::setw(10) << "ms" << "\n";
+
+		for (std::size_t i = 0; i < std::min(top, m_points.size()); i++)
+		{
+			const auto& point = m_points[i];
+			if (!point.ok())
+				break;
+			out << "  " << std::setw(5) << i + 1;
+			for (std::size_t p = 0; p < m_parameters.size(); p++)
+				out << " " << std::setw(std::max<int>(12, static_cast<int>(m_parameters[p].m_path.size()))) << std::setprecision(m_parameters[p].m_integral ? 0 : 4) << point.m_values[p];
+			out << " " << std::setw(12) << std::setprecision(6) << point.m_score << " " << std::setw(10) << std::setprecision(1) << point.m_ms << "\n";
+		}
+		return out.str();
+	}
+
+	void sweep_report::write_csv(const std::filesystem::path& path) const
+	{
+		std::ofstream file(path);
+		file << "rank";
+		for (const auto& parameter : m_parameters)
+			file << "," << parameter.m_path;
+		file << ",score,ms,error\n" << std::setprecision(10);
+		for (std::size_t i = 0; i < m_points.size(); i++)
+		{
+			const auto& point = m_points[i];
+			file << i + 1;
+			for (double value : point.m_values)
+				file << "," << value;
+			std::string error = point.m_error;
+			std::replace(error.begin(), error.end(), ',', ';');
+			std::replace(error.begin(), error.end(), '\n', ' ');
+			file << "," << point.m_score << "," << point.m_ms << "," << error << "\n";
+		}
+	}
+
+	parameter_sweep::parameter_sweep(module_factory factory, score_function score, thread_pool& pool) :
+		m_factory(std::move(factory)),
+		m_score(std::move(score)),
+		m_pool(pool),
+		m_prototype(m_factory())
+	{
+		assert(m_score && "No score function");
+		if (!m_prototype)
+			throw std::invalid_argument("parameter_sweep: the module factory returned no module");
+	}
+
+	parameter_sweep& parameter_sweep::add_parameter(const std::string& path, std::size_t steps)
+	{
+		const auto* numeric = find_numeric(*m_prototype, path);
+		if (!numeric->HasRange())
+			throw std::invalid_argument("parameter_sweep: '" + path + "' has no [min, max] range, give it explicitly");
+		return add_parameter(path, numeric->GetNumericMin(), numeric->GetNumericMax(), steps);
+	}
+
+	parameter_sweep& parameter_sweep::add_parameter(const std::string& path, double min, double max, std::size_t steps)
+	{
+		const auto* numeric = find_numeric(*m_prototype, path);
+		if (!(min <= max))
+			throw std::invalid_argument("parameter_sweep: invalid range of '" + path + "'");
+
+		sweep_parameter parameter{ path, std::max(min, numeric->GetNumericMin()), std::min(max, numeric->GetNumericMax()), std::max<std::size_t>(steps, 1), numeric->IsIntegral() };
+		if (parameter.m_integral)
+		{
+			parameter.m_min = std::ceil(parameter.m_min);
+			parameter.m_max = std::floor(parameter.m_max);
+		}
+		if (!(parameter.m_min <= parameter.m_max))
+			throw std::invalid_argument("parameter_sweep: empty range for '" + path + "'" + (parameter.m_integral ? " (no integer within the configurable range)" : " (outside the configurable range)"));
+		if (parameter.m_integral)
+			parameter.m_steps = std::min(parameter.m_steps, static_cast<std::size_t>(parameter.m_max - parameter.m_min) + 1);
+		m_parameters.push_back(std::move(parameter));
+		return *this;
+	}
+
+	parameter_sweep& parameter_sweep::add_all_parameters(std::size_t steps)
+	{
+		m_prototype->VisitConfigurables([&](const std::string& path, IConfigurable& config) {
+			if (auto* numeric = dynamic_cast<INumericConfigurable*>(&config); numeric != nullptr && numeric->HasRange())
+				add_parameter(path, steps);
+		});
+		return *this;
+	}
+
+	std::vector<std::vector<double>> parameter_sweep::sample(SWEEP_SAMPLING sampling, std::size_t count, std::uint64_t seed) const
+	{
+		const std::size_t ndims = m_parameters.size();
+		std::vector<std::vector<double>> points;
+		if (ndims == 0)
+			return points;
+
+		std::mt19937_64 rng(seed);
+		std::uniform_real_distribution<double> uniform(0.0, 1.0);
+
+		switch (sampling)
+		{
+		case SWEEP_SAMPLING::GRID:
+		{
+			std::size_t total = 1;
+			for (const auto& parameter : m_parameters)
+				total *= parameter.m_steps;
+			points.reserve(total);
+
+			std::vector<std::size_t> index(ndims, 0);
+			for (std::size_t n = 0; n < total; n++)
+			{
+				std::vector<double> point(ndims);
+				for (std::size_t d = 0; d < ndims; d++)
+				{
+					const auto& parameter = m_parameters[d];
+					const double t = parameter.m_steps > 1 ? static_cast<double>(index[d]) / static_cast<double>(parameter.m_steps - 1) : 0.5;
+					point[d] = value_at(parameter, t);
+				}
+				points.push_back(std::move(point));
+
+				//Next combination (odometer, last parameter fastest)
+				for (std::size_t d = ndims; d-- > 0;)
+				{
+					if (++index[d] < m_parameters[d].m_steps)
+						break;
+					index[d] = 0;
+				}
+			}
+			break;
+		}
+		case SWEEP_SAMPLING::RANDOM:
+		{
+			points.resize(count, std::vector<double>(ndims));
+			for (auto& point : points)
+				for (std::size_t d = 0; d < ndims; d++)
+					point[d] = value_at(m_parameters[d], uniform(rng));
+			break;
+		}
+		case SWEEP_SAMPLING::LATIN_HYPERCUBE:
+		{
+			points.resize(count, std::vector<double>(ndims));
+			std::vector<std::size_t> strata(count);
+			for (std::size_t d = 0; d < ndims; d++)
+			{
+				std::iota(strata.begin(), strata.end(), std::size_t(0));
+				std::shuffle(strata.begin(), strata.end(), rng);
+				for (std::size_t n = 0; n < count; n++)
+					points[n][d] = value_at(m_parameters[d], (static_cast<double>(strata[n]) + uniform(rng)) / static_cast<double>(count));
+			}
+			break;
+		}
+		default:
+			assert(0 && "Unknown sampling");
+		}
+
+		//Integral parameters may map several samples to the same point
+		std::sort(points.begin(), points.end());
+		points.erase(std::unique(points.begin(), points.end()), points.end());
+		return points;
+	}
+
+	IModule& parameter_sweep::acquire_module()
+	{
+		const std::lock_guard<std::mutex> lock(m_modules_mutex);
+		if (m_free.empty())
+		{
+			//All in use (nested evaluations): one more instance, kept for the next runs
+			auto module = m_factory();
+			if (!module)
+				throw std::runtime_error("parameter_sweep: the module factory returned no module");
+			m_prototype->CopyTo(*module);
+			m_modules.push_back(std::move(module));
+			return *m_modules.back();
+		}
+		IModule* module = m_free.back();
+		m_free.pop_back();
+		return *module;
+	}
+
+	void parameter_sweep::release_module(IModule& module) noexcept
+	{
+		const std::lock_guard<std::mutex> lock(m_modules_mutex);
+		m_free.push_back(&module);
+	}
+
+	void parameter_sweep::apply(const std::vector<double>& values, IModule& module) const
+	{
+		assert(values.size() == m_parameters.size());
+		for (std::size_t d = 0; d < m_parameters.size(); d++)
+			find_numeric(module, m_parameters[d].m_path)->SetNumericValue(values[d]);
+	}
+
+	void parameter_sweep::apply(const sweep_point& point, IModule& module) const
+	{
+		apply(point.m_values, module);
+	}
+
+	sweep_report parameter_sweep::run(const std::vector<cv::Mat>& images, SWEEP_SAMPLING sampling, std::size_t count, std::uint64_t seed)
+	{
+		return run(images, sample(sampling, count, seed));
+	}
+
+	sweep_report parameter_sweep::run(const std::vector<cv::Mat>& images, std::vector<std::vector<double>> points)
+	{
+		assert(m_pool.worker_index() < 0 && "A sweep blocks its thread: do not start it from a worker of the pool");
+
+		sweep_report report;
+		report.m_parameters = m_parameters;
+		report.m_workers = m_pool.size();
+		report.m_points.resize(points.size());
+		for (std::size_t i = 0; i < points.size(); i++)
+			report.m_points[i].m_values = std::move(points[i]);
+		if (report.m_points.empty())
+			return report;
+
+		//One module per worker, plus one for the calling thread (it runs tasks while waiting for the group)
+		if (m_modules.size() < m_pool.size() + 1)
+			m_modules.resize(m_pool.size() + 1);
+		m_free.clear();
+		for (auto& module : m_modules)
+		{
+			if (!module)
+				module = m_factory();
+			m_prototype->CopyTo(*module);
+			m_free.push_back(module.get());
+		}
+
+		std::mutex progress_mutex;
+		std::size_t done = 0;
+		const auto start = clock::now();
+
+		//The points are one job: a bounded pool neither refuses nor drops them
+		task_options options;
+		options.m_unbounded = true;
+		m_pool.enqueue_n(report.m_points.size(), [&](std::size_t i) {
+			auto& point = report.m_points[i];
+			const auto point_start = clock::now();
+			try
+			{
+				//Checked out rather than taken by worker index: a worker helping inside m_score may evaluate another point
+				IModule& module = acquire_module();
+				try
+				{
+					apply(point.m_values, module);
+					point.m_score = m_score(module, images);
+				}
+				catch (...)
+				{
+					release_module(module);
+					throw;
+				}
+				release_module(module);
+				if (!std::isfinite(point.m_score))
+					throw std::runtime_error("score is not finite");
+			}
+			catch (...)
+			{
+				point.m_error = error_message(std::current_exception());
+			}
+			point.m_ms = std::chrono::duration<double, std::milli>(clock::now() - point_start).count();
+
+			if (m_progress)
+			{
+				const std::lock_guard<std::mutex> lock(progress_mutex);
+				try { m_progress(point, ++done, report.m_points.size()); }
+				catch (...) {}
+			}
+		}, options).wait();
+
+		report.m_wall_ms = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+
+		//Rank: best score first, failures last
+		std::stable_sort(report.m_points.begin(), report.m_points.end(), [this](const sweep_point& a, const sweep_point& b) {
+			if (a.ok() != b.ok())
+				return a.ok();
+			return m_maximize ? a.m_score > b.m_score : a.m_score < b.m_score;
+		});
+		return report;
+	}
+}
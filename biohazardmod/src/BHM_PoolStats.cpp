@@ -0,0 +1,211 @@
+#include "BHM_PoolStats.h"
+
+#include <cmath>
+#include <cstdio>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <stdexcept>
+
+namespace bhd
+{
+	namespace
+	{
+		//! JSON string, quoted and escaped
+		std::string json_string(const std::string& value)
+		{
+			std::string quoted = "\"";
+			for (char c : value)
+			{
+				switch (c)
+				{
+				case '"':	quoted += "\\\""; break;
+				case '\\':	quoted += "\\\\"; break;
+				case '\n':	quoted += "\\n"; break;
+				case '\r':	quoted += "\\r"; break;
+				case '\t':	quoted += "\\t"; break;
+				default:
+					if (static_cast<unsigned char>(c) < 0x20)
+					{
+						char escaped[8];
+						std::snprintf(escaped, sizeof(escaped), "\\u%04x", static_cast<unsigned>(c));
+						quoted += escaped;
+					}
+					else
+						quoted += c;
+				}
+			}
+			return quoted + "\"";
+		}
+	}
+
+	std::uint64_t duration_histogram::count() const noexcept
+	{
+		std::uint64_t total = 0;
+		for (auto c : m_counts)
+			total += c;
+		return total;
+	}
+
+	double duration_histogram::percentile_ms(double p) const noexcept
+	{
+		const std::uint64_t total = count();
+		if (total == 0)
+			return 0.0;
+
+		const auto rank = static_cast<std::uint64_t>(std::ceil(std::clamp(p, 0.0, 1.0) * static_cast<double>(total)));
+		std::uint64_t seen = 0;
+		for (std::size_t b = 0; b < N_BUCKETS; b++)
+		{
+			seen += m_counts[b];
+			if (seen >= rank && m_counts[b] > 0)
+				return std::ldexp(1.0, static_cast<int>(b) + 1) * 1e-6;
+		}
+		return std::ldexp(1.0, static_cast<int>(N_BUCKETS)) * 1e-6;
+	}
+
+	std::string pool_stats::to_string() const
+	{
+		std::ostringstream out;
+		out << std::fixed << std::setprecision(3);
+		out << "thread_pool: " << m_workers.size() << " workers, " << m_elapsed_ms << " ms, queued " << m_queued << " (max " << m_max_queued << ")\n";
+		out << "  latency  p50 " << m_latency.percentile_ms(0.5) << " ms, p99 " << m_latency.percentile_ms(0.99) << " ms, max " << m_latency.percentile_ms(1.0) << " ms\n";
+		out << "  duration p50 " << m_duration.percentile_ms(0.5) << " ms, p99 " << m_duration.percentile_ms(0.99) << " ms, max " << m_duration.percentile_ms(1.0) << " ms\n";
+		for (std::size_t w = 0; w < m_workers.size(); w++)
+		{
+			const auto& worker = m_workers[w];
+			out << "  worker " << w << ": " << worker.m_executed << " tasks (" << worker.m_stolen << " stolen), busy " << worker.m_busy_ms
+				<< " ms, idle " << worker.m_idle_ms << " ms, stealing " << worker.m_steal_ms << " ms, depth " << worker.m_queue_depth << "\n";
+		}
+		return out.str();
+	}
+
+	void write_chrome_trace(const std::filesystem::path& path, const std::vector<std::vector<trace_event>>& workers,
+		const std::vector<queue_sample>& samples, const std::string& name)
+	{
+		if (path.has_parent_path())
+			std::filesystem::create_directories(path.parent_path());
+		std::ofstream file(path);
+		if (!file)
+			throw std::runtime_error("write_chrome_trace: cannot open " + path.string());
+
+		//Trace event format, timestamps in microseconds
+		file << std::fixed << std::setprecision(3);
+		file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+		file << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,\"args\":{\"name\":" << json_string(name) << "}}";
+		for (std::size_t w = 0; w < workers.size(); w++)
+		{
+			file << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << w << ",\"args\":{\"name\":\"worker " << w << "\"}}";
+			for (const auto& event : workers[w])
+				file << ",\n{\"name\":\"task\",\"ph\":\"X\",\"pid\":0,\"tid\":" << w
+					<< ",\"ts\":" << event.m_start_ns * 1e-3 << ",\"dur\":" << event.m_duration_ns * 1e-3 << "}";
+		}
+		for (const auto& sample : samples)
+		{
+			file << ",\n{\"name\":\"queue depth\",\"ph\":\"C\",\"pid\":0,\"ts\":" << sample.m_time_ns * 1e-3 << ",\"args\":{";
+			for (std::size_t q = 0; q < sample.m_depths.size(); q++)
+			{
+				if (q > 0)
+					file << ",";
+				if (q + 1 == sample.m_depths.size())
+					file << "\"injection\":" << sample.m_depths[q];
+				else
+					file << "\"worker " << q << "\":" << sample.m_depths[q];
+			}
+			file << "}}";
+		}
+		file << "\n]}\n";
+	}
+
+	namespace details
+	{
+		pool_instrumentation::pool_instrumentation(POOL_STATS level, std::size_t nworkers, std::size_t trace_capacity)
+			: m_level(level), m_trace_capacity(trace_capacity)
+		{
+			m_slots.reserve(nworkers);
+			for (std::size_t i = 0; i < nworkers; i++)
+				m_slots.emplace_back(std::make_unique<worker_slot>());
+		}
+
+		void pool_instrumentation::on_queued(std::size_t queued) noexcept
+		{
+			std::size_t max = m_max_queued.load(std::memory_order_relaxed);
+			while (queued > max && !m_max_queued.compare_exchange_weak(max, queued, std::memory_order_relaxed)) {}
+		}
+
+		void pool_instrumentation::on_task(std::size_t slot, clock::time_point queued_at, clock::time_point start, clock::time_point end, std::int64_t accounted)
+		{
+			auto& s = *m_slots[slot];
+			const auto duration = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+			//Exclusive time: the nested tasks, idle and steal periods in between were already recorded
+			const auto busy = std::max<std::int64_t>(0, duration - (s.m_accounted_ns - accounted));
+			s.m_accounted_ns += busy;
+			s.m_executed.fetch_add(1, std::memory_order_relaxed);
+			s.m_busy_ns.fetch_add(busy, std::memory_order_relaxed);
+			s.m_duration[duration_histogram::bucket(duration)].fetch_add(1, std::memory_order_relaxed);
+			if (queued_at != clock::time_point{})
+				s.m_latency[duration_histogram::bucket(std::chrono::duration_cast<std::chrono::nanoseconds>(start - queued_at).count())].fetch_add(1, std::memory_order_relaxed);
+
+			if (m_level == POOL_STATS::TRACE)
+			{
+				const std::lock_guard<std::mutex> lock(s.m_trace_mutex);
+				if (s.m_trace.size() < m_trace_capacity)
+					s.m_trace.push_back({ since_origin(start), duration });
+			}
+		}
+
+		void pool_instrumentation::on_steal(std::size_t slot, clock::duration span, bool found) noexcept
+		{
+			auto& s = *m_slots[slot];
+			const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(span).count();
+			s.m_accounted_ns += ns;
+			s.m_steal_ns.fetch_add(ns, std::memory_order_relaxed);
+			if (found)
+				s.m_stolen.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		void pool_instrumentation::on_idle(std::size_t slot, clock::duration span) noexcept
+		{
+			auto& s = *m_slots[slot];
+			const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(span).count();
+			s.m_accounted_ns += ns;
+			s.m_idle_ns.fetch_add(ns, std::memory_order_relaxed);
+		}
+
+		pool_stats pool_instrumentation::snapshot() const
+		{
+			pool_stats stats;
+			stats.m_elapsed_ms = since_origin(clock::now()) * 1e-6;
+			stats.m_max_queued = m_max_queued.load(std::memory_order_relaxed);
+			for (const auto& slot : m_slots)
+			{
+				worker_stats worker;
+				worker.m_executed = slot->m_executed.load(std::memory_order_relaxed);
+				worker.m_stolen = slot->m_stolen.load(std::memory_order_relaxed);
+				worker.m_busy_ms = slot->m_busy_ns.load(std::memory_order_relaxed) * 1e-6;
+				worker.m_idle_ms = slot->m_idle_ns.load(std::memory_order_relaxed) * 1e-6;
+				worker.m_steal_ms = slot->m_steal_ns.load(std::memory_order_relaxed) * 1e-6;
+				stats.m_workers.push_back(worker);
+				for (std::size_t b = 0; b < duration_histogram::N_BUCKETS; b++)
+				{
+					stats.m_latency.m_counts[b] += slot->m_latency[b].load(std::memory_order_relaxed);
+					stats.m_duration.m_counts[b] += slot->m_duration[b].load(std::memory_order_relaxed);
+				}
+			}
+			return stats;
+		}
+
+		std::vector<std::vector<trace_event>> pool_instrumentation::trace() const
+		{
+			std::vector<std::vector<trace_event>> events;
+			events.reserve(m_slots.size());
+			for (const auto& slot : m_slots)
+			{
+				const std::lock_guard<std::mutex> lock(slot->m_trace_mutex);
+				events.push_back(slot->m_trace);
+			}
+			return events;
+		}
+	}
+}
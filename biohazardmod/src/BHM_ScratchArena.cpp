@@ -0,0 +1,174 @@
+#include "BHM_ScratchArena.h"
+#include "BHM_ScratchMat.h"
+
+#include <new>
+#include <cassert>
+#include <algorithm>
+
+namespace bhd
+{
+	namespace
+	{
+		constexpr std::size_t MAT_ALIGNMENT = 64;	//Same as cv::fastMalloc (SIMD loads)
+
+		//UMatData header of a Mat block, padded to keep the buffer aligned
+		constexpr std::size_t MAT_HEADER = (sizeof(cv::UMatData) + MAT_ALIGNMENT - 1) & ~(MAT_ALIGNMENT - 1);
+	}
+
+	scratch_arena::scratch_arena(std::size_t chunk_size)
+		: m_chunk_size(std::max<std::size_t>(chunk_size, 4096))
+	{
+	}
+
+	scratch_arena::~scratch_arena() = default;
+
+	scratch_arena& scratch_arena::local()
+	{
+		//Chunks are only allocated on first use: a thread which never allocates costs nothing
+		static thread_local scratch_arena arena;
+		return arena;
+	}
+
+	void* scratch_arena::allocate_in(chunk& c, std::size_t size, std::size_t alignment) noexcept
+	{
+		const auto base = reinterpret_cast<std::uintptr_t>(c.m_data.get());
+		const std::uintptr_t aligned = (base + c.m_offset + alignment - 1) & ~(std::uintptr_t(alignment) - 1);
+		if (aligned + size > base + c.m_size)
+			return nullptr;
+		c.m_offset = static_cast<std::size_t>(aligned - base) + size;
+		return reinterpret_cast<void*>(aligned);
+	}
+
+	void* scratch_arena::allocate(std::size_t size, std::size_t alignment)
+	{
+		assert(alignment > 0 && (alignment & (alignment - 1)) == 0 && "Alignment must be a power of two");
+		const std::size_t needed = size + alignment;
+
+		if (m_chunks.empty())
+		{
+			m_chunks.push_back({ std::make_unique<std::byte[]>(std::max(m_chunk_size, needed)), std::max(m_chunk_size, needed), 0 });
+			m_current = 0;
+		}
+
+		void* ptr = allocate_in(m_chunks[m_current], size, alignment);
+		while (ptr == nullptr)
+		{
+			//Next chunk: reuse the one left by a previous rollback, or grow
+			if (m_current + 1 == m_chunks.size())
+				m_chunks.push_back({ std::make_unique<std::byte[]>(std::max(m_chunk_size, needed)), std::max(m_chunk_size, needed), 0 });
+			else if (m_chunks[m_current + 1].m_size < needed)
+				m_chunks[m_current + 1] = { std::make_unique<std::byte[]>(std::max(m_chunk_size, needed)), std::max(m_chunk_size, needed), 0 };
+
+			chunk& next = m_chunks[++m_current];
+			next.m_offset = 0;
+			ptr = allocate_in(next, size, alignment);
+		}
+
+		m_high_water = std::max(m_high_water, used());
+		return ptr;
+	}
+
+	void scratch_arena::deallocate(void* ptr, std::size_t size) noexcept
+	{
+		if (ptr == nullptr || m_chunks.empty())
+			return;
+		chunk& c = m_chunks[m_current];
+		std::byte* const p = static_cast<std::byte*>(ptr);
+		if (p >= c.m_data.get() && p + size == c.m_data.get() + c.m_offset)
+			c.m_offset = static_cast<std::size_t>(p - c.m_data.get());
+	}
+
+	void scratch_arena::rollback(const marker& mark) noexcept
+	{
+		assert(m_live <= mark.m_live && "A scratch Mat outlived its scope");
+		if (m_chunks.empty())
+			return;
+		assert(mark.m_chunk <= m_current && "Rollback to a released marker");
+
+		//Back to the start after an overflow: a single chunk as large as all of them
+		if (mark.m_chunk == 0 && mark.m_offset == 0 && m_chunks.size() > 1)
+		{
+			const std::size_t total = capacity();
+			m_chunks.clear();
+			m_chunks.push_back({ std::unique_ptr<std::byte[]>(new (std::nothrow) std::byte[total]), total, 0 });
+			if (!m_chunks.front().m_data)
+				m_chunks.clear();	//Reallocated on the next allocation
+			m_current = 0;
+			return;
+		}
+
+		m_current = mark.m_chunk;
+		m_chunks[m_current].m_offset = mark.m_offset;
+	}
+
+	std::size_t scratch_arena::used() const noexcept
+	{
+		std::size_t total = 0;
+		for (std::size_t i = 0; i <= m_current && i < m_chunks.size(); i++)
+			total += m_chunks[i].m_offset;
+		return total;
+	}
+
+	std::size_t scratch_arena::capacity() const noexcept
+	{
+		std::size_t total = 0;
+		for (const auto& c : m_chunks)
+			total += c.m_size;
+		return total;
+	}
+
+	cv::MatAllocator* scratch_arena::mat_allocator()
+	{
+		if (!m_mat_allocator)
+			m_mat_allocator = std::make_unique<scratch_mat_allocator>(*this);
+		return m_mat_allocator.get();
+	}
+
+	cv::UMatData* scratch_mat_allocator::allocate(int dims, const int* sizes, int type, void* data0, size_t* step, cv::AccessFlag, cv::UMatUsageFlags) const
+	{
+		//Same layout as the default OpenCV allocator
+		size_t total = CV_ELEM_SIZE(type);
+		for (int i = dims - 1; i >= 0; i--)
+		{
+			if (step)
+			{
+				if (data0 && step[i] != CV_AUTOSTEP)
+				{
+					CV_Assert(total <= step[i]);
+					total = step[i];
+				}
+				else
+					step[i] = total;
+			}
+			total *= sizes[i];
+		}
+
+		//Header and buffer in a single block
+		auto* block = static_cast<uchar*>(m_arena.allocate(data0 ? sizeof(cv::UMatData) : MAT_HEADER + total, data0 ? alignof(cv::UMatData) : MAT_ALIGNMENT));
+		auto* u = ::new (block) cv::UMatData(this);
+		u->data = u->origdata = data0 ? static_cast<uchar*>(data0) : block + MAT_HEADER;
+		u->size = total;
+		if (data0)
+			u->flags |= cv::UMatData::USER_ALLOCATED;
+		m_arena.add_live(1);
+		return u;
+	}
+
+	bool scratch_mat_allocator::allocate(cv::UMatData* u, cv::AccessFlag, cv::UMatUsageFlags) const
+	{
+		return u != nullptr;
+	}
+
+	void scratch_mat_allocator::deallocate(cv::UMatData* u) const
+	{
+		if (!u)
+			return;
+		CV_Assert(u->urefcount == 0);
+		CV_Assert(u->refcount == 0);
+
+		const std::size_t block = (u->flags & cv::UMatData::USER_ALLOCATED) ? sizeof(cv::UMatData) : MAT_HEADER + u->size;
+		u->~UMatData();
+		m_arena.deallocate(u, block);
+		m_arena.add_live(-1);
+	}
+}
@@ -0,0 +1,41 @@
+#include "BHM_StagePipeline.h"
+
+#include <sstream>
+#include <iomanip>
+
+namespace bhd
+{
+	const stage_stats* pipeline_stats::bottleneck() const noexcept
+	{
+		const stage_stats* slowest = nullptr;
+		for (const auto& stage : m_stages)
+		{
+			if (slowest == nullptr || stage.m_utilization > slowest->m_utilization)
+				slowest = &stage;
+		}
+		return slowest;
+	}
+
+	std::string pipeline_stats::to_string() const
+	{
+		std::ostringstream out;
+		out << std::fixed << std::setprecision(1);
+		out << "Pipeline: " << m_frames_in << " frames in, " << m_frames_out << " out, " << m_elapsed_ms << " ms\n";
+		for (const auto& stage : m_stages)
+		{
+			out << "  " << std::left << std::setw(16) << stage.m_name << std::right
+				<< " x" << stage.m_workers
+				<< " | " << std::setw(8) << stage.m_frames << " frames " << std::setw(8) << stage.m_throughput << " fps"
+				<< " | busy " << std::setw(5) << 100.0 * stage.m_utilization << "%"
+				<< " | wait in " << std::setw(9) << stage.m_wait_input_ms << " ms, out " << std::setw(9) << stage.m_wait_output_ms << " ms"
+				<< " | queue " << stage.m_queue_size << "/" << stage.m_queue_capacity
+				<< " (peak " << stage.m_queue_peak << ", fill " << 100.0 * stage.m_queue_fill << "%)";
+			if (stage.m_errors > 0)
+				out << " | " << stage.m_errors << " errors";
+			out << "\n";
+		}
+		if (const auto* slowest = bottleneck(); slowest != nullptr && m_frames_in > 0)
+			out << "  bottleneck: " << slowest->m_name << "\n";
+		return out.str();
+	}
+}
@@ -1,51 +1,581 @@
 #include "BHM_ThreadPool.h"
+#include "BHM_CpuTopology.h"
 
 namespace bhd
 {
 
+	thread_local thread_pool::worker_info thread_pool::t_worker = {};
+
+	namespace
+	{
+		thread_pool_options options_with_threads(size_t threads)
+		{
+			thread_pool_options options;
+			options.m_threads = threads;
+			return options;
+		}
+	}
+
 	// the constructor just launches some amount of workers
 	thread_pool::thread_pool(size_t threads)
-		: m_stop(false), m_pool_size(threads)
+		: thread_pool(options_with_threads(threads))
 	{
-		m_workers.reserve(threads);
+	}
 
-		for (size_t i = 0; i < threads; ++i)
-		{
-			m_workers.emplace_back(
-				[this, i]
-				{
-					for (;;)
-					{
-						std::function<void()> task;
-						{
-							std::unique_lock<std::mutex> lock(m_queue_mutex);
-							m_condition.wait(lock,
-								[this] { return m_stop || !m_tasks.empty(); });
-
-							if (m_stop && m_tasks.empty())
-								return;
-
-							task = std::move(m_tasks.front());
-							m_tasks.pop();
-						}
-						task();
-					}
-				}
-				);
-		}
+	thread_pool::thread_pool(const thread_pool_options& options)
+		: m_stop(false), m_capacity(options.m_capacity), m_overflow(options.m_overflow), m_pool_size(options.m_threads), m_name(options.m_name)
+	{
+		if (options.m_stats != POOL_STATS::OFF)
+			m_instrumentation = std::make_unique<details::pool_instrumentation>(options.m_stats, m_pool_size, options.m_trace_capacity);
+
+		m_queues.reserve(m_pool_size);
+		for (size_t i = 0; i < m_pool_size; ++i)
+			m_queues.emplace_back(std::make_unique<priority_queues>());
 
+		m_workers.reserve(m_pool_size);
+		for (size_t i = 0; i < m_pool_size; ++i)
+		{
+			std::vector<int> cpus = options.m_cpus;
+			if (options.m_one_cpu_per_worker && !cpus.empty())
+				cpus = { options.m_cpus[i % options.m_cpus.size()] };
+			std::string name = options.m_name + "-" + std::to_string(i);
 
+			m_workers.emplace_back([this, i, cpus = std::move(cpus), name = std::move(name)]
+			{
+				set_current_thread_name(name);
+				if (!cpus.empty())
+					set_current_thread_affinity(cpus);
+				worker_loop(i);
+			});
+		}
 	}
 
 	thread_pool::~thread_pool()
 	{
+		//Timers first: the tasks they have already queued are still run
+		{
+			const std::lock_guard<std::mutex> lock(m_timer_mutex);
+			m_timer_stop = true;
+		}
+		m_timer_condition.notify_all();
+		if (m_timer_thread.joinable())
+			m_timer_thread.join();
+
 		{
-			const std::lock_guard<std::mutex> lock(m_queue_mutex);
+			const std::lock_guard<std::mutex> lock(m_sleep_mutex);
 			m_stop = true;
 		}
 		m_condition.notify_all();
+		{
+			const std::lock_guard<std::mutex> lock(m_space_mutex);
+		}
+		m_space_condition.notify_all();
 		for (std::thread& worker : m_workers)
 			worker.join();
 	}
 
-}
\ No newline at end of file
+	details::work_stealing_queue& thread_pool::target_queue(std::size_t level, int worker)
+	{
+		//Locality hint first, then local push (LIFO) from a worker of this pool, else through the injection queue
+		if (worker >= 0 && m_pool_size > 0)
+			return (*m_queues[static_cast<std::size_t>(worker) % m_pool_size])[level];
+		if (t_worker.m_pool == this)
+			return (*m_queues[t_worker.m_index])[level];
+		return m_injection[level];
+	}
+
+	void thread_pool::push_task(task_t&& task, TASK_PRIORITY priority, int worker)
+	{
+		const std::size_t level = static_cast<std::size_t>(priority);
+		assert(level < N_PRIORITIES);
+
+		task.mark_scheduled();
+		if (m_instrumentation)
+			task.m_queued_at = std::chrono::steady_clock::now();
+
+		//Counted before being visible: a counter never underestimates its queues (a pop never takes it below zero)
+		m_pending_levels[level].fetch_add(1);
+		const std::size_t pending = m_pending.fetch_add(1) + 1;
+		target_queue(level, worker).push(std::move(task));
+
+		if (m_instrumentation)
+			m_instrumentation->on_queued(pending);
+		wake_workers(1);
+	}
+
+	void thread_pool::push_unbounded(task_t&& task, TASK_PRIORITY priority, int worker)
+	{
+		if (m_stop)
+			throw std::runtime_error("enqueue on stopped ThreadPool");
+		if (m_capacity > 0)
+			m_queued.fetch_add(1);
+		push_task(std::move(task), priority, worker);
+	}
+
+	void thread_pool::push_bulk(std::vector<task_t>& tasks, TASK_PRIORITY priority, int worker, bool bounded)
+	{
+		if (tasks.empty())
+			return;
+		if (m_stop)
+			throw std::runtime_error("enqueue on stopped ThreadPool");
+
+		const std::size_t level = static_cast<std::size_t>(priority);
+		assert(level < N_PRIORITIES);
+		const std::size_t count = tasks.size();
+
+		//A batch larger than the capacity is admitted once the queues are empty
+		if (!bounded)
+		{
+			if (m_capacity > 0)
+				m_queued.fetch_add(count);
+		}
+		else if (!admit(count, m_overflow, nullptr))
+			throw queue_full("thread_pool queue is full");
+
+		const auto now = m_instrumentation ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point{};
+		for (auto& task : tasks)
+		{
+			task.mark_scheduled();
+			task.m_queued_at = now;
+			task.m_admitted = bounded && m_capacity > 0;
+		}
+
+		m_pending_levels[level].fetch_add(count);
+		const std::size_t pending = m_pending.fetch_add(count) + count;
+
+		//The whole batch under a single queue lock
+		target_queue(level, worker).push_bulk(tasks.begin(), tasks.end());
+		tasks.clear();
+
+		if (m_instrumentation)
+			m_instrumentation->on_queued(pending);
+		wake_workers(count);
+	}
+
+	void thread_pool::wake_workers(std::size_t count)
+	{
+		//Wake up parked workers only if there are some, and no more than the new tasks.
+		//The lock closes the window between the worker predicate check and its wait.
+		const std::size_t sleeping = m_sleeping.load();
+		if (sleeping == 0)
+			return;
+		{
+			const std::lock_guard<std::mutex> lock(m_sleep_mutex);
+		}
+		if (count >= sleeping)
+			m_condition.notify_all();
+		else
+			for (std::size_t i = 0; i < count; i++)
+				m_condition.notify_one();
+	}
+
+	bool thread_pool::pop_task(std::size_t index, task_t& task)
+	{
+		for (std::size_t level = 0; level < N_PRIORITIES; ++level)
+		{
+			//Skip the empty levels without touching their queues
+			if (m_pending_levels[level].load() == 0)
+				continue;
+
+			//Own deque first (LIFO), then the injection queue (FIFO),
+			//then steal (FIFO) from the other workers, starting after itself to spread the victims
+			bool found = (*m_queues[index])[level].pop(task);
+			if (!found)
+			{
+				const auto start = m_instrumentation ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point{};
+				found = m_injection[level].steal(task);
+				for (std::size_t i = 1; i < m_pool_size && !found; ++i)
+					found = (*m_queues[(index + i) % m_pool_size])[level].steal(task);
+				if (m_instrumentation)
+					m_instrumentation->on_steal(index, std::chrono::steady_clock::now() - start, found);
+			}
+
+			if (found)
+			{
+				m_pending_levels[level].fetch_sub(1);
+				m_pending.fetch_sub(1);
+				if (m_capacity > 0)
+					release_slots(1);
+				return true;
+			}
+		}
+		return false;
+	}
+
+	bool thread_pool::push_admitted(task_t&& task, TASK_PRIORITY priority, int worker, OVERFLOW_POLICY policy, const std::chrono::steady_clock::time_point* until)
+	{
+		// don't allow enqueue after stopping the pool
+		if (m_stop)
+			throw std::runtime_error("enqueue on stopped ThreadPool");
+		if (!admit(1, policy, until))
+			return false;
+		task.m_admitted = m_capacity > 0;
+		push_task(std::move(task), priority, worker);
+		return true;
+	}
+
+	bool thread_pool::try_reserve(std::size_t count)
+	{
+		std::size_t queued = m_queued.load();
+		do
+		{
+			if (queued != 0 && queued + count > m_capacity)
+				return false;
+		} while (!m_queued.compare_exchange_weak(queued, queued + count));
+		return true;
+	}
+
+	void thread_pool::release_slots(std::size_t count)
+	{
+		m_queued.fetch_sub(count);
+		if (m_space_waiters.load() > 0)
+		{
+			{
+				const std::lock_guard<std::mutex> lock(m_space_mutex);
+			}
+			m_space_condition.notify_all();
+		}
+	}
+
+	bool thread_pool::drop_oldest()
+	{
+		//Lowest priority first, then the oldest task: front of the injection queue, then front of the worker deques.
+		//The unbounded tasks (fork/join helpers, continuations, coroutine resumes) were not admitted: they are never dropped
+		const auto admitted = [](const task_t& task) { return task.m_admitted; };
+		for (std::size_t level = N_PRIORITIES; level-- > 0; )
+		{
+			if (m_pending_levels[level].load() == 0)
+				continue;
+
+			task_t task;
+			bool found = m_injection[level].steal_if(task, admitted);
+			for (std::size_t i = 0; i < m_pool_size && !found; ++i)
+				found = (*m_queues[i])[level].steal_if(task, admitted);
+
+			if (found)
+			{
+				m_pending_levels[level].fetch_sub(1);
+				m_pending.fetch_sub(1);
+				release_slots(1);
+				task.drop("task dropped by the overflow policy of the thread_pool");
+				return true;
+			}
+		}
+		return false;
+	}
+
+	bool thread_pool::admit(std::size_t count, OVERFLOW_POLICY policy, const std::chrono::steady_clock::time_point* until)
+	{
+		if (m_capacity == 0)
+			return true;
+
+		while (!try_reserve(count))
+		{
+			switch (policy)
+			{
+			case OVERFLOW_POLICY::REJECT:
+				return false;
+
+			case OVERFLOW_POLICY::DROP_OLDEST:
+				if (!drop_oldest())
+					std::this_thread::yield();	//Slots held by tasks being popped right now
+				break;
+
+			default:
+			{
+				if (until != nullptr && std::chrono::steady_clock::now() >= *until)
+					return false;
+
+				//A worker of this pool never waits for its own queues: it makes room by running a task
+				if (t_worker.m_pool == this)
+				{
+					task_t task;
+					if (pop_task(t_worker.m_index, task))
+						run_task(t_worker.m_index, task);
+					else
+						std::this_thread::yield();
+					break;
+				}
+
+				std::unique_lock<std::mutex> lock(m_space_mutex);
+				m_space_waiters.fetch_add(1);
+				auto has_room = [this, count] {
+					const std::size_t queued = m_queued.load();
+					return m_stop || queued == 0 || queued + count <= m_capacity;
+				};
+				if (until != nullptr)
+					m_space_condition.wait_until(lock, *until, has_room);
+				else
+					m_space_condition.wait(lock, has_room);
+				m_space_waiters.fetch_sub(1);
+
+				if (m_stop)
+					throw std::runtime_error("enqueue on stopped ThreadPool");
+				break;
+			}
+			}
+		}
+		return true;
+	}
+
+	void thread_pool::run_task(std::size_t index, task_t& task)
+	{
+		if (!m_instrumentation) {
+			task();
+			return;
+		}
+
+		const auto accounted = m_instrumentation->accounted(index);
+		const auto start = std::chrono::steady_clock::now();
+		if (task())	//Not counted if it was already run by threaded_task::get
+			m_instrumentation->on_task(index, task.m_queued_at, start, std::chrono::steady_clock::now(), accounted);
+	}
+
+	void thread_pool::worker_loop(std::size_t index)
+	{
+		t_worker = { this, index };
+
+		for (;;)
+		{
+			task_t task;
+			if (pop_task(index, task))
+			{
+				run_task(index, task);
+				continue;
+			}
+
+			const auto start = m_instrumentation ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point{};
+			std::unique_lock<std::mutex> lock(m_sleep_mutex);
+			m_sleeping.fetch_add(1);
+			m_condition.wait(lock,
+				[this] { return m_stop || m_pending.load() > 0; });
+			m_sleeping.fetch_sub(1);
+			if (m_instrumentation)
+				m_instrumentation->on_idle(index, std::chrono::steady_clock::now() - start);
+
+			if (m_stop && m_pending.load() == 0)
+				return;
+		}
+	}
+
+	void thread_pool::help_until_done(std::size_t index, const details::task_state_base& state)
+	{
+		constexpr int SPIN_COUNT = 64;
+
+		for (int idle = 0; !state.is_done(); )
+		{
+			task_t task;
+			if (pop_task(index, task))
+			{
+				run_task(index, task);
+				idle = 0;
+				continue;
+			}
+
+			//The awaited task is running on another thread (or waits for its inputs)
+			if (++idle < SPIN_COUNT) {
+				std::this_thread::yield();
+				continue;
+			}
+			if (m_stop && m_pending.load() == 0) {
+				state.wait();
+				break;
+			}
+
+			//Park like an idle worker. A done task does not notify the pool, hence the short timeout
+			const auto start = m_instrumentation ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point{};
+			std::unique_lock<std::mutex> lock(m_sleep_mutex);
+			m_sleeping.fetch_add(1);
+			m_condition.wait_for(lock, std::chrono::microseconds(500),
+				[this, &state] { return m_stop || m_pending.load() > 0 || state.is_done(); });
+			m_sleeping.fetch_sub(1);
+			if (m_instrumentation)
+				m_instrumentation->on_idle(index, std::chrono::steady_clock::now() - start);
+		}
+
+		//A wake up may have been consumed here without taking the task: pass it on
+		if (m_pending.load() > 0)
+			wake_workers(1);
+	}
+
+	void thread_pool::add_timer(std::shared_ptr<details::timer_job> job, std::chrono::steady_clock::time_point due)
+	{
+		{
+			const std::lock_guard<std::mutex> lock(m_timer_mutex);
+			if (m_timer_stop || m_stop)
+				throw std::runtime_error("enqueue on stopped ThreadPool");
+			if (!m_timer_thread.joinable())
+				m_timer_thread = std::thread([this] {
+					set_current_thread_name(m_name + "-timer");
+					timer_loop();
+				});
+			m_timers.push({ due, m_timer_seq++, std::move(job) });
+		}
+		//The new timer may be due before the one the timer thread waits for
+		m_timer_condition.notify_one();
+	}
+
+	void thread_pool::timer_loop()
+	{
+		std::unique_lock<std::mutex> lock(m_timer_mutex);
+		while (!m_timer_stop)
+		{
+			if (m_timers.empty()) {
+				m_timer_condition.wait(lock);
+				continue;
+			}
+			//By value: wait_until reads the due time after the wake-up, when a push may have moved the entry
+			if (const auto due = m_timers.top().m_due; std::chrono::steady_clock::now() < due) {
+				m_timer_condition.wait_until(lock, due);
+				continue;
+			}
+
+			details::timer_entry entry = m_timers.top();
+			m_timers.pop();
+
+			//Fired outside the lock: a job may submit to the pool, which may block on a bounded pool
+			lock.unlock();
+			const bool again = !entry.m_job->m_cancelled.load() && entry.m_job->fire(*this, entry.m_due);
+			lock.lock();
+			if (again)
+				m_timers.push({ entry.m_due, m_timer_seq++, std::move(entry.m_job) });
+		}
+
+		for (; !m_timers.empty(); m_timers.pop())
+			m_timers.top().m_job->discard();
+	}
+
+	queue_sample thread_pool::sample_queues() const
+	{
+		queue_sample sample;
+		if (m_instrumentation)
+			sample.m_time_ns = m_instrumentation->since_origin(std::chrono::steady_clock::now());
+		sample.m_depths.reserve(m_pool_size + 1);
+		for (const auto& queues : m_queues)
+		{
+			std::size_t depth = 0;
+			for (const auto& queue : *queues)
+				depth += queue.size();
+			sample.m_depths.push_back(depth);
+		}
+		std::size_t injected = 0;
+		for (const auto& queue : m_injection)
+			injected += queue.size();
+		sample.m_depths.push_back(injected);
+		return sample;
+	}
+
+	pool_stats thread_pool::stats() const
+	{
+		pool_stats stats;
+		if (m_instrumentation)
+			stats = m_instrumentation->snapshot();
+		else
+			stats.m_workers.resize(m_pool_size);
+
+		const queue_sample depths = sample_queues();
+		for (std::size_t i = 0; i < m_pool_size; i++)
+			stats.m_workers[i].m_queue_depth = depths.m_depths[i];
+		stats.m_queued = m_pending.load();
+		stats.m_max_queued = std::max(stats.m_max_queued, stats.m_queued);
+		return stats;
+	}
+
+	std::vector<std::vector<trace_event>> thread_pool::trace() const
+	{
+		if (!m_instrumentation)
+			return {};
+		return m_instrumentation->trace();
+	}
+
+	namespace details
+	{
+		bool delayed_job::fire(thread_pool& pool, std::chrono::steady_clock::time_point&)
+		{
+			if (m_state->release_dependency())
+				pool.submit(std::move(m_state), m_priority);
+			return false;
+		}
+
+		void delayed_job::discard() noexcept
+		{
+			m_state->try_drop("thread_pool destroyed before the due time of the task");
+		}
+
+		struct periodic_job_base::tick_runner
+		{
+			std::shared_ptr<periodic_job_base> m_job;
+
+			tick_runner(std::shared_ptr<periodic_job_base> job) noexcept : m_job(std::move(job)) {}
+			tick_runner(tick_runner&& other) noexcept = default;
+			tick_runner(const tick_runner&) = delete;
+
+			//The task callable is released once the task is run or dropped
+			~tick_runner() {
+				if (m_job)
+					m_job->end_tick();
+			}
+
+			void operator()() { m_job->tick(); }
+		};
+
+		bool periodic_job_base::fire(thread_pool& pool, std::chrono::steady_clock::time_point& due)
+		{
+			//Running flag before the cancellation check: once timer_handle::stop has seen no running tick, none can start
+			if (m_running.exchange(true))
+				m_missed.fetch_add(1);
+			else if (m_cancelled.load())
+			{
+				end_tick();
+				return false;
+			}
+			else
+				pool.submit(make_task_state<void>(tick_runner{ std::static_pointer_cast<periodic_job_base>(shared_from_this()) }), m_priority);
+
+			//Next tick on the initial grid, skipping the ones already passed
+			const auto now = std::chrono::steady_clock::now();
+			due += m_period;
+			if (due <= now)
+			{
+				const auto late = (now - due) / m_period + 1;
+				m_missed.fetch_add(static_cast<std::uint64_t>(late));
+				due += late * m_period;
+			}
+			return !m_cancelled.load();
+		}
+
+		void periodic_job_base::tick() noexcept
+		{
+			try {
+				run_tick();
+				m_ticks.fetch_add(1);
+			}
+			catch (...) {
+				{
+					const std::lock_guard<std::mutex> lock(m_error_mutex);
+					m_error = std::current_exception();
+				}
+				m_cancelled.store(true);
+			}
+		}
+
+		void periodic_job_base::end_tick() noexcept
+		{
+			m_running.store(false);
+			m_running.notify_all();
+		}
+
+		void wait_task(const task_state_base& state)
+		{
+			if (state.is_done())
+				return;
+
+			auto [pool, index] = thread_pool::t_worker;
+			if (pool != nullptr)
+				pool->help_until_done(index, state);
+			else
+				state.wait();
+		}
+	}
+
+}
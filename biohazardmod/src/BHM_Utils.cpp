@@ -2,10 +2,12 @@
 
 #include <cassert>
 #include <vector>
+#include <algorithm>
 
-using namespace bhd;
+namespace bhd
+{
 
-std::vector<std::filesystem::path> GetFilesFromDir(const std::filesystem::path& path_dir, std::filesystem::path& ext)
+std::vector<std::filesystem::path> GetFilesFromDir(const std::filesystem::path& path_dir, const std::filesystem::path& ext)
 {
 	std::vector<std::filesystem::path> vPathNameList;
 	for (auto& fs : std::filesystem::directory_iterator(path_dir))
@@ -36,3 +38,4 @@ std::vector<std::filesystem::path> GetFilesFromDir(const std::filesystem::path&
 	return vPathNameList;
 }
 
+}
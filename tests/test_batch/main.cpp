@@ -0,0 +1,135 @@
+#include "BHM_Module.h"
+#include "BHM_BatchRunner.h"
+#include "BHM_OpenCVBackend.h"
+
+#include <iostream>
+#include <cstring>
+
+using namespace bhd;
+
+
+/// <summary>
+/// Denoising parameters (bilateral filter followed by a median filter)
+/// </summary>
+struct DenoiseConfigurables
+{
+	CIntConfigurable m_iDiameter = {
+		"DIAMETER",
+		u8"Neighborhood diameter",
+		u8"Diameter of each pixel neighborhood that is used during filtering. If it is non-positive, it is computed from sigmaSpace.",
+		5
+	};
+
+	CDoubleConfigurable m_dSigmaColor = {
+		"SIGMA_COLOR",
+		u8"Filter sigma in the color space",
+		u8"A larger value means that farther colors within the pixel neighborhood will be mixed together.",
+		15.0
+	};
+
+	CDoubleConfigurable m_dSigmaSpace = {
+		"SIGMA_SPACE",
+		u8"Filter sigma in the coordinate space",
+		u8"A larger value means that farther pixels will influence each other as long as their colors are close enough.",
+		15.0
+	};
+
+	CIntConfigurable m_iMedianKernel = {
+		"MEDIAN_KERNEL",
+		u8"Median kernel",
+		u8"Aperture of the median filter applied after the bilateral filter (odd, 0 to disable)",
+		3
+	};
+
+	IModule::configurable_register_t ConfigurableList()
+	{
+		return { &m_iDiameter, &m_dSigmaColor, &m_dSigmaSpace, &m_iMedianKernel };
+	}
+};
+
+class DenoiseModule : public CModule<DenoiseConfigurables>
+{
+public:
+
+	DenoiseModule() :
+		CModule("DENOISE", "Denoise filter", "Bilateral filter followed by a median filter.")
+	{	}
+
+	void Execute(const cv::Mat& in, cv::Mat& out) const
+	{
+		cv::Mat src = in;
+		if (src.depth() != CV_8U && src.depth() != CV_32F)
+			src.convertTo(src, CV_32F);
+		if (src.channels() == 4)
+			cv::cvtColor(src, src, cv::COLOR_BGRA2BGR);
+
+		cv::bilateralFilter(src, out, m_iDiameter, m_dSigmaColor, m_dSigmaSpace);
+		if (m_iMedianKernel >= 3)
+			cv::medianBlur(out, out, m_iMedianKernel | 1);
+	}
+};
+
+
+/// <summary>
+/// Usage: MyBatchRunner input_dir [output_dir] [--config denoise.json] [--threads n] [--in-flight n] [--ext .png] [--csv report.csv] [--stop-on-error]
+/// The configuration file is created with the default values if it does not exist.
+/// </summary>
+int main(int argc, char* argv[])
+{
+	if (argc < 2)
+	{
+		std::cout << "Usage: " << argv[0] << " input_dir [output_dir] [--config denoise.json] [--threads n] [--in-flight n] [--ext .png] [--csv report.csv] [--stop-on-error]" << std::endl;
+		return 1;
+	}
+
+	std::filesystem::path input = argv[1];
+	std::filesystem::path config = "denoise.json";
+	std::filesystem::path csv;
+	std::size_t nthreads = std::thread::hardware_concurrency();
+	batch_options options;
+	for (int i = 2; i < argc; i++)
+	{
+		if (std::strcmp(argv[i], "--config") == 0 && i + 1 < argc)
+			config = argv[++i];
+		else if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+			nthreads = std::max(1, std::atoi(argv[++i]));
+		else if (std::strcmp(argv[i], "--in-flight") == 0 && i + 1 < argc)
+			options.m_max_in_flight = std::max(0, std::atoi(argv[++i]));
+		else if (std::strcmp(argv[i], "--ext") == 0 && i + 1 < argc)
+			options.m_output_extension = argv[++i];
+		else if (std::strcmp(argv[i], "--csv") == 0 && i + 1 < argc)
+			csv = argv[++i];
+		else if (std::strcmp(argv[i], "--stop-on-error") == 0)
+			options.m_stop_on_error = true;
+		else if (argv[i][0] != '-')
+			options.m_output_directory = argv[i];
+	}
+
+	thread_pool pool(nthreads);
+
+	//OpenCV loops inside the module run on the same workers (no oversubscription)
+	set_opencv_parallel_backend(pool);
+
+	auto runner = make_batch_runner(
+		[] { return std::make_unique<DenoiseModule>(); },
+		[](const DenoiseModule& module, const cv::Mat& in, cv::Mat& out) { module.Execute(in, out); },
+		options,
+		pool);
+
+	if (auto [status, error] = runner.prototype().ImportOrExportFile(config); status == 0)
+		std::cout << "Configuration " << config << " error: " << error << std::endl;
+	else if (status == 2)
+		std::cout << "Configuration template written: " << config << std::endl;
+
+	runner.set_progress([](const batch_item& item, std::size_t done, std::size_t total) {
+		std::cout << "[" << done << "/" << total << "] " << item.m_input.filename().generic_string()
+			<< (item.ok() ? "" : " FAILED: " + item.m_error) << " (" << item.m_total_ms << " ms)" << std::endl;
+	});
+
+	const auto report = runner.run(input);
+	std::cout << report.to_string();
+	if (!csv.empty())
+		report.write_csv(csv);
+
+	return report.failed() == 0 ? 0 : 2;
+}
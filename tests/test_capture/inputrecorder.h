@@ -7,6 +7,8 @@
 #include <thread>
 #include <Windows.h>
 
+#include "BHM_ThreadPool.h"
+
 class KeyLogger
 {
 public:
@@ -21,8 +23,8 @@ public:
     int m_tick_frequency_ms = 10;
     std::size_t m_tick_count = 0;
 
-    std::atomic_bool m_recording = false;
-    std::thread m_recorder_thread;
+    bhd::timer_handle m_recorder_timer;     //periodic job on the shared thread pool
+    std::string m_recording_file;
 
     auto record() const {
         vk_sequence_t vKeySequence;
@@ -35,9 +37,12 @@ public:
     }
 
     void stop() {
-        m_recording = false;
-        if (m_recorder_thread.joinable())
-            m_recorder_thread.join();
+        if (!m_recorder_timer.active())
+            return;
+        m_recorder_timer.stop();
+
+        std::fstream file(m_recording_file, std::fstream::out | std::fstream::app);
+        file << "end: " << current_date_time() << std::endl;
     }
 
     static auto current_date_time() {
@@ -50,36 +55,28 @@ public:
 
         using clock = std::chrono::high_resolution_clock; //std::chrono::system_clock
         using duration_ms = std::chrono::duration<double, std::milli>;
-        m_recording = true;
-        m_recorder_thread = std::thread([&, filename = std::string(m_filename), freq = m_tick_frequency_ms] 
-        {   
-            std::fstream file;
-            file.open(filename, std::fstream::out | std::fstream::app);
+
+        m_recording_file = std::string(m_filename);
+        {
+            std::fstream file(m_recording_file, std::fstream::out | std::fstream::app);
             file << "start: " << current_date_time() << '\n';
-            file << "tick_frequency: " << freq << std::endl;
-
-            auto start = clock::now();
-            auto delta_clock = [&]() {
-                duration_ms elapsed = clock::now() - start;
-                return elapsed;
-            };
-
-            std::size_t count = 0;
-            while (m_recording) {
-                auto delta = delta_clock();
-                auto key_seq = record();
-                if(!key_seq.empty())
-                {
-                    std::fstream file(filename, std::fstream::out | std::fstream::app);
-                    file << count<<'-'<< delta << ':';
-                    export_sequence(key_seq, file);
-                    file << std::endl;
-                }
-                std::this_thread::sleep_for(duration_ms(freq));
-                count++;
-            };
-
-            file << "end: " << current_date_time() << std::endl;
+            file << "tick_frequency: " << m_tick_frequency_ms << std::endl;
+        }
+
+        //Ticks on a fixed grid (no drift), run by the shared pool instead of a dedicated thread
+        m_recorder_timer = bhd::thread_pool::instance().schedule_every(std::chrono::milliseconds(m_tick_frequency_ms),
+            [this, filename = m_recording_file, start = clock::now(), count = std::size_t(0)]() mutable
+        {
+            duration_ms delta = clock::now() - start;
+            auto key_seq = record();
+            if (!key_seq.empty())
+            {
+                std::fstream file(filename, std::fstream::out | std::fstream::app);
+                file << count << '-' << delta << ':';
+                export_sequence(key_seq, file);
+                file << std::endl;
+            }
+            count++;
         });
 	}
 
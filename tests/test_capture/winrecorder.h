@@ -6,6 +6,8 @@
 #include <thread>
 #include <Windows.h>
 
+#include "BHM_ThreadPool.h"
+
 class WinRecorder
 {
    
@@ -64,8 +66,7 @@ public:
 
 class WinRecorderAsyncLoop
 {
-    std::atomic_bool m_recording = false;
-    std::thread m_recorder_thread;
+    bhd::timer_handle m_recorder_timer;     //periodic job on the shared thread pool
     cv::Mat m_last_screenshoot;
     mutable std::mutex m_mutex;
 
@@ -95,9 +96,10 @@ public:
     };
 
     void stop() {
-        m_recording = false;
-        if (m_recorder_thread.joinable())
-            m_recorder_thread.join();
+        if (!m_recorder_timer.active())
+            return;
+        m_recorder_timer.stop();
+        m_last_screenshoot_time = current_date_time();
     }
 
     static auto current_date_time() {
@@ -108,31 +110,19 @@ public:
     void start() {
         stop();
       
-        using clock = std::chrono::high_resolution_clock; //std::chrono::system_clock
-        using duration_ms = std::chrono::duration<double, std::milli>;
-
         m_tick_count = 0;
-        m_recording = true;
-        m_recorder_thread = std::thread([&, filename = std::string(m_filename), tick_duration = duration_ms(m_tick_frequency_ms)]
+
+        //One screenshot per tick on a fixed grid; a tick still running when the next one is due makes it skipped
+        m_recorder_timer = bhd::thread_pool::instance().schedule_every(std::chrono::milliseconds(m_tick_frequency_ms), [this]
         {
-            std::size_t count = 0;
-            while (m_recording) {
-                auto start = clock::now();
-                auto sn = m_winRecoreder.screenshotWithTarget(m_window_title);
-                if (m_preprocessing) {
-                    m_preprocessing(sn);
-                }
-                {
-                    auto lg = std::lock_guard(m_mutex);
-                    cv::swap(sn, m_last_screenshoot);
-                }
-                duration_ms elapsed = clock::now() - start;
-                if (tick_duration > elapsed)
-                    std::this_thread::sleep_for(tick_duration - elapsed);
-                count++;
-            };
-
-            m_last_screenshoot_time = current_date_time();
+            auto sn = m_winRecoreder.screenshotWithTarget(m_window_title);
+            if (m_preprocessing) {
+                m_preprocessing(sn);
+            }
+            {
+                auto lg = std::lock_guard(m_mutex);
+                cv::swap(sn, m_last_screenshoot);
+            }
         });
     }
 
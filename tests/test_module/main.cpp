@@ -1,4 +1,12 @@
 #include "BHM_ModuleProc.h"
+#include "BHM_ModuleCache.h"
+#include "BHM_ParameterSweep.h"
+#include "BHM_ModuleSnapshot.h"
+#include "BHM_ParameterSnapshot.h"
+#include "BHM_ModuleInstancePool.h"
+#include "BHM_ConfigWatcher.h"
+
+#include <thread>
 
 using namespace bhd;
 
@@ -33,6 +41,8 @@ struct BilateralConfigurables
 		u8"A larger value of the parameter means that farther colors within the pixel"
 		" neighborhood (see sigmaSpace) will be mixed together, resulting in larger areas of semi-equal color.",
 
+		1.0, 150.0,	// optional range [min, max] (used by the parameter sweep)
+
 		15.0
 	};
 
@@ -45,6 +55,8 @@ struct BilateralConfigurables
 		"long as their colors are close enough (see sigmaColor ). When d>0, it specifies the neighborhood "
 		"size regardless of sigmaSpace. Otherwise, d is proportional to sigmaSpace.",
 
+		1.0, 150.0,
+
 		15.0
 	};
 
@@ -76,7 +88,8 @@ struct BilateralConfigurables
 };
 
 
-class BilateralModule : public CModule<BilateralConfigurables>
+//TCloneable: bilateral.Clone() creates an independent copy (see module_instance_pool)
+class BilateralModule : public TCloneable<BilateralModule, CModule<BilateralConfigurables>>
 {
 	//An another configurable.
 	//Generally it is preferable declare this one also in a structure
@@ -93,7 +106,7 @@ public:
 	BilateralModule() :
 		//Set the bilateral module with a new key, info, blurb.
 		//The registration of configurables is automatically performed by call BilateralConfigurables::List() function
-		CModule(
+		TCloneable(
 			"BILATERAL",									    //Key
 			"Bilateral filter",									//Info
 			"Applies the bilateral filter to an image."			//Blurb
@@ -142,6 +155,91 @@ int main(int argc, char* argv[])
 
 	bilateral.ImportOrExportFile("bilateral.json");
 
+	//Lookup by path: overrides from the command line (ex: test_module SIGMA_COLOR=20 BILATERAL/DIAMETER=7)
+	std::vector<std::pair<std::string, std::string>> overrides;
+	for (int i = 1; i < argc; i++)
+		if (const std::string_view arg = argv[i]; arg.find('=') != std::string_view::npos)
+			overrides.emplace_back(arg.substr(0, arg.find('=')), arg.substr(arg.find('=') + 1));
+	for (const auto& path : bilateral.ApplyConfigurableValues(overrides))
+		std::cout << "Unknown configurable: " << path << std::endl;
+	std::cout << "SIGMA_COLOR = " << bilateral.GetConfigurableValue("SIGMA_COLOR").value_or("?") << std::endl;
+
+	//Binary snapshot: the same state as bilateral.json, compact and fast to write / read
+	module_snapshot snapshot(bilateral);
+	snapshot.save("bilateral.bhms");
+	BilateralModule restored;
+	module_snapshot::load("bilateral.bhms").apply(restored);
+	std::cout << snapshot.size() << " configurables, " << snapshot.bytes().size() << " bytes, same state: " << (restored.StateHash() == bilateral.StateHash()) << std::endl;
+
+	//Change tracking: rerun only when a parameter changed since the last run
+	const auto last_run = IConfigurable::CurrentGeneration();
+	bilateral.m_dSigmaSpace = 20.0;
+	if (bilateral.ChangedSince(last_run))
+		for (const auto& path : bilateral.ChangesSince(last_run))
+			std::cout << "Changed: " << path << std::endl;
+
+	//Parameter snapshots: a running task reads the parameter set of its launch while the module is edited
+	parameter_publisher publisher(bilateral);
+	std::thread task([params = publisher.acquire(), &bilateral] {
+		std::cout << "Task diameter: " << params->get(bilateral.m_iDiameter) << std::endl;
+	});
+	bilateral.m_iDiameter = 9;		//Not seen by the running task
+	publisher.publish();			//Seen by the next ones
+	task.join();
+
+	//Per-thread instances: each worker runs its own clone of bilateral, synced only when bilateral changes
+	module_instance_pool instances;
+	std::vector<cv::Mat> outputs(8);
+	thread_pool::instance().enqueue_n(outputs.size(), [&](std::size_t i) {
+		instances.local(bilateral).Execute(in, outputs[i]);
+	}).wait();
+	std::cout << instances.stats().to_string() << std::endl;
+
+	//Hot reload: edit bilateral.json while the frames are processed, the new values are swapped in between two frames
+	config_watcher watcher(bilateral, "bilateral.json");
+	for (int frame = 0; frame < 20; frame++)
+	{
+		if (auto reload = watcher.apply())
+			std::cout << reload->to_string() << std::endl;
+		bilateral.Execute(in, out);
+	}
+
+	//Memoization: the second run with the same parameters and input is served by the cache
+	module_cache cache(64 << 20);
+	auto execute = [&bilateral](const cv::Mat& in, cv::Mat& out) { bilateral.Execute(in, out); };
+	cache.get_or_compute(bilateral, in, execute);
+	cache.get_or_compute(bilateral, in, execute);
+	bilateral.m_dSigmaColor = 30.0;		//New state: computed again
+	cache.get_or_compute(bilateral, in, execute);
+	std::cout << cache.stats().to_string() << std::endl;
+
+	//A result sharing its input buffer is not recognized by its address: the input can be refilled in place (capture buffer)
+	cv::Mat frame(64, 64, CV_8UC3, cv::Scalar::all(10));
+	cache.get_or_compute(bilateral, frame, [](const cv::Mat& in, cv::Mat& out) { out = in; });
+	frame.setTo(cv::Scalar::all(20));
+	std::cout << "Refilled frame hashed again: " << (cache.make_key(bilateral, frame).m_input == mat_hash(frame)) << std::endl;
+
+	//Parameter sweep: find the sigmas restoring best a noisy image (each worker runs its own BilateralModule)
+	cv::Mat clean(256, 128, CV_8UC3, cv::Scalar(40, 120, 200)), noise(clean.size(), CV_16SC3), noisy;
+	cv::randn(noise, 0.0, 12.0);
+	cv::add(clean, noise, noisy, cv::noArray(), CV_8U);
+
+	auto sweep = make_parameter_sweep(
+		[] { return std::make_unique<BilateralModule>(); },
+		[&clean](BilateralModule& module, const std::vector<cv::Mat>& images) {
+			double error = 0.0;
+			for (const auto& image : images)
+				error += cv::norm(module.Execute(image), clean, cv::NORM_L2SQR);
+			return error / static_cast<double>(images.size());
+		});
+	sweep.set_maximize(false);
+	sweep.add_parameter("SIGMA_COLOR").add_parameter("SIGMA_SPACE", 1.0, 50.0);
+	auto report = sweep.run({ noisy }, SWEEP_SAMPLING::LATIN_HYPERCUBE, 32);
+	std::cout << report.to_string(5);
+	report.write_csv("bilateral_sweep.csv");
+	if (const auto* best = report.best())
+		sweep.apply(*best, bilateral);
+
 	return 0;
 
 }
\ No newline at end of file
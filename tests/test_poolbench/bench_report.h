@@ -0,0 +1,79 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <filesystem>
+
+/// <summary>
+/// Results of the benchmark suite: one record per measure, printed as a table and written as JSON / CSV
+/// so that two runs (before / after a pool change) can be compared with a script.
+/// </summary>
+class bench_report
+{
+public:
+
+	struct record
+	{
+		std::string m_bench;	//Benchmark name ("enqueue_latency", "granularity"...)
+		std::string m_pool;		//Pool implementation ("bhd", "legacy")
+		std::size_t m_threads = 0;
+		std::string m_param;	//Benchmark parameter ("task=100us", "producers=4"...)
+		std::string m_metric;	//Measured quantity ("p50", "throughput"...)
+		double m_value = 0.0;
+		std::string m_unit;		//"ns", "tasks/s", "%"...
+	};
+
+	void add(record r)
+	{
+		std::cout << std::left << std::setw(20) << r.m_bench << std::setw(8) << r.m_pool << std::right << std::setw(4) << r.m_threads << "  "
+			<< std::left << std::setw(16) << r.m_param << std::setw(14) << r.m_metric << std::right
+			<< std::fixed << std::setprecision(r.m_value < 100.0 ? 2 : 0) << std::setw(14) << r.m_value << " " << r.m_unit << std::endl;
+		m_records.push_back(std::move(r));
+	}
+
+	const std::vector<record>& records() const noexcept { return m_records; }
+
+	void write_json(const std::filesystem::path& path) const
+	{
+		std::ofstream file(path);
+		file << "{\n  \"hardware_concurrency\": " << std::thread::hardware_concurrency()
+			<< ",\n  \"timestamp\": " << std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count()
+			<< ",\n  \"results\": [\n";
+		file << std::setprecision(6);
+		for (std::size_t i = 0; i < m_records.size(); i++)
+		{
+			const auto& r = m_records[i];
+			file << "    {\"bench\": \"" << r.m_bench << "\", \"pool\": \"" << r.m_pool << "\", \"threads\": " << r.m_threads
+				<< ", \"param\": \"" << r.m_param << "\", \"metric\": \"" << r.m_metric << "\", \"value\": " << r.m_value
+				<< ", \"unit\": \"" << r.m_unit << "\"}" << (i + 1 < m_records.size() ? "," : "") << "\n";
+		}
+		file << "  ]\n}\n";
+	}
+
+	void write_csv(const std::filesystem::path& path) const
+	{
+		std::ofstream file(path);
+		file << "bench,pool,threads,param,metric,value,unit\n" << std::setprecision(6);
+		for (const auto& r : m_records)
+			file << r.m_bench << "," << r.m_pool << "," << r.m_threads << "," << r.m_param << "," << r.m_metric << "," << r.m_value << "," << r.m_unit << "\n";
+	}
+
+private:
+	std::vector<record> m_records;
+};
+
+//! Percentile of a sample set (sorted in place)
+inline double percentile(std::vector<double>& values, double p)
+{
+	if (values.empty())
+		return 0.0;
+	std::sort(values.begin(), values.end());
+	const std::size_t i = std::min(values.size() - 1, static_cast<std::size_t>(p * static_cast<double>(values.size())));
+	return values[i];
+}
@@ -0,0 +1,369 @@
+#include <iostream>
+#include <iomanip>
+#include <queue>
+#include <latch>
+#include <chrono>
+#include <future>
+#include <functional>
+#include <string>
+#include <cstring>
+
+#include "BHM_ThreadPool.h"
+#include "BHM_TaskGraph.h"
+
+#include "bench_report.h"
+
+/// <summary>
+/// Reference pool: the former bhd::thread_pool implementation (single queue, single mutex, single condition variable).
+/// Kept here only to compare the work-stealing scheduler against it.
+/// </summary>
+namespace legacy
+{
+	class thread_pool
+	{
+		std::vector< std::thread > m_workers;
+		std::queue< std::function<void()> > m_tasks;
+		std::mutex m_queue_mutex;
+		std::condition_variable m_condition;
+		bool m_stop = false;
+
+	public:
+
+		thread_pool(size_t threads)
+		{
+			for (size_t i = 0; i < threads; ++i)
+			{
+				m_workers.emplace_back([this]
+					{
+						for (;;)
+						{
+							std::function<void()> task;
+							{
+								std::unique_lock<std::mutex> lock(m_queue_mutex);
+								m_condition.wait(lock, [this] { return m_stop || !m_tasks.empty(); });
+								if (m_stop && m_tasks.empty())
+									return;
+								task = std::move(m_tasks.front());
+								m_tasks.pop();
+							}
+							task();
+						}
+					});
+			}
+		}
+
+		~thread_pool()
+		{
+			{
+				const std::lock_guard<std::mutex> lock(m_queue_mutex);
+				m_stop = true;
+			}
+			m_condition.notify_all();
+			for (std::thread& worker : m_workers)
+				worker.join();
+		}
+
+		//Former threaded_task packaging (packaged_task + shared state + std::function)
+		template<class F>
+		auto enqueue(F&& f)
+		{
+			using result_t = std::invoke_result_t<F>;
+			using packaged_result_t = std::packaged_task<result_t()>;
+			using atomic_task_t = std::pair<std::atomic_bool, packaged_result_t>;
+
+			auto a_task = std::make_shared<atomic_task_t>(false, packaged_result_t(std::forward<F>(f)));
+			auto future = a_task->second.get_future();
+			{
+				const std::lock_guard<std::mutex> lock(m_queue_mutex);
+				m_tasks.emplace([a_task]() mutable {
+					if (a_task->first.exchange(true) == false)
+						a_task->second();
+				});
+			}
+			m_condition.notify_one();
+			return future;
+		}
+	};
+}
+
+namespace
+{
+	using clock = std::chrono::high_resolution_clock;
+
+	//Tiny amount of work (~ a few hundreds of ns), as a small image tile would do
+	inline void spin_work(int n)
+	{
+		volatile int acc = 0;
+		for (int i = 0; i < n; i++)
+			acc = acc + i;
+	}
+
+	/// <summary>
+	/// Flat fan-out: the main thread submits all the tasks.
+	/// </summary>
+	/// <returns>Throughput in tasks per second</returns>
+	template<class TPool>
+	double bench_flat(TPool& pool, int ntasks, int work)
+	{
+		std::latch done(ntasks);
+		auto start = clock::now();
+		for (int i = 0; i < ntasks; i++)
+			pool.enqueue([&done, work] { spin_work(work); done.count_down(); });
+		done.wait();
+		std::chrono::duration<double> span = clock::now() - start;
+		return ntasks / span.count();
+	}
+
+	/// <summary>
+	/// Flat fan-out submitted as one batch (single queue lock, single round of wake-ups).
+	/// </summary>
+	/// <returns>Throughput in tasks per second</returns>
+	double bench_bulk(bhd::thread_pool& pool, int ntasks, int work)
+	{
+		std::latch done(ntasks);
+		auto start = clock::now();
+		auto group = pool.enqueue_n(ntasks, [&done, work](std::size_t) { spin_work(work); done.count_down(); });
+		done.wait();
+		std::chrono::duration<double> span = clock::now() - start;
+		return ntasks / span.count();
+	}
+
+	/// <summary>
+	/// Nested fan-out: a few root tasks each submit their own tiles from inside the pool.
+	/// This is the case where local deques and stealing help the most.
+	/// </summary>
+	/// <returns>Throughput in tasks per second</returns>
+	template<class TPool>
+	double bench_nested(TPool& pool, int nroots, int ntiles, int work)
+	{
+		std::latch done(static_cast<std::ptrdiff_t>(nroots) * ntiles);
+		auto start = clock::now();
+		for (int r = 0; r < nroots; r++)
+		{
+			pool.enqueue([&pool, &done, ntiles, work] {
+				for (int i = 0; i < ntiles; i++)
+					pool.enqueue([&done, work] { spin_work(work); done.count_down(); });
+			});
+		}
+		done.wait();
+		std::chrono::duration<double> span = clock::now() - start;
+		return (static_cast<double>(nroots) * ntiles) / span.count();
+	}
+
+	//Busy wait (no sleep: a sleeping task does not load the cores)
+	inline void spin_for(std::chrono::nanoseconds duration)
+	{
+		const auto end = clock::now() + duration;
+		while (clock::now() < end) {}
+	}
+
+	inline double elapsed_ns(clock::time_point start, clock::time_point end) {
+		return std::chrono::duration<double, std::nano>(end - start).count();
+	}
+
+	/// <summary>
+	/// Enqueue latency: cost of the enqueue call in the producer, and time from the enqueue to the task start
+	/// (wake-up included: the pool is idle before each sample).
+	/// </summary>
+	void bench_latency(bench_report& report, std::size_t nthreads, int nsamples)
+	{
+		bhd::thread_pool pool(nthreads);
+		std::vector<double> call_ns, start_ns;
+		call_ns.reserve(nsamples);
+		start_ns.reserve(nsamples);
+
+		for (int i = 0; i < nsamples; i++)
+		{
+			std::atomic<clock::rep> started = 0;
+			const auto before = clock::now();
+			pool.enqueue([&started] { started = clock::now().time_since_epoch().count(); });
+			const auto after = clock::now();
+			//Not get(): it would run the task in this thread if no worker has taken it yet
+			while (started.load() == 0)
+				std::this_thread::yield();
+			call_ns.push_back(elapsed_ns(before, after));
+			start_ns.push_back(elapsed_ns(before, clock::time_point(clock::duration(started.load()))));
+
+			//Let the workers park again
+			std::this_thread::sleep_for(std::chrono::microseconds(200));
+		}
+
+		report.add({ "enqueue_latency", "bhd", nthreads, "idle", "call_p50", percentile(call_ns, 0.5), "ns" });
+		report.add({ "enqueue_latency", "bhd", nthreads, "idle", "call_p99", percentile(call_ns, 0.99), "ns" });
+		report.add({ "enqueue_latency", "bhd", nthreads, "idle", "start_p50", percentile(start_ns, 0.5), "ns" });
+		report.add({ "enqueue_latency", "bhd", nthreads, "idle", "start_p99", percentile(start_ns, 0.99), "ns" });
+	}
+
+	/// <summary>
+	/// Empty tasks: pure scheduling overhead, one by one and as a batch.
+	/// </summary>
+	void bench_empty(bench_report& report, std::size_t nthreads, int ntasks)
+	{
+		{
+			legacy::thread_pool pool(nthreads);
+			report.add({ "empty_tasks", "legacy", nthreads, "enqueue", "throughput", bench_flat(pool, ntasks, 0), "tasks/s" });
+		}
+		bhd::thread_pool pool(nthreads);
+		report.add({ "empty_tasks", "bhd", nthreads, "enqueue", "throughput", bench_flat(pool, ntasks, 0), "tasks/s" });
+		report.add({ "empty_tasks", "bhd", nthreads, "enqueue_n", "throughput", bench_bulk(pool, ntasks, 0), "tasks/s" });
+	}
+
+	/// <summary>
+	/// Fan-out / fan-in: a round queues 'width' small tasks and joins them (when_all), as a module splitting an image does.
+	/// </summary>
+	void bench_fanout(bench_report& report, std::size_t nthreads, int nrounds)
+	{
+		bhd::thread_pool pool(nthreads);
+		for (int width : { 8, 64, 512 })
+		{
+			std::vector<double> round_ns;
+			round_ns.reserve(nrounds);
+			for (int r = 0; r < nrounds; r++)
+			{
+				const auto start = clock::now();
+				std::vector<bhd::threaded_task<void>> tasks;
+				tasks.reserve(width);
+				for (int i = 0; i < width; i++)
+					tasks.push_back(pool.enqueue([] { spin_work(200); }));
+				bhd::when_all(std::move(tasks)).get();
+				round_ns.push_back(elapsed_ns(start, clock::now()));
+			}
+			const std::string param = "width=" + std::to_string(width);
+			report.add({ "fanout_fanin", "bhd", nthreads, param, "round_p50", percentile(round_ns, 0.5) * 1e-3, "us" });
+			report.add({ "fanout_fanin", "bhd", nthreads, param, "round_p99", percentile(round_ns, 0.99) * 1e-3, "us" });
+		}
+	}
+
+	/// <summary>
+	/// Task granularity: a fixed amount of busy work cut in tasks of 1us to 10ms.
+	/// Efficiency = ideal time (work / threads) / measured time.
+	/// </summary>
+	void bench_granularity(bench_report& report, std::size_t nthreads, std::chrono::milliseconds total_work)
+	{
+		bhd::thread_pool pool(nthreads);
+		const std::pair<const char*, std::chrono::nanoseconds> grains[] = {
+			{ "task=1us", std::chrono::microseconds(1) }, { "task=10us", std::chrono::microseconds(10) }, { "task=100us", std::chrono::microseconds(100) },
+			{ "task=1ms", std::chrono::milliseconds(1) }, { "task=10ms", std::chrono::milliseconds(10) } };
+
+		for (const auto& [name, grain] : grains)
+		{
+			const auto ntasks = std::max<std::size_t>(nthreads, static_cast<std::size_t>(std::chrono::nanoseconds(total_work) / grain));
+			//Joined with a latch: group.wait() would make this thread run tasks too
+			std::latch done(static_cast<std::ptrdiff_t>(ntasks));
+			const auto start = clock::now();
+			auto group = pool.enqueue_n(ntasks, [grain, &done](std::size_t) { spin_for(grain); done.count_down(); });
+			done.wait();
+			const double measured = elapsed_ns(start, clock::now());
+			const double ideal = static_cast<double>(ntasks) * static_cast<double>(grain.count()) / static_cast<double>(nthreads);
+			report.add({ "granularity", "bhd", nthreads, name, "efficiency", 100.0 * ideal / measured, "%" });
+		}
+	}
+
+	/// <summary>
+	/// Contention: several producer threads enqueue at the same time (injection queue and wake-ups under pressure).
+	/// </summary>
+	void bench_producers(bench_report& report, std::size_t nthreads, int ntasks)
+	{
+		for (int nproducers : { 1, 2, 4, 8 })
+		{
+			bhd::thread_pool pool(nthreads);
+			std::latch done(ntasks);
+			std::latch ready(nproducers + 1);
+			const int per_producer = ntasks / nproducers;
+
+			std::vector<std::thread> producers;
+			for (int p = 0; p < nproducers; p++)
+				producers.emplace_back([&, p] {
+					const int count = p + 1 == nproducers ? ntasks - per_producer * p : per_producer;
+					ready.arrive_and_wait();
+					for (int i = 0; i < count; i++)
+						pool.enqueue([&done] { spin_work(50); done.count_down(); });
+				});
+
+			ready.arrive_and_wait();
+			const auto start = clock::now();
+			done.wait();
+			const double span = elapsed_ns(start, clock::now());
+			for (auto& producer : producers)
+				producer.join();
+
+			report.add({ "producers", "bhd", nthreads, "producers=" + std::to_string(nproducers), "throughput", ntasks / (span * 1e-9), "tasks/s" });
+		}
+	}
+}
+
+
+
+/// <summary>
+/// Usage: MyThreadPoolBench [--quick] [--json results.json] [--csv results.csv] [--only bench]
+/// bench: throughput, latency, empty, fanout, granularity, producers
+/// </summary>
+int main(int argc, char* argv[])
+{
+	bool quick = false;
+	std::string json_path, csv_path, only;
+	for (int i = 1; i < argc; i++)
+	{
+		if (std::strcmp(argv[i], "--quick") == 0)
+			quick = true;
+		else if (std::strcmp(argv[i], "--json") == 0 && i + 1 < argc)
+			json_path = argv[++i];
+		else if (std::strcmp(argv[i], "--csv") == 0 && i + 1 < argc)
+			csv_path = argv[++i];
+		else if (std::strcmp(argv[i], "--only") == 0 && i + 1 < argc)
+			only = argv[++i];
+	}
+	auto enabled = [&only](const char* bench) { return only.empty() || only == bench; };
+
+	const int NTASKS = quick ? 20000 : 200000;
+	constexpr int NROOTS = 64;
+	const int NTILES = NTASKS / NROOTS;
+	constexpr int WORK = 200;
+
+	const std::size_t max_threads = std::max(1u, std::thread::hardware_concurrency());
+	std::vector<std::size_t> thread_counts;
+	for (std::size_t nthreads = 1; ; nthreads = std::min(nthreads * 2, max_threads))
+	{
+		thread_counts.push_back(nthreads);
+		if (nthreads == max_threads)
+			break;
+	}
+
+	bench_report report;
+	for (std::size_t nthreads : thread_counts)
+	{
+		//Work-stealing scheduler against the former single queue pool, small tasks
+		if (enabled("throughput"))
+		{
+			{
+				legacy::thread_pool pool(nthreads);
+				report.add({ "throughput", "legacy", nthreads, "flat", "throughput", bench_flat(pool, NTASKS, WORK), "tasks/s" });
+				report.add({ "throughput", "legacy", nthreads, "nested", "throughput", bench_nested(pool, NROOTS, NTILES, WORK), "tasks/s" });
+			}
+			{
+				bhd::thread_pool pool(nthreads);
+				report.add({ "throughput", "bhd", nthreads, "flat", "throughput", bench_flat(pool, NTASKS, WORK), "tasks/s" });
+				report.add({ "throughput", "bhd", nthreads, "bulk", "throughput", bench_bulk(pool, NTASKS, WORK), "tasks/s" });
+				report.add({ "throughput", "bhd", nthreads, "nested", "throughput", bench_nested(pool, NROOTS, NTILES, WORK), "tasks/s" });
+			}
+		}
+
+		if (enabled("latency"))
+			bench_latency(report, nthreads, quick ? 200 : 2000);
+		if (enabled("empty"))
+			bench_empty(report, nthreads, NTASKS);
+		if (enabled("fanout"))
+			bench_fanout(report, nthreads, quick ? 50 : 500);
+		if (enabled("granularity"))
+			bench_granularity(report, nthreads, std::chrono::milliseconds(quick ? 50 : 500));
+		if (enabled("producers"))
+			bench_producers(report, nthreads, NTASKS);
+	}
+
+	if (!json_path.empty())
+		report.write_json(json_path);
+	if (!csv_path.empty())
+		report.write_csv(csv_path);
+
+	return 0;
+}
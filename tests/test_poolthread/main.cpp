@@ -1,8 +1,16 @@
 
 #include <iostream>
 #include <mutex>
+#include <vector>
 
 #include "BHM_ThreadPool.h"
+#include "BHM_TaskGraph.h"
+#include "BHM_TopologyPool.h"
+#include "BHM_Coroutine.h"
+#include "BHM_PoolMonitor.h"
+#include "BHM_ScratchArena.h"
+#include "BHM_OpenCVBackend.h"
+#include "BHM_StagePipeline.h"
 
 //Make cout thread safe
 std::mutex m_safe_cout;
@@ -169,6 +177,439 @@ void TryDeadLock()
 
 
 
+/// <summary>
+/// Recursive fan-out: every task enqueues a sub task and waits for it.
+/// Waiting workers run the pending tasks meanwhile, so a deep recursion never starves the 2 threads.
+/// </summary>
+long NestedFibonacci(bhd::thread_pool& pool, int n)
+{
+	if (n < 2)
+		return n;
+	auto sub = pool.enqueue(NestedFibonacci, std::ref(pool), n - 1);
+	long other = NestedFibonacci(pool, n - 2);
+	return sub.get() + other;
+}
+
+void NestedTasks()
+{
+	std::cout << "Nested tasks:" << std::endl;
+	auto& pool = bhd::thread_pool::instance(2);
+	auto fib = pool.enqueue(NestedFibonacci, std::ref(pool), 20);
+	long result = fib.get();	//Not inside safe_cout: the lock would be held while waiting
+	safe_cout("Fibonacci(20) = " << result);
+}
+
+
+/// <summary>
+/// Parallel loops
+/// Split a range over the pool, the calling thread takes part in the loop.
+/// </summary>
+void ParallelLoops()
+{
+	std::cout << "Parallel loops:" << std::endl;
+
+	auto& pool = bhd::thread_pool::instance(2);
+
+	std::vector<float> values(100000);
+
+	//One call per index, automatic chunking
+	pool.parallel_for(0, static_cast<int>(values.size()), [&](int i) {
+		values[i] = 0.5f * i;
+	});
+
+	//One call per chunk of 1000 indices
+	pool.parallel_for(0, static_cast<int>(values.size()), 1000, [&](int begin, int end) {
+		for (int i = begin; i < end; i++)
+			values[i] += 1.0f;
+	});
+
+	//Reduction (partial sums are combined in the chunk order)
+	double sum = pool.parallel_reduce(0, static_cast<int>(values.size()), 0, 0.0,
+		[&](int i) { return static_cast<double>(values[i]); },
+		std::plus<>{});
+
+	safe_cout("Parallel reduce sum: " << sum);
+}
+
+void Continuations()
+{
+	bhd::thread_pool& pool = bhd::thread_pool::instance();
+
+	//then: the continuation is enqueued when the task is done, nobody waits in between
+	bhd::threaded_task<int> count(
+		[] { ThreadVerbose v("Count"); return 21; });
+	pool.enqueue(count);
+	auto doubled = count.then([](int n) { return 2 * n; })
+		.then([](int n) { return std::to_string(n); });
+	std::string text = doubled.get();
+	safe_cout("then: " << text);
+
+	//when_all: fan-in of several tiles
+	std::vector<bhd::threaded_task<int>> tiles;
+	for (int i = 0; i < 8; i++)
+		tiles.push_back(pool.enqueue([i] { return i * i; }));
+	int total = 0;
+	for (auto& tile : when_all(std::move(tiles)).get())
+		total += tile.get();
+	safe_cout("when_all sum of squares: " << total);
+
+	//when_any: first finished task
+	std::vector<bhd::threaded_task<int>> racers;
+	racers.push_back(pool.enqueue([] { thread_sleep(1); return 0; }));
+	racers.push_back(pool.enqueue([] { return 1; }));
+	auto first = when_any(std::move(racers)).get();
+	safe_cout("when_any first: " << first.m_index);
+
+	//Graph of a module-like pipeline: load -> (denoise, threshold) -> merge
+	std::vector<float> image(1 << 16, 1.0f);
+	float denoised = 0.0f, thresholded = 0.0f, merged = 0.0f;
+	bhd::task_graph graph;
+	auto load = graph.emplace([&] { for (auto& px : image) px *= 0.5f; });
+	auto denoise = graph.emplace([&] { for (float px : image) denoised += px; });
+	auto threshold = graph.emplace([&] { for (float px : image) thresholded += px > 0.25f ? 1.0f : 0.0f; });
+	auto merge = graph.emplace([&] { merged = denoised + thresholded; });
+	graph.precede(load, denoise);
+	graph.precede(load, threshold);
+	graph.precede(denoise, merge);
+	graph.precede(threshold, merge);
+	graph.run(pool).get();
+	safe_cout("Graph result: " << merged);
+}
+
+/// <summary>
+/// Priorities and cancellation
+/// Batch jobs run at low priority, the live previews jump ahead of them.
+/// A new preview cancels the stale one, which is dropped if it has not started yet.
+/// </summary>
+void PrioritiesAndCancellation()
+{
+	std::cout << "Priorities and cancellation:" << std::endl;
+	auto& pool = bhd::thread_pool::instance(2);
+
+	bhd::task_options background;
+	background.m_priority = bhd::TASK_PRIORITY::LOW;
+	std::vector<bhd::threaded_task<int>> batch;
+	for (int i = 0; i < 8; i++)
+		batch.push_back(pool.enqueue(background, [i] { thread_sleep(1); return i; }));
+
+	bhd::cancellation_token token;
+	auto preview = [](const bhd::cancellation_token& token, int param) {
+		for (int step = 0; step < 10; step++) {
+			token.throw_if_cancelled();	//Polling point of a running task
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		}
+		return param;
+	};
+
+	bhd::task_options interactive;
+	interactive.m_priority = bhd::TASK_PRIORITY::HIGH;
+	interactive.m_token = token;
+	auto stale = pool.enqueue(interactive, preview, token, 1);
+	token.cancel();
+	token = bhd::cancellation_token();
+	interactive.m_token = token;
+	auto latest = pool.enqueue(interactive, preview, token, 2);
+
+	//Deadline: a preview still queued after 1 ms is useless
+	bhd::task_options short_lived;
+	short_lived.m_deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(1);
+	auto expired = pool.enqueue(short_lived, preview, token, 3);
+
+	try {
+		stale.get();
+	}
+	catch (const bhd::task_cancelled& e) {
+		safe_cout("Stale preview: " << e.what());
+	}
+	int result = latest.get();
+	safe_cout("Latest preview: " << result);
+	std::this_thread::sleep_for(std::chrono::milliseconds(5));
+	try {
+		expired.get();
+	}
+	catch (const bhd::task_cancelled& e) {
+		safe_cout("Expired preview: " << e.what());
+	}
+
+	for (auto& job : batch)
+		job.get();
+}
+
+/// <summary>
+/// CPU topology
+/// One sub-pool per NUMA node, workers named and kept on the CPUs of their node.
+/// </summary>
+void Topology()
+{
+	std::cout << "Topology:" << std::endl;
+
+	const auto l3 = bhd::cpu_domains(bhd::CPU_DOMAIN::L3_CACHE);
+	safe_cout("L3 domains: " << l3.size());
+
+	bhd::topology_pool pools(bhd::CPU_DOMAIN::NUMA_NODE);
+	std::vector<bhd::threaded_task<int>> tasks;
+	constexpr std::size_t NTILES = 16;
+	for (std::size_t i = 0; i < NTILES; i++)
+		tasks.push_back(pools.enqueue(pools.domain_of(i, NTILES), [&pools] { return pools.current_domain(); }));
+	for (std::size_t i = 0; i < NTILES; i++) {
+		int domain = tasks[i].get();
+		safe_cout("Tile " << i << " ran on NUMA domain " << domain << " / " << pools.size());
+	}
+}
+
+/// <summary>
+/// Bounded queue
+/// A fast producer (frame grabber) feeds a slow consumer: the pool holds at most 4 queued frames.
+/// With DROP_OLDEST, the stale frames are dropped instead of slowing down the grabber.
+/// The parallel loops are not bounded: the full queue neither refuses their helpers nor drops frames for them.
+/// </summary>
+void BoundedQueue()
+{
+	std::cout << "Bounded queue:" << std::endl;
+
+	for (auto policy : { bhd::OVERFLOW_POLICY::BLOCK, bhd::OVERFLOW_POLICY::DROP_OLDEST })
+	{
+		bhd::thread_pool_options options;
+		options.m_threads = 2;
+		options.m_capacity = 4;
+		options.m_overflow = policy;
+		bhd::thread_pool pool(options);
+
+		std::vector<bhd::threaded_task<int>> frames;
+		for (int i = 0; i < 32; i++) {
+			std::vector<float> frame(1 << 16, static_cast<float>(i));	//Captured data, released once processed or dropped
+			frames.push_back(pool.enqueue([frame = std::move(frame), i] {
+				std::this_thread::sleep_for(std::chrono::milliseconds(5));
+				return i;
+			}));
+		}
+
+		std::atomic<int> rows = 0;
+		pool.parallel_for(0, 256, [&](int) { rows++; });		//Queue full meanwhile
+
+		int processed = 0, dropped = 0;
+		for (auto& frame : frames) {
+			try {
+				frame.get();
+				processed++;
+			}
+			catch (const bhd::task_cancelled&) {
+				dropped++;
+			}
+		}
+		safe_cout((policy == bhd::OVERFLOW_POLICY::BLOCK ? "BLOCK" : "DROP_OLDEST") << ": processed " << processed << ", dropped " << dropped << ", rows " << rows);
+	}
+}
+
+double pool_sum(const std::vector<float>& values)
+{
+	return bhd::thread_pool::instance().parallel_reduce(std::size_t(0), values.size(), std::size_t(0), 0.0,
+		[&](std::size_t i) { return static_cast<double>(values[i]); },
+		std::plus<>{});
+}
+
+/// <summary>
+/// Coroutines
+/// A read -> compute -> save flow written linearly. No thread is held while a step waits for another one.
+/// </summary>
+bhd::task<std::size_t> ProcessCube(bhd::thread_pool& pool, int id)
+{
+	co_await pool.schedule();	//Continue on a worker
+
+	//"Read" (I/O)
+	std::vector<float> cube(1 << 16, static_cast<float>(id));
+	std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+	//Compute on the pool, the coroutine is suspended meanwhile
+	double sum = co_await pool.enqueue([&cube] {
+		return pool_sum(cube);
+	});
+
+	//"Save"
+	safe_cout("Cube " << id << " sum " << sum);
+	co_return cube.size();
+}
+
+void Coroutines()
+{
+	std::cout << "Coroutines:" << std::endl;
+	auto& pool = bhd::thread_pool::instance(2);
+
+	//Start several flows, then wait for all of them
+	std::vector<bhd::threaded_task<std::size_t>> flows;
+	for (int id = 0; id < 4; id++)
+		flows.push_back(bhd::spawn(ProcessCube(pool, id)));
+	std::size_t total = 0;
+	for (auto& flow : flows)
+		total += flow.get();
+	safe_cout("Processed values: " << total);
+
+	//Blocking bridge from synchronous code
+	std::size_t size = bhd::sync_wait(ProcessCube(pool, 4));
+	safe_cout("Single flow values: " << size);
+}
+
+void Instrumentation()
+{
+	std::cout << "Instrumentation:" << std::endl;
+
+	bhd::thread_pool_options options;
+	options.m_threads = 4;
+	options.m_stats = bhd::POOL_STATS::TRACE;
+	bhd::thread_pool pool(options);
+
+	{
+		//Report every 100ms, Chrome trace written at the end of the scope (open it in chrome://tracing)
+		bhd::pool_monitor monitor(pool, std::chrono::milliseconds(100), &bhd::logging::Logger(), "pool_trace.json");
+
+		std::vector<bhd::threaded_task<int>> tasks;
+		for (int i = 0; i < 64; i++)
+			tasks.push_back(pool.enqueue([i] {
+				std::this_thread::sleep_for(std::chrono::milliseconds(1 + i % 7));
+				return i;
+			}));
+		for (auto& task : tasks)
+			task.get();
+		std::this_thread::sleep_for(std::chrono::milliseconds(150));
+	}
+
+	const bhd::pool_stats stats = pool.stats();
+	safe_cout(stats.to_string());
+	safe_cout("Latency p99: " << stats.m_latency.percentile_ms(0.99) << " ms, duration p50: " << stats.m_duration.percentile_ms(0.5) << " ms");
+}
+
+void Timers()
+{
+	std::cout << "Timers:" << std::endl;
+	bhd::thread_pool pool(2);
+	const auto start = std::chrono::steady_clock::now();
+	auto elapsed_ms = [start] {
+		return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+	};
+
+	//One-shot: get() waits for the due time, it never runs the task early
+	auto delayed = pool.schedule_after(std::chrono::milliseconds(50), [&] { return elapsed_ms(); });
+	safe_cout("Delayed task ran after " << delayed.get() << " ms (50 expected)");
+
+	//Periodic samplers sharing the pool workers. The slow one keeps its grid: late ticks are skipped, not shifted
+	std::atomic_int fast_ticks = 0;
+	bhd::timer_handle fast = pool.schedule_every(std::chrono::milliseconds(10), [&] { fast_ticks++; });
+	bhd::timer_handle slow = pool.schedule_every(std::chrono::milliseconds(20), [] { std::this_thread::sleep_for(std::chrono::milliseconds(30)); });
+	bhd::timer_handle failing = pool.schedule_every(std::chrono::milliseconds(10), [] { throw std::runtime_error("sampler failure"); });
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(200));
+	fast.stop();
+	slow.stop();
+	safe_cout("Fast sampler: " << fast.ticks() << " ticks (~20 expected), " << fast.missed() << " missed");
+	safe_cout("Slow sampler: " << slow.ticks() << " ticks, " << slow.missed() << " missed");
+	try {
+		if (failing.error())
+			std::rethrow_exception(failing.error());
+	}
+	catch (const std::exception& e) {
+		safe_cout("Failing sampler stopped (active: " << failing.active() << "): " << e.what());
+	}
+}
+
+void ScratchArenas()
+{
+	std::cout << "Scratch arenas:" << std::endl;
+	bhd::thread_pool pool(2);
+
+	//Per-task temporaries from the arena of the worker, released after each task
+	auto tasks = pool.enqueue_n(32, [](std::size_t i) {
+		auto& arena = bhd::scratch_arena::local();
+		const std::size_t n = 4096 * (1 + i % 4);
+		float* buffer = static_cast<float*>(arena.allocate(n * sizeof(float), 64));
+		for (std::size_t k = 0; k < n; k++)
+			buffer[k] = static_cast<float>(k);
+
+		{
+			//Nested scope: released at its end, the outer buffer stays valid
+			bhd::scratch_scope scope;
+			double* partial = static_cast<double*>(arena.allocate(n * sizeof(double)));
+			partial[0] = buffer[n - 1];
+		}
+		return arena.used();
+	});
+	const auto used = tasks.get();
+	safe_cout("Arena bytes used at the end of the first task: " << used.front());
+
+	auto after = pool.enqueue([] { return bhd::scratch_arena::local().used(); });
+	const std::size_t remaining = after.get();
+	safe_cout("Arena bytes used by a new task: " << remaining << " (0 expected)");
+}
+
+void OpenCVBackend()
+{
+	std::cout << "OpenCV backend:" << std::endl;
+	auto& pool = bhd::thread_pool::instance();
+	if (!bhd::set_opencv_parallel_backend(pool)) {
+		safe_cout("OpenCV older than 4.5.2: no parallel backend API");
+		return;
+	}
+	safe_cout("OpenCV threads: " << cv::getNumThreads() << " (pool workers + caller)");
+
+	//OpenCV loops nested in pool tasks share the same workers
+	cv::Mat image(2048, 2048, CV_32FC1);
+	cv::randu(image, 0.0f, 1.0f);
+	std::vector<bhd::threaded_task<double>> tasks;
+	for (int i = 0; i < 4; i++)
+		tasks.push_back(pool.enqueue([&image, i] {
+			cv::Mat blurred;
+			cv::GaussianBlur(image, blurred, cv::Size(2 * i + 3, 2 * i + 3), 0);
+			return cv::mean(blurred)[0];
+		}));
+	for (auto& task : tasks) {
+		const double mean = task.get();
+		safe_cout("Blurred mean: " << mean);
+	}
+}
+
+void StagePipeline()
+{
+	std::cout << "Stage pipeline:" << std::endl;
+
+	struct Frame
+	{
+		cv::Mat m_image;
+		cv::Mat m_mask;
+		std::vector<std::vector<cv::Point>> m_contours;
+	};
+
+	//denoise (2 workers) -> threshold -> contours, 4 frames at most between two stages
+	bhd::stage_pipeline<Frame> pipeline(4);
+	pipeline.add_stage("denoise", [](Frame& frame) { cv::GaussianBlur(frame.m_image, frame.m_image, cv::Size(9, 9), 0); }, 2);
+	pipeline.add_stage("threshold", [](Frame& frame) { cv::threshold(frame.m_image, frame.m_mask, 128, 255, cv::THRESH_BINARY); });
+	pipeline.add_stage("contours", [](Frame& frame) { cv::findContours(frame.m_mask, frame.m_contours, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE); });
+	pipeline.start();
+
+	std::thread camera([&pipeline] {
+		for (int i = 0; i < 100; i++)
+		{
+			Frame frame;
+			frame.m_image.create(480, 640, CV_8UC1);
+			cv::randu(frame.m_image, 0, 256);
+			pipeline.push(std::move(frame));
+		}
+		pipeline.close();
+	});
+
+	//Frames come out in the push order
+	std::size_t nframes = 0, ncontours = 0;
+	Frame frame;
+	while (pipeline.pop(frame))
+	{
+		nframes++;
+		ncontours += frame.m_contours.size();
+	}
+	camera.join();
+
+	safe_cout(nframes << " frames, " << ncontours << " contours");
+	safe_cout(pipeline.stats().to_string());
+}
+
+
 int main()
 {
 	//Simple task testing
@@ -177,6 +618,42 @@ int main()
 	//Some task create new tasks. Check if deadlock is avoided
 	TryDeadLock();
 
+	//Recursive enqueue / get from inside the pool
+	NestedTasks();
+
+	//parallel_for / parallel_reduce
+	ParallelLoops();
+
+	//then / when_all / when_any / task_graph
+	Continuations();
+
+	//TASK_PRIORITY / cancellation_token / deadline
+	PrioritiesAndCancellation();
+
+	//cpu_domains / topology_pool
+	Topology();
+
+	//Bounded thread_pool and overflow policies
+	BoundedQueue();
+
+	//co_await pool.schedule() / co_await threaded_task / bhd::task
+	Coroutines();
+
+	//POOL_STATS counters, histograms and Chrome trace
+	Instrumentation();
+
+	//schedule_after / schedule_every
+	Timers();
+
+	//scratch_arena / scratch_scope
+	ScratchArenas();
+
+	//cv::parallel_for_ on bhd::thread_pool
+	OpenCVBackend();
+
+	//Streaming stages connected by bounded lock-free queues
+	StagePipeline();
+
 	system("Pause");
 	return 0;
 }
\ No newline at end of file